@@ -72,8 +72,8 @@ cat out
 echo ""
 
 # Check if checkpoint was created
-if [ -f "checkpoint.txt" ]; then
-    echo "Checkpoint file created: checkpoint.txt"
+if [ -f "checkpoint.bin" ]; then
+    echo "Checkpoint file created: checkpoint.bin"
 fi
 
 # Show stderr output if needed
@@ -14,8 +14,10 @@ echo "Testing Ax=b Monte Carlo Solver"
 echo "======================================"
 echo
 
-# Generate test work units
+# Generate test work units. The matrix is random and its file is named
+# after its contents, so start from an empty directory to get exactly one.
 echo "Generating test matrix and work units..."
+rm -rf axb_test
 python3 ../tools/generate_axb_work.py \
     --dimension 5 \
     --num-work-units 3 \
@@ -26,18 +28,22 @@ python3 ../tools/generate_axb_work.py \
 echo
 echo "Building solver..."
 cd ../src
-gcc -o axb_montecarlo Axb-MonteCarlo.c -lm
+gcc -O2 -pthread -o axb_montecarlo Axb-MonteCarlo.c -lm
 cd ../examples
 
 echo
 echo "Running work units..."
 mkdir -p axb_test/results
 
-for wu_input in axb_test/axb_wu_*_input.txt; do
-    wu_name=$(basename "$wu_input" _input.txt)
-    echo "  Processing $wu_name..."
+# All work units share one matrix file and differ only in their parameters
+matrix=$(ls axb_test/axb_matrix_*.txt)
+echo "  Shared matrix: $matrix"
 
-    ../src/axb_montecarlo "$wu_input" "axb_test/results/${wu_name}_output.txt" \
+for wu_params in axb_test/axb_wu_*_params.txt; do
+    wu_name=$(basename "$wu_params" _params.txt)
+    echo "  Processing $wu_name ($(cat "$wu_params"))..."
+
+    ../src/axb_montecarlo "$matrix" "axb_test/results/${wu_name}_output.txt" "$wu_params" \
         > "axb_test/results/${wu_name}.log" 2>&1
 done
 
@@ -60,7 +66,8 @@ for result_file in sorted(glob.glob('axb_test/results/axb_wu_*_output.txt')):
     with open(result_file, 'r') as f:
         lines = f.readlines()
         start_idx, end_idx = map(int, lines[0].split())
-        values = [float(line.strip()) for line in lines[1:]]
+        # "value std_error" per line (older outputs have only the value)
+        values = [float(line.split()[0]) for line in lines[1:]]
         results.append((start_idx, end_idx, values))
 
 # Merge into complete solution
@@ -31,4 +31,41 @@ find ~/boinc_test/projects/upload -type f -name "*.txt" -o -name "*_0" | while r
     grep "Estimated value of PI" "$file" 2>/dev/null || echo "No PI value found"
 done
 
+# Performance counters of the successful results: the apps end stderr.txt
+# with "telemetry ..." lines (src/mc_telemetry.h), which the server keeps
+# in result.stderr_out. --raw keeps their line breaks.
+echo ""
+echo "Telemetry of successful results (per app)..."
+mysql -u $DB_USER -p"$DB_PASS" $DB_NAME --batch --raw --skip-column-names \
+    -e "SELECT stderr_out FROM result WHERE server_state = 5 AND outcome = 1" |
+awk '
+/^telemetry version/ { app = $5; n[app]++; threads[app] += $7; found = 1 }
+/^telemetry phases/ { read_s[app] += $4; compute[app] += $8; output[app] += $12 }
+/^telemetry checkpoints/ {
+    ckpts[app] += $3; ckpt_s[app] += $5
+    if ($7 > ckpt_max[app]) ckpt_max[app] = $7
+}
+/^telemetry samples/ { samples[app] += $3 }
+/^telemetry transitions/ { transitions[app] += $3 }
+/^telemetry walk_length_log2/ { for (k = 3; k <= NF; k++) hist[app, k - 3] += $k; bins[app] = NF - 2 }
+END {
+    if (!found) print "No telemetry found"
+    for (a in n) {
+        printf "\n=== %s: %d results, %.1f threads on average ===\n", a, n[a], threads[a] / n[a]
+        printf "Mean phase times: read %.2f s, compute %.2f s, output %.2f s\n",
+               read_s[a] / n[a], compute[a] / n[a], output[a] / n[a]
+        if (compute[a] > 0) printf "Samples per second of compute: %.4g\n", samples[a] / compute[a]
+        if (compute[a] > 0 && transitions[a] > 0)
+            printf "Transitions per second of compute: %.4g\n", transitions[a] / compute[a]
+        if (ckpts[a] > 0)
+            printf "Checkpoints: %d, mean write %.4f s, slowest %.4f s\n",
+                   ckpts[a], ckpt_s[a] / ckpts[a], ckpt_max[a]
+        if (bins[a] > 0) {
+            printf "Walk length histogram (states visited, all results):\n"
+            for (k = 0; k < bins[a]; k++)
+                if (hist[a, k] > 0) printf "  [%d, %d): %d\n", 2 ^ k, 2 ^ (k + 1), hist[a, k]
+        }
+    }
+}'
+
 echo ""
@@ -0,0 +1,613 @@
+/*
+ * axb_assimilator.cpp
+ *
+ * BOINC assimilator for the Ax=b Monte Carlo solver
+ * Writes validated partial solutions into one binary solution store per job
+ *
+ * All work units of a job share one matrix file (templates/axb_in.xml), so
+ * its name identifies the job. For each job the store directory holds:
+ *
+ *   <job>.sol       double x[n], component i at offset i * 8
+ *   <job>.se        double std_error[n], same layout (0 = not reported)
+ *   <job>.cov       coverage bitmap, bit i (byte i / 8, bit i % 8) set once
+ *                   component i has been written
+ *   <job>.csc       the matrix by columns: a binary input (src/axb_input.h)
+ *                   holding A^T and b, built from the matrix file once
+ *   <job>.ax        A x over the covered components: int64 n, int64 dirty
+ *                   flag, then double[n]
+ *   <job>.residual  ||Ax - b|| and ||Ax - b|| / ||b||, written once every
+ *                   component is covered and again whenever a later
+ *                   result changes x; for systems of up to
+ *                   --direct_max_dim rows also the largest difference
+ *                   from the direct solution (LU, src/mc_lu.h)
+ *
+ * Where the ranges of two work units overlap, the estimate with the
+ * smaller standard error is kept.
+ *
+ * The value files are allocated at full size when the first result of a
+ * job arrives and memory-mapped, so a work unit's range is copied straight
+ * to its place and analysis tools can read x for large n without parsing
+ * any text output, e.g. numpy.fromfile("<job>.sol"). The coverage bits are
+ * set only after the values are synced to disk, so a crash can lose a
+ * range (it is then simply missing) but never mark garbage as covered.
+ *
+ * The residual is built up as the ranges arrive: every component a result
+ * writes adds its change times column i of A (from <job>.csc) to <job>.ax,
+ * O(nnz of the range), so completing a job takes an O(n) pass instead of
+ * reparsing the matrix. If an update of .ax was interrupted (its dirty
+ * flag is still set), it is recomputed from .sol and .cov.
+ *
+ * Self-contained work units (templates/axb_single_in.xml) carry their own
+ * matrix, so each of them is a job of its own.
+ *
+ * Command line: --store_dir DIR (default ../axb_solutions),
+ *               --direct_max_dim N (default 1000, 0 for no direct solve)
+ *
+ * Licensed under GPL v3
+ */
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "filesys.h"
+#include "parse.h"
+#include "sched_config.h"
+#include "sched_msgs.h"
+#include "sched_util.h"
+#include "validate_util.h"
+#include "assimilate_handler.h"
+
+#include "axb_input.h"
+#include "axb_partial.h"
+#include "mc_csr.h"
+#include "mc_lu.h"
+
+using std::vector;
+using std::string;
+
+static string store_dir = "../axb_solutions";
+
+// Largest system whose merged solution is compared with a direct solve;
+// the dense copy takes 8 n^2 bytes and the LU about 2n^3/3 operations
+static long direct_max_dim = 1000;
+
+// A file of 'size' bytes, created and zero-filled if it does not exist,
+// mapped read-write. Returns NULL (and logs why) on failure.
+static void* map_store_file(const string& path, size_t size) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        log_messages.printf(MSG_CRITICAL, "Cannot open %s: %s\n", path.c_str(), strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (st.st_size != 0 && (size_t)st.st_size != size)) {
+        log_messages.printf(MSG_CRITICAL,
+            "%s has %ld bytes, expected %zu\n", path.c_str(), (long)st.st_size, size);
+        close(fd);
+        return NULL;
+    }
+
+    // Allocate the blocks now rather than on first touch of the mapping,
+    // where a full disk would be a SIGBUS instead of an error
+    if (st.st_size == 0) {
+        int retval = posix_fallocate(fd, 0, (off_t)size);
+        if (retval) {
+            log_messages.printf(MSG_CRITICAL,
+                "Cannot allocate %zu bytes for %s: %s\n", size, path.c_str(), strerror(retval));
+            close(fd);
+            return NULL;
+        }
+    }
+
+    void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        log_messages.printf(MSG_CRITICAL, "Cannot map %s: %s\n", path.c_str(), strerror(errno));
+        return NULL;
+    }
+    return base;
+}
+
+// Dimension of the system in a matrix file: the header of a binary input,
+// or the first line ("n" or "sparse n nnz") of a text one. Returns -1 if
+// it cannot be read.
+static long read_dimension(const char* path) {
+    axb_input_header_t header;
+    long n = -1;
+
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        log_messages.printf(MSG_CRITICAL, "Cannot open matrix file %s\n", path);
+        return -1;
+    }
+
+    size_t got = fread(&header, 1, sizeof(header), fp);
+    if (axb_input_is_binary(&header, got)) {
+        if (got == sizeof(header) && header.version == AXB_INPUT_VERSION) {
+            n = (long)header.n;
+        }
+    } else {
+        char token[32];
+        rewind(fp);
+        if (fscanf(fp, "%31s", token) == 1) {
+            if (strcmp(token, "sparse") == 0) {
+                if (fscanf(fp, "%ld", &n) != 1) n = -1;
+            } else if (sscanf(token, "%ld", &n) != 1) {
+                n = -1;
+            }
+        }
+    }
+    fclose(fp);
+
+    if (n <= 0 || n > INT_MAX) {
+        log_messages.printf(MSG_CRITICAL, "Cannot read the dimension of %s\n", path);
+        return -1;
+    }
+    return n;
+}
+
+// Column copy of a job's matrix, <job>.csc: a binary input (src/axb_input.h)
+// holding A^T, so "row" j of the copy lists the entries of column j of A,
+// followed by b. It is built from the matrix file when the first result of
+// the job arrives; later results only map it.
+struct MatrixCache {
+    void* base;
+    size_t size;
+    axb_input_view_t view;
+};
+
+// A^T as triplets and b, read from the text or binary matrix file at 'path'
+static int read_matrix_transposed(const char* path, long n, vector<int32_t>& rows,
+                                  vector<int32_t>& cols, vector<double>& vals,
+                                  vector<double>& b) {
+    axb_input_header_t header;
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        log_messages.printf(MSG_CRITICAL, "Cannot open matrix file %s\n", path);
+        return -1;
+    }
+    size_t got = fread(&header, 1, sizeof(header), fp);
+    b.assign(n, 0.0);
+
+    if (axb_input_is_binary(&header, got)) {
+        fclose(fp);
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            if (fd >= 0) close(fd);
+            return -1;
+        }
+        void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) return -1;
+
+        axb_input_view_t view;
+        const char* error = axb_input_open(base, (size_t)st.st_size, &view);
+        if (error || view.header->n != n) {
+            log_messages.printf(MSG_CRITICAL, "%s: %s\n", path, error ? error : "dimension changed");
+            munmap(base, (size_t)st.st_size);
+            return -1;
+        }
+        for (long i = 0; i < n; i++) {
+            for (int64_t k = view.row_ptr[i]; k < view.row_ptr[i + 1]; k++) {
+                rows.push_back(view.col[k]);
+                cols.push_back((int32_t)i);
+                vals.push_back(view.val[k]);
+            }
+            b[i] = view.b[i];
+        }
+        munmap(base, (size_t)st.st_size);
+        return 0;
+    }
+
+    char token[32];
+    long dim, nnz;
+    double v;
+    int retval = 0;
+
+    rewind(fp);
+    if (fscanf(fp, "%31s", token) != 1) {
+        retval = -1;
+    } else if (strcmp(token, "sparse") == 0) {
+        if (fscanf(fp, "%ld %ld", &dim, &nnz) != 2 || dim != n) {
+            retval = -1;
+        }
+        for (long k = 0; retval == 0 && k < nnz; k++) {
+            long i, j;
+            if (fscanf(fp, "%ld %ld %lf", &i, &j, &v) != 3 || i < 0 || i >= n || j < 0 || j >= n) {
+                retval = -1;
+                break;
+            }
+            rows.push_back((int32_t)j);
+            cols.push_back((int32_t)i);
+            vals.push_back(v);
+        }
+    } else {
+        if (sscanf(token, "%ld", &dim) != 1 || dim != n) {
+            retval = -1;
+        }
+        for (long i = 0; retval == 0 && i < n; i++) {
+            for (long j = 0; j < n; j++) {
+                if (fscanf(fp, "%lf", &v) != 1) {
+                    retval = -1;
+                    break;
+                }
+                if (v != 0.0) {
+                    rows.push_back((int32_t)j);
+                    cols.push_back((int32_t)i);
+                    vals.push_back(v);
+                }
+            }
+        }
+    }
+    for (long i = 0; retval == 0 && i < n; i++) {
+        if (fscanf(fp, "%lf", &b[i]) != 1) retval = -1;
+    }
+    fclose(fp);
+
+    if (retval < 0) {
+        log_messages.printf(MSG_CRITICAL, "Cannot read matrix file %s\n", path);
+    }
+    return retval;
+}
+
+// Write the column copy of the matrix file at 'matrix_path' to 'path'
+static int build_matrix_cache(const char* matrix_path, const string& path, long n) {
+    vector<int32_t> rows, cols;
+    vector<double> vals, b;
+    mc_csr_t t;
+
+    if (read_matrix_transposed(matrix_path, n, rows, cols, vals, b) < 0) return -1;
+    if (mc_csr_from_coo(&t, (int)n, (int64_t)vals.size(), rows.data(), cols.data(),
+                        vals.data()) < 0) {
+        log_messages.printf(MSG_CRITICAL, "Cannot allocate the column copy of %s\n", matrix_path);
+        return -1;
+    }
+
+    axb_input_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = AXB_INPUT_MAGIC;
+    header.version = AXB_INPUT_VERSION;
+    header.n = n;
+    header.nnz = t.nnz;
+    header.start_idx = 0;
+    header.end_idx = n - 1;
+    header.num_walks = 1;
+
+    size_t col_offset, val_offset, b_offset, total;
+    axb_input_layout(n, t.nnz, &col_offset, &val_offset, &b_offset, &total);
+    size_t padding = val_offset - col_offset - (size_t)t.nnz * sizeof(int32_t);
+    static const char zeros[8] = {0};
+
+    string tmp_path = path + ".tmp";
+    FILE* fp = fopen(tmp_path.c_str(), "wb");
+    bool ok = fp &&
+        fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(t.row_ptr, sizeof(int64_t), (size_t)n + 1, fp) == (size_t)n + 1 &&
+        fwrite(t.col, sizeof(int32_t), (size_t)t.nnz, fp) == (size_t)t.nnz &&
+        fwrite(zeros, 1, padding, fp) == padding &&
+        fwrite(t.val, sizeof(double), (size_t)t.nnz, fp) == (size_t)t.nnz &&
+        fwrite(b.data(), sizeof(double), (size_t)n, fp) == (size_t)n;
+    if (fp && fclose(fp) != 0) ok = false;
+    mc_csr_free(&t);
+
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        log_messages.printf(MSG_CRITICAL, "Cannot write %s\n", path.c_str());
+        unlink(tmp_path.c_str());
+        return -1;
+    }
+    log_messages.printf(MSG_NORMAL, "Built the column copy %s (%ld entries)\n",
+                        path.c_str(), (long)header.nnz);
+    return 0;
+}
+
+// Map the column copy of a job's matrix, building it first if it does not
+// exist or does not match the dimension. Returns 0 on success.
+static int open_matrix_cache(const string& job_path, const char* matrix_path, long n,
+                             MatrixCache& cache) {
+    string path = job_path + ".csc";
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (attempt > 0 || access(path.c_str(), F_OK) != 0) {
+            if (build_matrix_cache(matrix_path, path, n) < 0) return -1;
+        }
+
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            if (fd >= 0) close(fd);
+            continue;
+        }
+        cache.size = (size_t)st.st_size;
+        cache.base = mmap(NULL, cache.size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (cache.base == MAP_FAILED) continue;
+
+        const char* error = axb_input_open(cache.base, cache.size, &cache.view);
+        if (!error && cache.view.header->n == n) return 0;
+
+        log_messages.printf(MSG_NORMAL, "%s: %s, rebuilding it\n", path.c_str(),
+                            error ? error : "dimension changed");
+        munmap(cache.base, cache.size);
+    }
+    return -1;
+}
+
+static void close_matrix_cache(MatrixCache& cache) {
+    munmap(cache.base, cache.size);
+}
+
+// Add 'scale' times column j of A to ax
+static inline void add_column(const MatrixCache& cache, long j, double scale, double* ax) {
+    const axb_input_view_t& v = cache.view;
+    for (int64_t k = v.row_ptr[j]; k < v.row_ptr[j + 1]; k++) {
+        ax[v.col[k]] += v.val[k] * scale;
+    }
+}
+
+// Header of <job>.ax, which holds A x for the stored components. 'n' is
+// only set (and 'dirty' only cleared) once the vector matches the .sol and
+// .cov files on disk, so an update that was interrupted, or a store that
+// predates the file, is recomputed from them.
+struct AxHeader {
+    int64_t n;
+    int64_t dirty;
+};
+
+// Largest difference between x and the direct solution of the system in
+// 'cache', absolute and relative to the largest component of the direct
+// solution. Returns -1 if the matrix is singular or memory is exhausted.
+static int direct_error(const MatrixCache& cache, const double* x, long n, double& max_error,
+                        double& relative_error) {
+    const axb_input_view_t& v = cache.view;
+    vector<double> A((size_t)n * n, 0.0);
+    mc_lu_t lu;
+
+    for (long j = 0; j < n; j++) {
+        for (int64_t k = v.row_ptr[j]; k < v.row_ptr[j + 1]; k++) {
+            A[(size_t)v.col[k] * n + j] = v.val[k];
+        }
+    }
+    if (mc_lu_alloc(&lu, (int)n) < 0) return -1;
+
+    int retval = mc_lu_factor(&lu, A.data(), (size_t)n, NULL);
+    if (retval == 0) {
+        vector<double> x_direct(n);
+        double max_value = 0.0;
+
+        mc_lu_solve(&lu, v.b, x_direct.data());
+        max_error = 0.0;
+        for (long i = 0; i < n; i++) {
+            max_error = std::max(max_error, fabs(x[i] - x_direct[i]));
+            max_value = std::max(max_value, fabs(x_direct[i]));
+        }
+        relative_error = max_value > 0 ? max_error / max_value : max_error;
+    }
+    mc_lu_free(&lu);
+    return retval == 0 ? 0 : -1;
+}
+
+// Write <job>.residual for the complete solution x, whose product with A
+// is ax: O(n), plus the direct solve for small systems
+static int write_residual(const string& job_path, const MatrixCache& cache, const double* x,
+                          const double* ax, long n) {
+    double norm = 0.0, b_norm = 0.0;
+    for (long i = 0; i < n; i++) {
+        double r = ax[i] - cache.view.b[i];
+        norm += r * r;
+        b_norm += cache.view.b[i] * cache.view.b[i];
+    }
+    norm = sqrt(norm);
+    b_norm = sqrt(b_norm);
+
+    bool direct = n <= direct_max_dim;
+    double max_error = 0.0, relative_error = 0.0;
+    if (direct && direct_error(cache, x, n, max_error, relative_error) < 0) {
+        log_messages.printf(MSG_NORMAL, "Solution %s: no direct solve, the matrix is singular\n",
+                            job_path.c_str());
+        direct = false;
+    }
+
+    string path = job_path + ".residual";
+    string tmp_path = path + ".tmp";
+    FILE* fp = fopen(tmp_path.c_str(), "w");
+    if (!fp) {
+        log_messages.printf(MSG_CRITICAL, "Cannot create %s\n", tmp_path.c_str());
+        return -1;
+    }
+    fprintf(fp, "n %ld\n", n);
+    fprintf(fp, "residual %.15e\n", norm);
+    fprintf(fp, "relative_residual %.15e\n", b_norm > 0 ? norm / b_norm : norm);
+    if (direct) {
+        fprintf(fp, "direct_max_error %.15e\n", max_error);
+        fprintf(fp, "direct_relative_error %.15e\n", relative_error);
+    }
+    if (fclose(fp) != 0 || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        log_messages.printf(MSG_CRITICAL, "Cannot write %s\n", path.c_str());
+        return -1;
+    }
+
+    log_messages.printf(MSG_NORMAL,
+        "Solution %s complete: ||Ax - b|| = %.6e (relative %.6e)\n",
+        job_path.c_str(), norm, b_norm > 0 ? norm / b_norm : norm);
+    if (direct) {
+        log_messages.printf(MSG_NORMAL,
+            "Solution %s: max |x - x_direct| = %.6e (relative %.6e)\n",
+            job_path.c_str(), max_error, relative_error);
+    }
+    return 0;
+}
+
+// Copy a partial solution into the store of its job, add the change of
+// the stored x times the matching columns of A to A x and, once every
+// component is covered, write the residual
+static int store_solution(const string& job, const char* matrix_path, long n,
+                          const PartialSolution& sol) {
+    string job_path = store_dir + "/" + job;
+    size_t bitmap_size = (size_t)(n + 7) / 8;
+    size_t ax_size = sizeof(AxHeader) + (size_t)n * sizeof(double);
+    int retval = -1;
+
+    if (sol.end_idx >= n) {
+        log_messages.printf(MSG_CRITICAL,
+            "Components %d-%d are outside the %ld-dimensional system of %s\n",
+            sol.start_idx, sol.end_idx, n, job.c_str());
+        return -1;
+    }
+
+    // One assimilator at a time per job: the lock on the bitmap guards
+    // the creation of the files, the coverage and the residual
+    string cov_path = job_path + ".cov";
+    int lock_fd = open(cov_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (lock_fd < 0 || flock(lock_fd, LOCK_EX) < 0) {
+        log_messages.printf(MSG_CRITICAL, "Cannot lock %s: %s\n", cov_path.c_str(), strerror(errno));
+        if (lock_fd >= 0) close(lock_fd);
+        return -1;
+    }
+
+    MatrixCache cache;
+    bool have_cache = open_matrix_cache(job_path, matrix_path, n, cache) == 0;
+    double* x = (double*)map_store_file(job_path + ".sol", (size_t)n * sizeof(double));
+    double* se = (double*)map_store_file(job_path + ".se", (size_t)n * sizeof(double));
+    unsigned char* covered = (unsigned char*)map_store_file(cov_path, bitmap_size);
+    AxHeader* ax_header = (AxHeader*)map_store_file(job_path + ".ax", ax_size);
+    double* ax = ax_header ? (double*)(ax_header + 1) : NULL;
+    bool changed = false;
+
+    if (have_cache && x && se && covered && ax) {
+        // Mark A x as being updated before touching it
+        bool ax_valid = ax_header->n == n && !ax_header->dirty;
+        ax_header->dirty = 1;
+        msync(ax_header, sizeof(AxHeader), MS_SYNC);
+
+        if (!ax_valid) {
+            std::fill(ax, ax + n, 0.0);
+            for (long j = 0; j < n; j++) {
+                if (covered[j / 8] & (1u << (j % 8))) add_column(cache, j, x[j], ax);
+            }
+        }
+
+        // A component already covered by another work unit keeps the
+        // estimate with the smaller standard error
+        for (int i = sol.start_idx; i <= sol.end_idx; i++) {
+            double new_se = sol.std_errors[i - sol.start_idx];
+            bool have = covered[i / 8] & (1u << (i % 8));
+            if (!have || (new_se > 0 && (se[i] == 0 || new_se < se[i]))) {
+                double value = sol.values[i - sol.start_idx];
+                add_column(cache, i, value - (have ? x[i] : 0.0), ax);
+                x[i] = value;
+                se[i] = new_se;
+                changed = true;
+            }
+        }
+
+        if (msync(x, (size_t)n * sizeof(double), MS_SYNC) == 0 &&
+            msync(se, (size_t)n * sizeof(double), MS_SYNC) == 0) {
+            for (int i = sol.start_idx; i <= sol.end_idx; i++) {
+                covered[i / 8] |= (unsigned char)(1u << (i % 8));
+            }
+            msync(covered, bitmap_size, MS_SYNC);
+            if (msync(ax_header, ax_size, MS_SYNC) == 0) {
+                ax_header->n = n;
+                ax_header->dirty = 0;
+                msync(ax_header, sizeof(AxHeader), MS_SYNC);
+            }
+            retval = 0;
+        } else {
+            log_messages.printf(MSG_CRITICAL, "Cannot sync %s: %s\n", job_path.c_str(), strerror(errno));
+        }
+    }
+
+    // Residual once every component is covered, again whenever a later
+    // result improves the stored solution
+    if (retval == 0) {
+        long num_covered = 0;
+        for (size_t k = 0; k < bitmap_size; k++) {
+            num_covered += __builtin_popcount(covered[k]);
+        }
+
+        string residual_path = job_path + ".residual";
+        if (num_covered == n && (changed || access(residual_path.c_str(), F_OK) != 0)) {
+            write_residual(job_path, cache, x, ax, n);
+        } else {
+            log_messages.printf(MSG_DEBUG,
+                "%s: %ld of %ld components covered\n", job.c_str(), num_covered, n);
+        }
+    }
+
+    if (x) munmap(x, (size_t)n * sizeof(double));
+    if (se) munmap(se, (size_t)n * sizeof(double));
+    if (covered) munmap(covered, bitmap_size);
+    if (ax_header) munmap(ax_header, ax_size);
+    if (have_cache) close_matrix_cache(cache);
+    close(lock_fd);     // Releases the lock
+    return retval;
+}
+
+int assimilate_handler_init(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--store_dir") && i + 1 < argc) {
+            store_dir = argv[++i];
+        } else if (!strcmp(argv[i], "--direct_max_dim") && i + 1 < argc) {
+            direct_max_dim = atol(argv[++i]);
+        }
+    }
+
+    if (mkdir(store_dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        log_messages.printf(MSG_CRITICAL, "Cannot create %s: %s\n", store_dir.c_str(), strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void assimilate_handler_usage() {
+    fprintf(stderr,
+        "    --store_dir DIR   Directory of the solution stores (default ../axb_solutions)\n"
+        "    --direct_max_dim N  Compare solutions of up to N rows with a direct solve\n"
+        "                      (default 1000, 0: never)\n");
+}
+
+int assimilate_handler(WORKUNIT& wu, vector<RESULT>& results, RESULT& canonical_result) {
+    char path[MAXPATHLEN];
+    string name;
+
+    if (!wu.canonical_resultid) {
+        log_messages.printf(MSG_NORMAL, "Work unit %s has no canonical result\n", wu.name);
+        return 0;
+    }
+
+    // The shared matrix names the job; a self-contained input is its own
+    if (!find_input_file(wu, "matrix", name) && !find_input_file(wu, "input.txt", name)) {
+        log_messages.printf(MSG_CRITICAL, "No input file in work unit %s\n", wu.name);
+        return -1;
+    }
+    dir_hier_path(name.c_str(), sched_config.download_dir, sched_config.uldl_dir_fanout, path);
+
+    long n = read_dimension(path);
+    if (n < 0) return -1;
+
+    PartialSolution* sol = load_result(canonical_result);
+    if (!sol) return -1;
+
+    int retval = store_solution(name, path, n, *sol);
+    delete sol;
+
+    if (retval == 0) {
+        log_messages.printf(MSG_NORMAL,
+            "Work unit %s: components stored in %s/%s.sol\n", wu.name, store_dir.c_str(), name.c_str());
+    }
+    return retval;
+}
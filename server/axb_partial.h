@@ -0,0 +1,168 @@
+/*
+ * axb_partial.h
+ *
+ * Partial solutions of the Ax=b Monte Carlo solver on the server
+ *
+ * A result holds components start_idx .. end_idx of x, one
+ * "value [std_error]" line each after a "start_idx end_idx" line
+ * (src/Axb-MonteCarlo.c, write_output), or the same numbers as one binary
+ * record (src/mc_result.h), which is read with a single fread and used
+ * without parsing. Shared by axb_validator.cpp and axb_assimilator.cpp,
+ * which both include the BOINC scheduler headers before this one.
+ *
+ * Licensed under GPL v3
+ */
+
+#ifndef AXB_PARTIAL_H
+#define AXB_PARTIAL_H
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "mc_result.h"
+
+// Structure to hold partial solution from one work unit
+struct PartialSolution {
+    int start_idx;
+    int end_idx;
+    std::vector<double> values;
+    std::vector<double> std_errors;  // 0 where the result gives none
+};
+
+// Take the partial solution from a binary result record of 'size' bytes
+inline int decode_result(const void* record, size_t size, const char* path,
+                         PartialSolution& sol) {
+    const void* entries;
+    const char* problem = mc_result_open(record, size, MC_RESULT_APP_AXB,
+                                         sizeof(mc_result_axb_t), &entries);
+    if (problem) {
+        log_messages.printf(MSG_CRITICAL, "Invalid binary result %s: %s\n", path, problem);
+        return -1;
+    }
+
+    const mc_result_header_t* header = (const mc_result_header_t*)record;
+    const mc_result_axb_t* components = (const mc_result_axb_t*)entries;
+    if (header->start_idx < 0 || header->end_idx < header->start_idx ||
+        header->end_idx > INT32_MAX ||
+        header->count != (uint64_t)(header->end_idx - header->start_idx + 1)) {
+        log_messages.printf(MSG_CRITICAL, "Invalid component range in %s\n", path);
+        return -1;
+    }
+
+    sol.start_idx = (int)header->start_idx;
+    sol.end_idx = (int)header->end_idx;
+    sol.values.resize(header->count);
+    sol.std_errors.resize(header->count);
+    for (size_t i = 0; i < header->count; i++) {
+        if (!std::isfinite(components[i].value) || !(components[i].std_error >= 0.0) ||
+            components[i].samples < 0) {
+            log_messages.printf(MSG_CRITICAL, "Invalid value %zu in %s\n", i, path);
+            return -1;
+        }
+        sol.values[i] = components[i].value;
+        sol.std_errors[i] = components[i].std_error;
+    }
+    return 0;
+}
+
+// Parse output file to extract partial solution
+inline int parse_result(const char* path, PartialSolution& sol) {
+    size_t size;
+    void* record = mc_result_load(path, &size);
+    if (record && mc_result_is_binary(record, size)) {
+        int retval = decode_result(record, size, path, sol);
+        free(record);
+        return retval;
+    }
+    free(record);
+
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        log_messages.printf(MSG_CRITICAL, "Cannot open result file %s\n", path);
+        return -1;
+    }
+
+    // Read component range
+    char line[256];
+    if (!fgets(line, sizeof(line), fp) ||
+        sscanf(line, "%d %d", &sol.start_idx, &sol.end_idx) != 2 ||
+        sol.start_idx < 0 || sol.end_idx < sol.start_idx) {
+        log_messages.printf(MSG_CRITICAL, "Cannot read component range from %s\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    // Read values, one "value [std_error]" line per component
+    int num_components = sol.end_idx - sol.start_idx + 1;
+    sol.values.resize(num_components);
+    sol.std_errors.assign(num_components, 0.0);
+
+    for (int i = 0; i < num_components; i++) {
+        if (!fgets(line, sizeof(line), fp) ||
+            sscanf(line, "%lf %lf", &sol.values[i], &sol.std_errors[i]) < 1 ||
+            !std::isfinite(sol.values[i]) || !(sol.std_errors[i] >= 0.0)) {
+            log_messages.printf(MSG_CRITICAL,
+                "Cannot read value %d from %s\n", i, path);
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+// Parse the first output file of a result. Returns NULL (and logs why)
+// if it cannot be read.
+inline PartialSolution* load_result(RESULT& result) {
+    std::vector<OUTPUT_FILE_INFO> files;
+    int retval = get_output_file_infos(result, files);
+    if (retval) {
+        log_messages.printf(MSG_CRITICAL,
+            "Cannot get output files for result %lu\n", result.id);
+        return NULL;
+    }
+
+    if (files.empty()) {
+        log_messages.printf(MSG_CRITICAL,
+            "No output files for result %lu\n", result.id);
+        return NULL;
+    }
+
+    PartialSolution* sol = new PartialSolution;
+    if (parse_result(files[0].path.c_str(), *sol) < 0) {
+        log_messages.printf(MSG_CRITICAL,
+            "Cannot parse result %lu\n", result.id);
+        delete sol;
+        return NULL;
+    }
+    return sol;
+}
+
+// Find the physical name of the work unit input opened as 'open_name'
+// (a <file_ref> of the work unit description). Returns false if none.
+inline bool find_input_file(WORKUNIT& wu, const char* open_name, std::string& name) {
+    std::string doc(wu.xml_doc);
+    std::string tag = std::string("<open_name>") + open_name + "</open_name>";
+
+    size_t ref = 0;
+    while ((ref = doc.find("<file_ref>", ref)) != std::string::npos) {
+        size_t ref_end = doc.find("</file_ref>", ref);
+        if (ref_end == std::string::npos) break;
+
+        std::string block = doc.substr(ref, ref_end - ref);
+        char file_name[256];
+        if (block.find(tag) != std::string::npos &&
+            parse_str(block.c_str(), "<file_name>", file_name, sizeof(file_name))) {
+            name = file_name;
+            return true;
+        }
+        ref = ref_end;
+    }
+    return false;
+}
+
+#endif
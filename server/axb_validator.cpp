@@ -7,67 +7,120 @@
  * Each work unit computes a subset of solution components.
  * The validator collects all components and verifies the complete solution.
  *
+ * Results report a standard error next to every value, so two estimates
+ * of a component are compared by how many standard errors they differ.
+ *
+ * Every output file is parsed once, by init_result(), whether it is text
+ * or a binary record (src/mc_result.h, read in one fread); the parsed partial
+ * solution travels with the result as its data pointer and is what
+ * compare_results() and check_set() work on. Coverage is a list of
+ * component ranges sorted by their start, merged in one sweep, so the
+ * cost grows with the number of results and overlapping components, not
+ * with the number of components times the number of results.
+ *
  * Licensed under GPL v3
  */
 
 #include <vector>
-#include <map>
+#include <string>
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <cstring>
 
+#include "filesys.h"
+#include "parse.h"
 #include "sched_config.h"
 #include "sched_util.h"
 #include "validate_util.h"
 #include "validator.h"
 
+#include "axb_input.h"
+#include "axb_params.h"
+#include "axb_partial.h"
+#include "telemetry.h"
+
 using std::vector;
-using std::map;
-
-// Structure to hold partial solution from one work unit
-struct PartialSolution {
-    int start_idx;
-    int end_idx;
-    vector<double> values;
-};
-
-// Parse output file to extract partial solution
-int parse_result(const char* path, PartialSolution& sol) {
-    FILE* fp = fopen(path, "r");
+
+// Two estimates of a component agree if they differ by at most this many
+// combined standard errors. For normally distributed estimates a correct
+// result fails this with probability about 6e-7 per component.
+#define MAX_Z_SCORE 5.0
+
+// Relative tolerance for results without standard errors (older clients)
+#define RELATIVE_TOLERANCE 0.01
+
+// Read the component range of a work unit: from its parameter file when
+// it shares a matrix (src/axb_params.h), otherwise from the header of its
+// binary input file (src/axb_input.h).
+// Returns 0 on success, 1 if the input is in a text format (no header),
+// -1 if the input file cannot be read.
+int get_wu_range(WORKUNIT& wu, int& start_idx, int& end_idx) {
+    char path[MAXPATHLEN], error[256];
+    std::string name;
+    axb_input_header_t header;
+    axb_params_t params;
+
+    if (find_input_file(wu, "params", name)) {
+        dir_hier_path(name.c_str(), sched_config.download_dir, sched_config.uldl_dir_fanout, path);
+        if (axb_params_read(path, &params, error, sizeof(error)) < 0) {
+            log_messages.printf(MSG_CRITICAL, "Work unit %s: %s\n", wu.name, error);
+            return -1;
+        }
+        start_idx = (int)params.start_idx;
+        end_idx = (int)params.end_idx;
+        return 0;
+    }
+
+    if (!find_input_file(wu, "input.txt", name)) {
+        log_messages.printf(MSG_CRITICAL, "No input file in work unit %s\n", wu.name);
+        return -1;
+    }
+    dir_hier_path(name.c_str(), sched_config.download_dir, sched_config.uldl_dir_fanout, path);
+
+    FILE* fp = fopen(path, "rb");
     if (!fp) {
-        log_messages.printf(MSG_CRITICAL, "Cannot open result file %s\n", path);
+        log_messages.printf(MSG_CRITICAL, "Cannot open input file %s\n", path);
         return -1;
     }
+    size_t got = fread(&header, 1, sizeof(header), fp);
+    fclose(fp);
 
-    // Read component range
-    if (fscanf(fp, "%d %d", &sol.start_idx, &sol.end_idx) != 2) {
-        log_messages.printf(MSG_CRITICAL, "Cannot read component range from %s\n", path);
-        fclose(fp);
+    if (!axb_input_is_binary(&header, got)) {
+        return 1;
+    }
+    if (got != sizeof(header) || header.version != AXB_INPUT_VERSION) {
+        log_messages.printf(MSG_CRITICAL, "Unsupported binary input %s\n", path);
         return -1;
     }
 
-    // Read values
-    int num_components = sol.end_idx - sol.start_idx + 1;
-    sol.values.resize(num_components);
+    start_idx = (int)header.start_idx;
+    end_idx = (int)header.end_idx;
+    return 0;
+}
+
+// Do two estimates of a component agree? 'error' is set to their
+// difference in combined standard errors, or to the relative difference
+// if neither has a standard error.
+bool values_agree(double v1, double se1, double v2, double se2, double& error) {
+    double diff = fabs(v1 - v2);
+    double se = sqrt(se1 * se1 + se2 * se2);
 
-    for (int i = 0; i < num_components; i++) {
-        if (fscanf(fp, "%lf", &sol.values[i]) != 1) {
-            log_messages.printf(MSG_CRITICAL,
-                "Cannot read value %d from %s\n", i, path);
-            fclose(fp);
-            return -1;
-        }
+    if (se > 0) {
+        error = diff / se;
+        return error <= MAX_Z_SCORE;
     }
 
-    fclose(fp);
-    return 0;
+    // Use relative error if values are not too small
+    double avg = (fabs(v1) + fabs(v2)) / 2.0;
+    error = (avg > 1e-10) ? (diff / avg) : diff;
+    return error <= RELATIVE_TOLERANCE;
 }
 
 // Compare two partial solutions for the same component range
-// Returns true if they agree within tolerance
+// Returns true if they agree within their standard errors
 bool compare_partial_solutions(const PartialSolution& sol1,
-                               const PartialSolution& sol2,
-                               double tolerance = 0.01) {
+                               const PartialSolution& sol2) {
 
     if (sol1.start_idx != sol2.start_idx || sol1.end_idx != sol2.end_idx) {
         return false;  // Different ranges
@@ -79,13 +132,10 @@ bool compare_partial_solutions(const PartialSolution& sol1,
 
     // Compare values component by component
     for (size_t i = 0; i < sol1.values.size(); i++) {
-        double diff = fabs(sol1.values[i] - sol2.values[i]);
-        double avg = (fabs(sol1.values[i]) + fabs(sol2.values[i])) / 2.0;
+        double error;
 
-        // Use relative error if values are not too small
-        double error = (avg > 1e-10) ? (diff / avg) : diff;
-
-        if (error > tolerance) {
+        if (!values_agree(sol1.values[i], sol1.std_errors[i],
+                          sol2.values[i], sol2.std_errors[i], error)) {
             log_messages.printf(MSG_NORMAL,
                 "Component %d differs: %.10e vs %.10e (error: %.10e)\n",
                 sol1.start_idx + (int)i, sol1.values[i], sol2.values[i], error);
@@ -96,68 +146,85 @@ bool compare_partial_solutions(const PartialSolution& sol1,
     return true;
 }
 
-// Check if a set of results form a complete, valid solution
-int check_set(
+// Compare the components two partial solutions have in common.
+// Returns false (and logs the first difference) if any of them disagree.
+bool compare_overlap(const PartialSolution& sol, const PartialSolution& prev) {
+    int first = std::max(sol.start_idx, prev.start_idx);
+    int last = std::min(sol.end_idx, prev.end_idx);
+
+    for (int idx = first; idx <= last; idx++) {
+        int local_idx = idx - sol.start_idx;
+        int prev_local_idx = idx - prev.start_idx;
+        double error;
+
+        if (!values_agree(sol.values[local_idx], sol.std_errors[local_idx],
+                          prev.values[prev_local_idx], prev.std_errors[prev_local_idx],
+                          error)) {
+            log_messages.printf(MSG_NORMAL,
+                "Inconsistent values for component %d: %.10e vs %.10e (error: %.3e)\n",
+                idx, sol.values[local_idx], prev.values[prev_local_idx], error);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Merge the partial solutions of a set of results and check that they
+// form a complete, valid solution. 'data' holds the partial solution
+// init_result() parsed for each result (NULL where it could not).
+int merge_solutions(
     vector<RESULT>& results,
+    const vector<void*>& data,
     WORKUNIT& wu,
-    int& canonicalid,
+    DB_ID_TYPE& canonicalid,
     double& credit,
     bool& retry
 ) {
     retry = false;
 
-    // Parse all results
-    vector<PartialSolution> solutions;
-    map<int, int> component_coverage;  // Maps component index to solution index
+    // Component range the work unit asked for, if its input says so
+    int wu_start = -1, wu_end = -1;
+    bool wu_range_known = (get_wu_range(wu, wu_start, wu_end) == 0);
 
+    // Results in order of their first component (by result order on ties)
+    vector<size_t> order;
     for (size_t i = 0; i < results.size(); i++) {
-        PartialSolution sol;
-
-        // Get output file path
-        vector<OUTPUT_FILE_INFO> files;
-        int retval = get_output_file_infos(results[i], files);
-        if (retval) {
-            log_messages.printf(MSG_CRITICAL,
-                "Cannot get output files for result %lu\n", results[i].id);
-            continue;
-        }
+        const PartialSolution* sol = (const PartialSolution*)data[i];
+        if (!sol) continue;
 
-        if (files.empty()) {
-            log_messages.printf(MSG_CRITICAL,
-                "No output files for result %lu\n", results[i].id);
+        // A result must cover exactly the range of its work unit
+        if (wu_range_known && (sol->start_idx != wu_start || sol->end_idx != wu_end)) {
+            log_messages.printf(MSG_NORMAL,
+                "Result %lu covers components %d-%d, work unit asks for %d-%d\n",
+                results[i].id, sol->start_idx, sol->end_idx, wu_start, wu_end);
             continue;
         }
-
-        // Parse the output file
-        if (parse_result(files[0].path.c_str(), sol) < 0) {
-            log_messages.printf(MSG_CRITICAL,
-                "Cannot parse result %lu\n", results[i].id);
-            continue;
+        order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&data](size_t a, size_t b) {
+        return ((const PartialSolution*)data[a])->start_idx <
+               ((const PartialSolution*)data[b])->start_idx;
+    });
+
+    // Sweep over the ranges. 'active' holds the accepted results that may
+    // still overlap the next one (their end is not before its start).
+    vector<size_t> accepted, active;
+    for (size_t i : order) {
+        const PartialSolution& sol = *(const PartialSolution*)data[i];
+
+        size_t kept = 0;
+        for (size_t a : active) {
+            if (((const PartialSolution*)data[a])->end_idx >= sol.start_idx) {
+                active[kept++] = a;
+            }
         }
+        active.resize(kept);
 
-        // Check for overlap with existing solutions
         bool valid = true;
-        for (int idx = sol.start_idx; idx <= sol.end_idx; idx++) {
-            if (component_coverage.find(idx) != component_coverage.end()) {
-                // Component already covered - verify consistency
-                int prev_sol_idx = component_coverage[idx];
-                int local_idx = idx - sol.start_idx;
-                int prev_local_idx = idx - solutions[prev_sol_idx].start_idx;
-
-                double diff = fabs(sol.values[local_idx] -
-                                  solutions[prev_sol_idx].values[prev_local_idx]);
-                double avg = (fabs(sol.values[local_idx]) +
-                             fabs(solutions[prev_sol_idx].values[prev_local_idx])) / 2.0;
-                double error = (avg > 1e-10) ? (diff / avg) : diff;
-
-                if (error > 0.01) {  // 1% tolerance
-                    log_messages.printf(MSG_NORMAL,
-                        "Inconsistent values for component %d: %.10e vs %.10e\n",
-                        idx, sol.values[local_idx],
-                        solutions[prev_sol_idx].values[prev_local_idx]);
-                    valid = false;
-                    break;
-                }
+        for (size_t a : active) {
+            if (!compare_overlap(sol, *(const PartialSolution*)data[a])) {
+                valid = false;
+                break;
             }
         }
 
@@ -165,35 +232,49 @@ int check_set(
             continue;  // Skip this result due to inconsistency
         }
 
-        // Add solution and mark components as covered
-        int sol_idx = solutions.size();
-        solutions.push_back(sol);
-
-        for (int idx = sol.start_idx; idx <= sol.end_idx; idx++) {
-            component_coverage[idx] = sol_idx;
-        }
+        accepted.push_back(i);
+        active.push_back(i);
     }
 
-    if (solutions.empty()) {
+    if (accepted.empty()) {
         log_messages.printf(MSG_CRITICAL, "No valid results in set\n");
         retry = true;
         return -1;
     }
 
     // Check if we have complete coverage
-    // Determine the full range needed (assume components 0 to max_idx)
+    // Determine the full range needed (the work unit's range when its
+    // input tells us, components 0 to max_idx otherwise)
+    int min_idx = 0;
     int max_idx = 0;
-    for (const auto& sol : solutions) {
-        if (sol.end_idx > max_idx) max_idx = sol.end_idx;
+    if (wu_range_known) {
+        min_idx = wu_start;
+        max_idx = wu_end;
+    } else {
+        for (size_t i : accepted) {
+            const PartialSolution* sol = (const PartialSolution*)data[i];
+            if (sol->end_idx > max_idx) max_idx = sol->end_idx;
+        }
     }
 
+    // 'accepted' is sorted by start, so gaps show up in one pass
     bool complete = true;
-    for (int idx = 0; idx <= max_idx; idx++) {
-        if (component_coverage.find(idx) == component_coverage.end()) {
+    int covered = min_idx;          // Components before this are covered
+    for (size_t i : accepted) {
+        const PartialSolution* sol = (const PartialSolution*)data[i];
+        if (sol->start_idx > covered) {
             log_messages.printf(MSG_NORMAL,
-                "Component %d not covered by any result\n", idx);
+                "Components %d-%d not covered by any result\n",
+                covered, std::min(sol->start_idx - 1, max_idx));
             complete = false;
         }
+        covered = std::max(covered, sol->end_idx + 1);
+        if (covered > max_idx) break;
+    }
+    if (covered <= max_idx) {
+        log_messages.printf(MSG_NORMAL,
+            "Components %d-%d not covered by any result\n", covered, max_idx);
+        complete = false;
     }
 
     if (!complete) {
@@ -203,91 +284,111 @@ int check_set(
         return -1;
     }
 
-    // Success! Mark first result as canonical
-    canonicalid = results[0].id;
+    // Success! Mark the first accepted result (in result order) as
+    // canonical, the accepted ones valid and the inconsistent ones invalid
+    canonicalid = results[*std::min_element(accepted.begin(), accepted.end())].id;
+
+    for (size_t i = 0; i < results.size(); i++) {
+        if (data[i]) results[i].validate_state = VALIDATE_STATE_INVALID;
+    }
+    for (size_t i : accepted) {
+        results[i].validate_state = VALIDATE_STATE_VALID;
+    }
 
     // Grant credit based on computational effort
     // More components or more work gets more credit
     credit = 0;
-    for (const auto& sol : solutions) {
-        int num_components = sol.end_idx - sol.start_idx + 1;
+    for (size_t i : accepted) {
+        const PartialSolution* sol = (const PartialSolution*)data[i];
+        int num_components = sol->end_idx - sol->start_idx + 1;
         credit += num_components * 10.0;  // 10 credits per component
     }
 
     log_messages.printf(MSG_NORMAL,
         "Valid complete solution with %zu partial results, granting %.2f credits\n",
-        solutions.size(), credit);
+        accepted.size(), credit);
 
     return 0;
 }
 
-// Required BOINC validator function
+// Required BOINC validator function: parse the output once and keep the
+// partial solution as the result's data
 int init_result(RESULT& result, void*& data) {
-    return 0;
+    data = load_result(result);
+    return data ? 0 : -1;
 }
 
 // Required BOINC validator function
 int compare_results(RESULT& r1, void* data1, RESULT& r2, void* data2, bool& match) {
-    PartialSolution sol1, sol2;
-
-    // Get output files
-    vector<OUTPUT_FILE_INFO> files1, files2;
-    get_output_file_infos(r1, files1);
-    get_output_file_infos(r2, files2);
-
-    if (files1.empty() || files2.empty()) {
-        match = false;
-        return 0;
-    }
-
-    // Parse results
-    if (parse_result(files1[0].path.c_str(), sol1) < 0 ||
-        parse_result(files2[0].path.c_str(), sol2) < 0) {
+    // Results init_result() could not parse never match
+    if (!data1 || !data2) {
         match = false;
         return 0;
     }
 
-    // Compare
-    match = compare_partial_solutions(sol1, sol2);
-
+    match = compare_partial_solutions(*(const PartialSolution*)data1,
+                                      *(const PartialSolution*)data2);
     return 0;
 }
 
 // Required BOINC validator function
 int cleanup_result(RESULT const& result, void* data) {
+    delete (PartialSolution*)data;
     return 0;
 }
 
-// Main validator entry point
-int main(int argc, char** argv) {
-    int retval;
-
-    retval = sched_config.parse_file();
-    if (retval) {
-        log_messages.printf(MSG_CRITICAL,
-            "Cannot parse config file: %d\n", retval);
-        return retval;
+// Check if a set of results form a complete, valid solution. Each output
+// is parsed once, here, and the parsed solutions are shared by all the
+// comparisons of the sweep.
+int check_set(
+    vector<RESULT>& results,
+    WORKUNIT& wu,
+    DB_ID_TYPE& canonicalid,
+    double& credit,
+    bool& retry
+) {
+    vector<void*> data(results.size(), NULL);
+    for (size_t i = 0; i < results.size(); i++) {
+        log_telemetry(results[i], "[axb_validator]");
+        if (init_result(results[i], data[i])) {
+            results[i].outcome = RESULT_OUTCOME_VALIDATE_ERROR;
+            results[i].validate_state = VALIDATE_STATE_INVALID;
+        }
     }
 
-    retval = boinc_db.open(
-        sched_config.db_name,
-        sched_config.db_host,
-        sched_config.db_user,
-        sched_config.db_passwd
-    );
-    if (retval) {
-        log_messages.printf(MSG_CRITICAL, "Cannot open database: %d\n", retval);
-        return retval;
+    int retval = merge_solutions(results, data, wu, canonicalid, credit, retry);
+
+    for (size_t i = 0; i < results.size(); i++) {
+        cleanup_result(results[i], data[i]);
     }
+    return retval;
+}
 
-    log_messages.printf(MSG_NORMAL, "axb_validator: starting\n");
+// Validate a result that arrives after the work unit has a canonical result
+int check_pair(RESULT& new_result, RESULT& canonical_result, bool& retry) {
+    void* data1 = NULL;
+    void* data2 = NULL;
+    bool match = false;
 
-    retval = process_wu_results(argc, argv, check_set);
+    retry = false;
+    log_telemetry(new_result, "[axb_validator]");
+    init_result(new_result, data1);
+    init_result(canonical_result, data2);
+    compare_results(new_result, data1, canonical_result, data2, match);
 
-    if (retval) {
-        log_messages.printf(MSG_CRITICAL,
-            "process_wu_results returned %d\n", retval);
-    }
+    if (!data1) new_result.outcome = RESULT_OUTCOME_VALIDATE_ERROR;
+    new_result.validate_state = match ? VALIDATE_STATE_VALID : VALIDATE_STATE_INVALID;
 
-    return retval;
+    cleanup_result(new_result, data1);
+    cleanup_result(canonical_result, data2);
+    return 0;
+}
+
+// Command line options (BOINC's validator.cpp provides main())
+int validate_handler_init(int argc, char** argv) {
+    log_messages.printf(MSG_NORMAL, "axb_validator: starting\n");
+    return 0;
+}
+
+void validate_handler_usage() {
 }
@@ -0,0 +1,213 @@
+/*
+ * PI Computation Assimilator for BOINC
+ *
+ * Every valid replica of a pi_compute work unit is an independent sample
+ * of points_in_circle, and the redundancy that validation needs is paid
+ * for anyway. This assimilator adds up the hit and iteration counters of
+ * all valid results of each work unit, and of all work units, so the
+ * project ends up with one estimate from every sample it received rather
+ * than only the canonical ones.
+ *
+ * Files in the store directory:
+ *   pi_work_units.txt   one "wu_name hits iterations replicas" line per
+ *                       assimilated work unit
+ *   pi_pooled.txt       totals over all lines above, and the pooled
+ *                       estimate 4 * hits / iterations with its standard
+ *                       error
+ *
+ * pi_pooled.txt is recomputed from pi_work_units.txt every time, so the
+ * two can never disagree, and a work unit that is assimilated again (the
+ * assimilator stopped before BOINC recorded it) is not counted twice.
+ * Replicas with the same seed drew the same samples and count once; the
+ * experiments of a batch (server/pi_result.h) are pooled one by one, by
+ * their own seeds. Results without counters (older clients) are skipped.
+ *
+ * Compile (link with BOINC's assimilator.cpp, which provides main()):
+ *   g++ -o pi_assimilator pi_assimilator.cpp assimilator.o validate_util.o \
+ *       -I../src -I/path/to/boinc/sched -lboinc_sched -lboinc
+ *
+ * Command line: --store_dir DIR (default ../pi_results)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "boinc_db.h"
+#include "error_numbers.h"
+#include "sched_msgs.h"
+#include "validate_util.h"
+#include "assimilate_handler.h"
+#include "pi_result.h"
+
+using std::string;
+using std::vector;
+
+static string store_dir = "../pi_results";
+
+int assimilate_handler_init(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--store_dir") && i + 1 < argc) {
+            store_dir = argv[++i];
+        }
+    }
+
+    if (mkdir(store_dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        log_messages.printf(MSG_CRITICAL,
+            "[pi_assimilator] Cannot create %s: %s\n", store_dir.c_str(), strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void assimilate_handler_usage() {
+    fprintf(stderr,
+        "    --store_dir DIR   Directory of the pooled results (default ../pi_results)\n");
+}
+
+/**
+ * Write pi_pooled.txt for the given totals
+ */
+static int write_pooled(long work_units, long long replicas, long long hits, long long iterations) {
+    string path = store_dir + "/pi_pooled.txt";
+    string tmp_path = path + ".tmp";
+
+    FILE* f = fopen(tmp_path.c_str(), "w");
+    if (!f) {
+        log_messages.printf(MSG_CRITICAL, "[pi_assimilator] Cannot create %s\n", tmp_path.c_str());
+        return -1;
+    }
+
+    // Standard error from the observed hit rate, which is all we know
+    // about a sample that is not assumed to be correct
+    double p = iterations > 0 ? (double)hits / (double)iterations : 0.0;
+    double se = iterations > 0 ? 4.0 * sqrt(p * (1.0 - p) / (double)iterations) : 0.0;
+
+    fprintf(f, "work_units %ld\n", work_units);
+    fprintf(f, "replicas %lld\n", replicas);
+    fprintf(f, "hits %lld\n", hits);
+    fprintf(f, "iterations %lld\n", iterations);
+    fprintf(f, "pi %.15f\n", 4.0 * p);
+    fprintf(f, "std_error %.3e\n", se);
+
+    if (fclose(f) != 0 || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        log_messages.printf(MSG_CRITICAL, "[pi_assimilator] Cannot write %s\n", path.c_str());
+        return -1;
+    }
+
+    log_messages.printf(MSG_NORMAL,
+        "[pi_assimilator] Pooled over %ld work units: PI = %.15f +- %.3e (%lld iterations)\n",
+        work_units, 4.0 * p, se, iterations);
+    return 0;
+}
+
+int assimilate_handler(WORKUNIT& wu, vector<RESULT>& results, RESULT& /*canonical_result*/) {
+    if (!wu.canonical_resultid) {
+        log_messages.printf(MSG_NORMAL,
+            "[pi_assimilator] Work unit %s has no canonical result\n", wu.name);
+        return 0;
+    }
+
+    // Counters of the valid replicas, each seed once
+    long long wu_hits = 0, wu_iterations = 0, wu_replicas = 0;
+    vector<unsigned long long> seeds;
+
+    for (size_t i = 0; i < results.size(); i++) {
+        PI_RESULT res;
+        if (results[i].validate_state != VALIDATE_STATE_VALID) continue;
+        if (read_pi_result(results[i], res) || !res.has_counts) continue;
+
+        bool pooled = false;
+        for (const PI_EXPERIMENT& e : res.experiments) {
+            bool duplicate = false;
+            for (unsigned long long seed : seeds) {
+                if (seed == e.seed) duplicate = true;
+            }
+            if (duplicate) {
+                log_messages.printf(MSG_NORMAL,
+                    "[pi_assimilator] Result %s repeats seed %llu, not pooled\n",
+                    results[i].name, e.seed);
+                continue;
+            }
+
+            seeds.push_back(e.seed);
+            wu_hits += e.hits;
+            wu_iterations += e.iterations;
+            pooled = true;
+        }
+        if (pooled) wu_replicas++;
+    }
+
+    // One assimilator at a time: the lock on the list guards both files
+    string list_path = store_dir + "/pi_work_units.txt";
+    int fd = open(list_path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0 || flock(fd, LOCK_EX) < 0) {
+        log_messages.printf(MSG_CRITICAL,
+            "[pi_assimilator] Cannot lock %s: %s\n", list_path.c_str(), strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    FILE* list = fdopen(fd, "a+");
+    if (!list) {
+        close(fd);
+        return -1;
+    }
+
+    // Totals over the work units so far, and whether this one is among them
+    char line[512], name[256];
+    long long hits, iterations, replicas;
+    long long total_hits = 0, total_iterations = 0, total_replicas = 0;
+    long work_units = 0;
+    bool seen = false;
+
+    rewind(list);
+    while (fgets(line, sizeof(line), list)) {
+        if (sscanf(line, "%255s %lld %lld %lld", name, &hits, &iterations, &replicas) != 4) continue;
+        if (!strcmp(name, wu.name)) seen = true;
+        total_hits += hits;
+        total_iterations += iterations;
+        total_replicas += replicas;
+        work_units++;
+    }
+
+    int retval = 0;
+    if (seen) {
+        log_messages.printf(MSG_NORMAL,
+            "[pi_assimilator] Work unit %s already pooled\n", wu.name);
+    } else if (wu_replicas > 0) {
+        fprintf(list, "%s %lld %lld %lld\n", wu.name, wu_hits, wu_iterations, wu_replicas);
+        if (fflush(list) != 0 || fsync(fd) != 0) {
+            log_messages.printf(MSG_CRITICAL,
+                "[pi_assimilator] Cannot append to %s\n", list_path.c_str());
+            retval = -1;
+        } else {
+            log_messages.printf(MSG_NORMAL,
+                "[pi_assimilator] Work unit %s: %lld replicas, PI = %.15f\n",
+                wu.name, wu_replicas, 4.0 * (double)wu_hits / (double)wu_iterations);
+            total_hits += wu_hits;
+            total_iterations += wu_iterations;
+            total_replicas += wu_replicas;
+            work_units++;
+        }
+    } else {
+        log_messages.printf(MSG_NORMAL,
+            "[pi_assimilator] Work unit %s has no valid results with counters\n", wu.name);
+    }
+
+    if (retval == 0) {
+        retval = write_pooled(work_units, total_replicas, total_hits, total_iterations);
+    }
+
+    fclose(list);       // Releases the lock
+    return retval;
+}
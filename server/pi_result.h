@@ -0,0 +1,278 @@
+/*
+ * pi_result.h
+ *
+ * Parsed pi_compute results on the server
+ *
+ * Shared by pi_validator.cpp and pi_assimilator.cpp, which both include
+ * the BOINC scheduler headers before this one. Results of current clients
+ * end with a "counts <points_in_circle> <iterations> <seed>" line
+ * (src/pi_compute.cpp); the hit counts of independent replicas add up to
+ * one estimate from all their samples. Older results only have the
+ * rounded estimate and cannot be pooled.
+ *
+ * A work unit may run a batch of independent experiments; its results
+ * list each one as "experiment <index> <points_in_circle> <iterations>
+ * <seed>" before the counts line, which then holds the totals.
+ *
+ * Clients started with --binary_output upload the same counters as one
+ * binary record instead (src/mc_result.h), read with a single fread and
+ * used without parsing.
+ */
+
+#ifndef PI_RESULT_H
+#define PI_RESULT_H
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+
+#include "mc_result.h"
+
+// Success probability of one sample: the quarter circle's share of the square
+const double HIT_PROBABILITY = M_PI / 4.0;
+
+/**
+ * One experiment of a result
+ */
+struct PI_EXPERIMENT {
+    long long iterations;
+    double pi;
+    double variance;
+    long long hits;         // Only if the result has counts
+    unsigned long long seed;
+};
+
+/**
+ * Parsed result, cached by init_result() as the result's data
+ */
+struct PI_RESULT {
+    long long iterations;   // Of all experiments
+    double pi;
+    double variance;        // Squared standard error of 'pi'
+    bool has_counts;        // The fields below are known
+    long long hits;         // Points in circle
+    unsigned long long seed;
+    std::vector<PI_EXPERIMENT> experiments;     // A single one without a batch
+};
+
+// Squared standard error of a PI estimate from 'iterations' samples
+static inline double pi_variance(long long iterations) {
+    return 16.0 * HIT_PROBABILITY * (1.0 - HIT_PROBABILITY) / (double)iterations;
+}
+
+// Did two results run the same experiments? Replicas of one work unit
+// may pick their own seeds, so only the iteration counts must match.
+static inline bool same_experiments(const PI_RESULT& a, const PI_RESULT& b) {
+    if (a.experiments.size() != b.experiments.size()) return false;
+    for (size_t k = 0; k < a.experiments.size(); k++) {
+        if (a.experiments[k].iterations != b.experiments[k].iterations) return false;
+    }
+    return true;
+}
+
+/**
+ * Parse PI value and iteration count from output file
+ *
+ * Expected format:
+ *   PI Computation Results
+ *   ======================
+ *   Total iterations: NNNNNN
+ *   Points in circle: NNNNNN
+ *   Estimated value of PI: X.XXXXXXXXXXXXXXX
+ *   ...
+ *   experiment INDEX HITS ITERATIONS SEED     (batches only, one per experiment)
+ *   counts HITS ITERATIONS SEED
+ *
+ * Returns 0, ERR_FOPEN if the file cannot be opened or ERR_XML_PARSE if
+ * it does not contain a plausible result.
+ */
+static inline int parse_pi_from_output(const char* path, PI_RESULT& res) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        log_messages.printf(MSG_CRITICAL,
+            "[pi_result] Cannot open output file: %s\n", path);
+        return ERR_FOPEN;
+    }
+
+    char line[256];
+    bool have_iterations = false, have_pi = false, experiments_ok = true;
+    long long count_iterations = 0;
+    PI_EXPERIMENT e;
+    size_t index;
+
+    res.has_counts = false;
+    res.experiments.clear();
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "counts %lld %lld %llu", &res.hits, &count_iterations, &res.seed) == 3) {
+            res.has_counts = true;
+            continue;
+        }
+        if (sscanf(line, "experiment %zu %lld %lld %llu", &index, &e.hits, &e.iterations,
+                   &e.seed) == 4) {
+            if (index != res.experiments.size() || e.iterations <= 0 || e.hits < 0 ||
+                e.hits > e.iterations) {
+                experiments_ok = false;
+            }
+            e.pi = 4.0 * (double)e.hits / (double)e.iterations;
+            e.variance = pi_variance(e.iterations);
+            res.experiments.push_back(e);
+            continue;
+        }
+
+        char* colon = strchr(line, ':');
+        if (!colon) continue;
+
+        if (strstr(line, "Total iterations:")) {
+            have_iterations = sscanf(colon + 1, "%lld", &res.iterations) == 1;
+        } else if (strstr(line, "Estimated value of PI:")) {
+            have_pi = sscanf(colon + 1, "%lf", &res.pi) == 1;
+        }
+    }
+
+    fclose(f);
+
+    // The estimate is 4 * hits / iterations, so it lies in [0, 4]
+    if (!have_iterations || !have_pi || res.iterations <= 0 ||
+        !(res.pi >= 0.0 && res.pi <= 4.0)) {
+        log_messages.printf(MSG_CRITICAL,
+            "[pi_result] Could not parse PI value and iterations from: %s\n", path);
+        return ERR_XML_PARSE;
+    }
+
+    // The counters must be the ones the printed estimate came from
+    if (res.has_counts) {
+        double pi = 4.0 * (double)res.hits / (double)res.iterations;
+        if (count_iterations != res.iterations || res.hits < 0 || res.hits > res.iterations ||
+            fabs(pi - res.pi) > 1e-12) {
+            log_messages.printf(MSG_CRITICAL,
+                "[pi_result] Counters do not match the estimate in: %s\n", path);
+            return ERR_XML_PARSE;
+        }
+        res.pi = pi;
+    }
+
+    // The experiments of a batch must add up to the totals
+    if (!res.experiments.empty()) {
+        long long hits = 0, iterations = 0;
+        for (const PI_EXPERIMENT& x : res.experiments) {
+            hits += x.hits;
+            iterations += x.iterations;
+        }
+        if (!experiments_ok || !res.has_counts || hits != res.hits ||
+            iterations != res.iterations) {
+            log_messages.printf(MSG_CRITICAL,
+                "[pi_result] Experiments do not match the totals in: %s\n", path);
+            return ERR_XML_PARSE;
+        }
+    }
+
+    res.variance = pi_variance(res.iterations);
+    if (res.experiments.empty()) {
+        e.iterations = res.iterations;
+        e.pi = res.pi;
+        e.variance = res.variance;
+        e.hits = res.has_counts ? res.hits : 0;
+        e.seed = res.has_counts ? res.seed : 0;
+        res.experiments.push_back(e);
+    }
+    log_messages.printf(MSG_DEBUG,
+        "[pi_result] Parsed PI value: %.15f (%lld iterations, se %.3e, %zu experiments) from %s\n",
+        res.pi, res.iterations, sqrt(res.variance), res.experiments.size(), path);
+    return 0;
+}
+
+/**
+ * Take the result from a binary record of 'size' bytes: one mc_result_pi_t
+ * per experiment. The estimates must be exactly the ones the counters give.
+ *
+ * Returns 0 or ERR_XML_PARSE.
+ */
+static inline int decode_pi_result(const void* record, size_t size, const char* path,
+                                   PI_RESULT& res) {
+    const void* entries;
+    const char* problem = mc_result_open(record, size, MC_RESULT_APP_PI,
+                                         sizeof(mc_result_pi_t), &entries);
+    if (problem) {
+        log_messages.printf(MSG_CRITICAL,
+            "[pi_result] Invalid binary result %s: %s\n", path, problem);
+        return ERR_XML_PARSE;
+    }
+
+    const mc_result_header_t* header = (const mc_result_header_t*)record;
+    const mc_result_pi_t* experiments = (const mc_result_pi_t*)entries;
+    bool ok = header->count >= 1 && header->start_idx == 0 &&
+              header->end_idx == (int64_t)header->count - 1 &&
+              header->seed == experiments[0].seed;
+
+    res.iterations = 0;
+    res.hits = 0;
+    res.has_counts = true;
+    res.seed = header->seed;
+    res.experiments.clear();
+    for (uint64_t k = 0; ok && k < header->count; k++) {
+        const mc_result_pi_t& x = experiments[k];
+        PI_EXPERIMENT e;
+        ok = x.iterations > 0 && x.hits >= 0 && x.hits <= x.iterations &&
+             x.pi == 4.0 * (double)x.hits / (double)x.iterations;
+        e.iterations = x.iterations;
+        e.hits = x.hits;
+        e.seed = x.seed;
+        e.pi = x.pi;
+        e.variance = pi_variance(x.iterations);
+        res.experiments.push_back(e);
+        res.iterations += x.iterations;
+        res.hits += x.hits;
+    }
+    if (!ok || header->num_walks != res.iterations) {
+        log_messages.printf(MSG_CRITICAL,
+            "[pi_result] Counters do not match the estimates in: %s\n", path);
+        return ERR_XML_PARSE;
+    }
+
+    res.pi = 4.0 * (double)res.hits / (double)res.iterations;
+    res.variance = pi_variance(res.iterations);
+    log_messages.printf(MSG_DEBUG,
+        "[pi_result] Read PI value: %.15f (%lld iterations, se %.3e, %zu experiments) from %s\n",
+        res.pi, res.iterations, sqrt(res.variance), res.experiments.size(), path);
+    return 0;
+}
+
+/**
+ * Read a result file in either format
+ */
+static inline int read_pi_file(const char* path, PI_RESULT& res) {
+    size_t size;
+    void* record = mc_result_load(path, &size);
+    if (record && mc_result_is_binary(record, size)) {
+        int retval = decode_pi_result(record, size, path, res);
+        free(record);
+        return retval;
+    }
+    free(record);
+    return parse_pi_from_output(path, res);
+}
+
+/**
+ * Parse the output file of a result
+ */
+static inline int read_pi_result(RESULT& result, PI_RESULT& res) {
+    std::vector<OUTPUT_FILE_INFO> fis;
+    int retval = get_output_file_infos(result, fis);
+    if (retval) {
+        log_messages.printf(MSG_CRITICAL,
+            "[pi_result] get_output_file_infos() failed: %d\n", retval);
+        return retval;
+    }
+
+    if (fis.size() != 1) {
+        log_messages.printf(MSG_CRITICAL,
+            "[pi_result] Expected 1 output file, got %d\n", (int)fis.size());
+        return ERR_XML_PARSE;
+    }
+
+    return read_pi_file(fis[0].path.c_str(), res);
+}
+
+#endif
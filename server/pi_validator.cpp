@@ -5,8 +5,28 @@
  * Since the Monte Carlo method produces slightly different results each time
  * (due to randomness), we need a tolerant comparison rather than exact match.
  *
- * Compile:
- *   g++ -o pi_validator pi_validator.cpp -I/path/to/boinc/sched -lboinc_sched -lboinc
+ * How tolerant depends on the work: an estimate from N samples is
+ * 4 * (hits / N) with hits ~ Binomial(N, PI/4), so its standard error is
+ *
+ *   se = 4 * sqrt(p * (1 - p) / N),   p = PI/4
+ *
+ * and two results agree if they differ by at most MAX_Z_SCORE combined
+ * standard errors. A fixed relative tolerance would accept a sloppy result
+ * of a short run and reject valid results of long ones.
+ *
+ * check_set() and check_pair() are implemented here instead of taken from
+ * validate_util2.cpp. check_set() compares every result with the weighted
+ * mean of all the others, which takes one pass over the replicas instead
+ * of comparing all N(N-1)/2 pairs.
+ *
+ * Results of a batch of experiments are compared experiment by experiment;
+ * a result is as far from another as its worst experiment is. Text and
+ * binary results (src/mc_result.h) may be compared with each other.
+ *
+ * Compile (link with BOINC's validator.cpp and validate_util.cpp, not
+ * validate_util2.cpp):
+ *   g++ -o pi_validator pi_validator.cpp validator.o validate_util.o \
+ *       -I../src -I/path/to/boinc/sched -lboinc_sched -lboinc
  *
  * Deploy:
  *   Copy to ~/projects/pi_compute/bin/
@@ -16,139 +36,79 @@
 #include <cstdlib>
 #include <cmath>
 #include <cstring>
+#include <vector>
+#include "boinc_db.h"
+#include "error_numbers.h"
 #include "sched_msgs.h"
 #include "validate_util.h"
-#include "validate_util2.h"
+#include "validator.h"
+#include "pi_result.h"
+#include "telemetry.h"
 
 using std::vector;
 
-// Tolerance for PI comparison (0.1% relative error)
-const double PI_TOLERANCE = 0.001;
+// Two estimates agree if they differ by at most this many combined
+// standard errors. For a correct pair this fails with probability ~6e-7,
+// or ~K * 6e-7 for a batch of K experiments.
+const double MAX_Z_SCORE = 5.0;
 
 /**
- * Parse PI value from output file
- *
- * Expected format:
- *   PI Computation Results
- *   ======================
- *   Total iterations: NNNNNN
- *   Estimated value of PI: X.XXXXXXXXXXXXXXX
- *   ...
- */
-double parse_pi_from_output(const char* path) {
-    FILE* f = fopen(path, "r");
-    if (!f) {
-        log_messages.printf(MSG_CRITICAL,
-            "[pi_validator] Cannot open output file: %s\n", path);
-        return -1.0;
-    }
-
-    char line[256];
-    double pi_value = -1.0;
-
-    while (fgets(line, sizeof(line), f)) {
-        if (strstr(line, "Estimated value of PI:")) {
-            // Parse the PI value
-            char* colon = strchr(line, ':');
-            if (colon) {
-                pi_value = atof(colon + 1);
-                break;
-            }
-        }
-    }
-
-    fclose(f);
-
-    if (pi_value < 0) {
-        log_messages.printf(MSG_CRITICAL,
-            "[pi_validator] Could not parse PI value from: %s\n", path);
-    } else {
-        log_messages.printf(MSG_DEBUG,
-            "[pi_validator] Parsed PI value: %.15f from %s\n", pi_value, path);
-    }
-
-    return pi_value;
-}
-
-/**
- * Initialize validation
- * Called once at startup
+ * Parse the output file of a result once; the PI_RESULT is kept as 'data'
  */
 int init_result(RESULT& result, void*& data) {
-    int retval;
-
-    // Get the output file
-    vector<FILE_INFO> fis;
-    retval = get_output_file_infos(result, fis);
+    PI_RESULT* res = new PI_RESULT;
+    int retval = read_pi_result(result, *res);
     if (retval) {
-        log_messages.printf(MSG_CRITICAL,
-            "[pi_validator] get_output_file_infos() failed: %d\n", retval);
+        delete res;
         return retval;
     }
 
-    if (fis.size() != 1) {
-        log_messages.printf(MSG_CRITICAL,
-            "[pi_validator] Expected 1 output file, got %d\n", (int)fis.size());
-        return ERR_XML_PARSE;
-    }
-
-    // Get file path
-    const char* path = fis[0].path.c_str();
-
-    // Parse PI value
-    double* pi_ptr = new double;
-    *pi_ptr = parse_pi_from_output(path);
-
-    if (*pi_ptr < 0) {
-        delete pi_ptr;
-        return ERR_XML_PARSE;
-    }
-
-    data = (void*)pi_ptr;
+    data = (void*)res;
     return 0;
 }
 
 /**
- * Compare two results
- *
- * Returns:
- *   0: Results match (within tolerance)
- *   1: Results don't match
+ * Compare two results by their binomial standard errors
  */
 int compare_results(
     RESULT& r1, void* data1,
     RESULT& r2, void* data2,
     bool& match
 ) {
-    double pi1 = *(double*)data1;
-    double pi2 = *(double*)data2;
+    const PI_RESULT& res1 = *(const PI_RESULT*)data1;
+    const PI_RESULT& res2 = *(const PI_RESULT*)data2;
+
+    if (!same_experiments(res1, res2)) {
+        log_messages.printf(MSG_NORMAL,
+            "[pi_validator] Results %s and %s ran different experiments\n", r1.name, r2.name);
+        match = false;
+        return 0;
+    }
 
-    // Calculate relative difference
-    double diff = fabs(pi1 - pi2);
-    double avg = (pi1 + pi2) / 2.0;
-    double relative_error = diff / avg;
+    // The experiment in which the two differ most
+    double diff = 0.0, z = 0.0;
+    for (size_t k = 0; k < res1.experiments.size(); k++) {
+        const PI_EXPERIMENT& e1 = res1.experiments[k];
+        const PI_EXPERIMENT& e2 = res2.experiments[k];
+        double zk = fabs(e1.pi - e2.pi) / sqrt(e1.variance + e2.variance);
+        if (k == 0 || zk > z) {
+            z = zk;
+            diff = fabs(e1.pi - e2.pi);
+        }
+    }
+    match = z <= MAX_Z_SCORE;
 
     log_messages.printf(MSG_NORMAL,
         "[pi_validator] Comparing results:\n");
     log_messages.printf(MSG_NORMAL,
-        "  Result 1 (%s): PI = %.15f\n", r1.name, pi1);
+        "  Result 1 (%s): PI = %.15f (%lld iterations)\n", r1.name, res1.pi, res1.iterations);
     log_messages.printf(MSG_NORMAL,
-        "  Result 2 (%s): PI = %.15f\n", r2.name, pi2);
+        "  Result 2 (%s): PI = %.15f (%lld iterations)\n", r2.name, res2.pi, res2.iterations);
     log_messages.printf(MSG_NORMAL,
-        "  Difference: %.15f (%.6f%%)\n", diff, relative_error * 100.0);
-
-    // Check if within tolerance
-    if (relative_error <= PI_TOLERANCE) {
-        match = true;
-        log_messages.printf(MSG_NORMAL,
-            "[pi_validator] Results MATCH (within %.2f%% tolerance)\n",
-            PI_TOLERANCE * 100.0);
-    } else {
-        match = false;
-        log_messages.printf(MSG_NORMAL,
-            "[pi_validator] Results DO NOT MATCH (exceeds %.2f%% tolerance)\n",
-            PI_TOLERANCE * 100.0);
-    }
+        "  Difference: %.15f (%.2f standard errors)\n", diff, z);
+    log_messages.printf(MSG_NORMAL,
+        "[pi_validator] Results %s (limit %.1f standard errors)\n",
+        match ? "MATCH" : "DO NOT MATCH", MAX_Z_SCORE);
 
     return 0;
 }
@@ -158,47 +118,232 @@ int compare_results(
  */
 int cleanup_result(RESULT const& /*result*/, void* data) {
     if (data) {
-        delete (double*)data;
+        delete (PI_RESULT*)data;
     }
     return 0;
 }
 
 /**
- * Check if a result set is valid
- * (all results agree within tolerance)
+ * Mark the replicas that agree with the others.
+ *
+ * Each result is compared with the inverse-variance weighted mean of the
+ * other ones, which two running sums give for all results at once:
+ *
+ *   m_i = (S - w_i x_i) / (W - w_i),   Var(x_i - m_i) = v_i + 1 / (W - w_i)
+ *
+ * with w_i = 1 / v_i, W = sum w_i and S = sum w_i x_i. Results too far
+ * from their m_i are dropped and the pass repeated over the rest, so one
+ * bad result cannot drag the mean away from the good ones. 'agree' has an
+ * entry per replica. Returns the number of agreeing replicas.
+ *
+ * With a batch, the sums are kept per experiment and z_i is the largest
+ * over the experiments. Only replicas that ran the experiments most of
+ * them ran take part.
  */
-bool check_set(
-    vector<RESULT>& /*results*/,
-    WORKUNIT& /*wu*/,
-    int& /*canonicalid*/,
+static int find_agreeing(const vector<const PI_RESULT*>& replicas, vector<bool>& agree) {
+    size_t n = replicas.size();
+    int count = 0;
+
+    // The most common experiment list
+    const PI_RESULT* reference = NULL;
+    int reference_count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!replicas[i]) continue;
+        int same = 0;
+        for (size_t j = 0; j < n; j++) {
+            if (replicas[j] && same_experiments(*replicas[i], *replicas[j])) same++;
+        }
+        if (same > reference_count) {
+            reference = replicas[i];
+            reference_count = same;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        agree[i] = replicas[i] != NULL && same_experiments(*replicas[i], *reference);
+        if (agree[i]) {
+            count++;
+        } else if (replicas[i]) {
+            log_messages.printf(MSG_NORMAL,
+                "[pi_validator] Replica %zu ran different experiments\n", i);
+        }
+    }
+
+    size_t num_experiments = reference ? reference->experiments.size() : 0;
+    vector<double> W(num_experiments), S(num_experiments);
+
+    while (count >= 2) {
+        for (size_t k = 0; k < num_experiments; k++) {
+            W[k] = 0.0;
+            S[k] = 0.0;
+            for (size_t i = 0; i < n; i++) {
+                if (!agree[i]) continue;
+                const PI_EXPERIMENT& e = replicas[i]->experiments[k];
+                W[k] += 1.0 / e.variance;
+                S[k] += e.pi / e.variance;
+            }
+        }
+
+        // Drop the result furthest from the others, if it is too far
+        double worst_z = 0.0;
+        size_t worst = n;
+        for (size_t i = 0; i < n; i++) {
+            if (!agree[i]) continue;
+            for (size_t k = 0; k < num_experiments; k++) {
+                const PI_EXPERIMENT& e = replicas[i]->experiments[k];
+                double w = 1.0 / e.variance;
+                double others = (S[k] - w * e.pi) / (W[k] - w);
+                double z = fabs(e.pi - others) / sqrt(e.variance + 1.0 / (W[k] - w));
+                if (z > worst_z) {
+                    worst_z = z;
+                    worst = i;
+                }
+            }
+        }
+
+        if (worst_z <= MAX_Z_SCORE) {
+            return count;
+        }
+
+        log_messages.printf(MSG_NORMAL,
+            "[pi_validator] Replica %zu is %.2f standard errors from the others\n",
+            worst, worst_z);
+        agree[worst] = false;
+        count--;
+    }
+
+    return count;
+}
+
+/**
+ * Validate the results of a work unit once it has reached its quorum:
+ * mark the replicas that agree valid, the rest invalid, and pick the
+ * first agreeing one as canonical
+ */
+int check_set(
+    vector<RESULT>& results,
+    WORKUNIT& wu,
+    DB_ID_TYPE& canonicalid,
     double& /*credit*/,
-    bool& /*retry*/
+    bool& retry
 ) {
-    // Use default behavior
+    size_t n = results.size();
+    vector<void*> data(n, NULL);
+    vector<const PI_RESULT*> replicas(n, NULL);
+
     retry = false;
-    return false;
+    canonicalid = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        log_telemetry(results[i], "[pi_validator]");
+        int retval = init_result(results[i], data[i]);
+        if (retval == ERR_FOPEN) {
+            // The upload may not be complete yet; try again later
+            log_messages.printf(MSG_CRITICAL,
+                "[pi_validator] Output of result %s not readable yet\n", results[i].name);
+            retry = true;
+        } else if (retval) {
+            results[i].outcome = RESULT_OUTCOME_VALIDATE_ERROR;
+            results[i].validate_state = VALIDATE_STATE_INVALID;
+        } else {
+            replicas[i] = (const PI_RESULT*)data[i];
+        }
+    }
+
+    if (!retry) {
+        vector<bool> agree(n);
+        int count = find_agreeing(replicas, agree);
+
+        if (count >= wu.min_quorum) {
+            for (size_t i = 0; i < n; i++) {
+                if (!replicas[i]) continue;
+                results[i].validate_state = agree[i] ? VALIDATE_STATE_VALID : VALIDATE_STATE_INVALID;
+                if (agree[i] && !canonicalid) {
+                    canonicalid = results[i].id;
+                }
+            }
+            log_messages.printf(MSG_NORMAL,
+                "[pi_validator] %d of %zu results agree, canonical result %lu\n",
+                count, n, (unsigned long)canonicalid);
+
+            // All agreeing replicas together: pi_assimilator.cpp keeps this
+            long long hits = 0, iterations = 0;
+            for (size_t i = 0; i < n; i++) {
+                if (agree[i] && replicas[i]->has_counts) {
+                    hits += replicas[i]->hits;
+                    iterations += replicas[i]->iterations;
+                }
+            }
+            if (iterations > 0) {
+                log_messages.printf(MSG_NORMAL,
+                    "[pi_validator] Pooled estimate: PI = %.15f (%lld iterations, se %.3e)\n",
+                    4.0 * (double)hits / (double)iterations, iterations,
+                    sqrt(pi_variance(iterations)));
+            }
+        } else {
+            // No quorum yet: leave the results pending and let the
+            // transitioner send out more replicas
+            log_messages.printf(MSG_NORMAL,
+                "[pi_validator] Only %d of %zu results agree, need %d\n",
+                count, n, wu.min_quorum);
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (data[i]) cleanup_result(results[i], data[i]);
+    }
+    return 0;
 }
 
 /**
- * Check if result needs more processing
+ * Validate a result that arrives after the work unit has a canonical result
  */
-bool check_pair(
-    RESULT& /*r1*/,
-    RESULT& /*r2*/,
-    bool& /*retry*/
+int check_pair(
+    RESULT& new_result,
+    RESULT& canonical_result,
+    bool& retry
 ) {
+    void* data1 = NULL;
+    void* data2 = NULL;
+
     retry = false;
-    return false;
+    log_telemetry(new_result, "[pi_validator]");
+
+    int retval = init_result(new_result, data1);
+    if (retval == ERR_FOPEN) {
+        retry = true;
+        return 0;
+    }
+    if (retval) {
+        new_result.outcome = RESULT_OUTCOME_VALIDATE_ERROR;
+        new_result.validate_state = VALIDATE_STATE_INVALID;
+        return 0;
+    }
+
+    retval = init_result(canonical_result, data2);
+    if (retval) {
+        // The canonical output is gone or damaged; nothing to compare with
+        cleanup_result(new_result, data1);
+        retry = retval == ERR_FOPEN;
+        return retval == ERR_FOPEN ? 0 : retval;
+    }
+
+    bool match;
+    compare_results(new_result, data1, canonical_result, data2, match);
+    new_result.validate_state = match ? VALIDATE_STATE_VALID : VALIDATE_STATE_INVALID;
+
+    cleanup_result(new_result, data1);
+    cleanup_result(canonical_result, data2);
+    return 0;
 }
 
 /**
- * Main validation driver
+ * Command line options (BOINC's validator.cpp provides main())
  */
-const char* BOINC_RCSID_33c7876 = "$Id$";
-
-int main(int argc, char** argv) {
-    log_messages.set_debug_level(3);
+int validate_handler_init(int /*argc*/, char** /*argv*/) {
     log_messages.printf(MSG_NORMAL, "PI Validator starting...\n");
+    return 0;
+}
 
-    return validate_handler(argc, argv);
+void validate_handler_usage() {
 }
@@ -0,0 +1,136 @@
+/*
+ * telemetry.h
+ *
+ * Performance counters of a result, parsed from its stderr
+ *
+ * pi_compute and axb_montecarlo end stderr.txt with "telemetry ..." lines
+ * (src/mc_telemetry.h): phase times, checkpoint write latency, samples
+ * and walk transitions per second and a histogram of the walk lengths.
+ * The client returns stderr.txt as the result's stderr_out. The validators
+ * log the counters of every result they check, one line per result, and
+ * scripts/check_results.sh adds them up over the whole project.
+ *
+ * Include after the BOINC scheduler headers, with src/ on the include
+ * path (like axb_input.h).
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <cstdio>
+#include <cstring>
+
+#include "mc_telemetry.h"
+
+/**
+ * Counters of one run, as reported in the trailer
+ */
+struct TELEMETRY {
+    int version;                            // 0: no trailer (older clients)
+    char app[64];
+    int threads;
+    double phase_seconds[MC_NUM_PHASES];
+    double total_seconds;
+    long checkpoints;
+    double checkpoint_seconds;
+    double checkpoint_max;
+    long long samples;
+    double samples_per_sec;
+    bool has_walks;                         // The fields below are known
+    long long transitions;
+    double transitions_per_sec;
+    long long length_hist[MC_TELEMETRY_BINS];
+};
+
+/**
+ * Parse the telemetry lines of 'text' (a result's stderr_out). Lines that
+ * are missing or damaged leave their fields zero.
+ * Returns true if the text has a trailer of a known version.
+ */
+static inline bool parse_telemetry(const char* text, TELEMETRY& t) {
+    memset(&t, 0, sizeof(t));
+
+    for (const char* line = strstr(text, "telemetry "); line; line = strstr(line + 1, "telemetry ")) {
+        // Only at the start of a line
+        if (line != text && line[-1] != '\n') continue;
+
+        const char* p = line + strlen("telemetry ");
+        int used = 0;
+
+        if (sscanf(p, "version %d app %63s threads %d", &t.version, t.app, &t.threads) == 3) {
+            continue;
+        }
+        if (!strncmp(p, "phases", 6)) {
+            p += 6;
+            for (int k = 0; k < MC_NUM_PHASES; k++) {
+                char name[16];
+                if (sscanf(p, " %15s %lf%n", name, &t.phase_seconds[k], &used) != 2 ||
+                    strcmp(name, mc_phase_names[k])) {
+                    break;
+                }
+                p += used;
+            }
+            sscanf(p, " total %lf", &t.total_seconds);
+            continue;
+        }
+        if (sscanf(p, "checkpoints %ld total %lf max %lf",
+                   &t.checkpoints, &t.checkpoint_seconds, &t.checkpoint_max) == 3) {
+            continue;
+        }
+        if (sscanf(p, "samples %lld per_sec %lf", &t.samples, &t.samples_per_sec) == 2) {
+            continue;
+        }
+        if (sscanf(p, "transitions %lld per_sec %lf", &t.transitions, &t.transitions_per_sec) == 2) {
+            t.has_walks = true;
+            continue;
+        }
+        if (!strncmp(p, "walk_length_log2", 16)) {
+            p += 16;
+            for (int k = 0; k < MC_TELEMETRY_BINS; k++) {
+                if (sscanf(p, " %lld%n", &t.length_hist[k], &used) != 1) break;
+                p += used;
+            }
+        }
+    }
+
+    return t.version >= 1 && t.version <= MC_TELEMETRY_VERSION;
+}
+
+/**
+ * Mean number of states a walk visited, from the histogram (the bin
+ * centres, so only an estimate)
+ */
+static inline double telemetry_mean_walk_length(const TELEMETRY& t) {
+    double walks = 0.0, states = 0.0;
+    for (int k = 0; k < MC_TELEMETRY_BINS; k++) {
+        walks += t.length_hist[k];
+        states += t.length_hist[k] * 1.5 * (double)(1LL << k);
+    }
+    return walks > 0 ? states / walks : 0.0;
+}
+
+/**
+ * Log the counters of a result on one line, prefixed with 'tag'
+ */
+static inline void log_telemetry(RESULT const& result, const char* tag) {
+    TELEMETRY t;
+    if (!parse_telemetry(result.stderr_out, t)) {
+        log_messages.printf(MSG_DEBUG, "%s Result %s has no telemetry\n", tag, result.name);
+        return;
+    }
+
+    char walks[128] = "";
+    if (t.has_walks) {
+        snprintf(walks, sizeof(walks), ", %.3g transitions/s, mean walk ~%.1f states",
+                 t.transitions_per_sec, telemetry_mean_walk_length(t));
+    }
+    log_messages.printf(MSG_NORMAL,
+        "%s Telemetry of %s (host %lu): %d threads, read %.2f s, compute %.2f s, "
+        "output %.2f s, %.3g samples/s%s, %ld checkpoints (max %.3f s)\n",
+        tag, result.name, (unsigned long)result.hostid, t.threads,
+        t.phase_seconds[MC_PHASE_READ], t.phase_seconds[MC_PHASE_COMPUTE],
+        t.phase_seconds[MC_PHASE_OUTPUT], t.samples_per_sec, walks,
+        t.checkpoints, t.checkpoint_max);
+}
+
+#endif
@@ -7,13 +7,29 @@
  *
  * The method works by:
  * 1. Converting the system to the form x = Cx + f where C = I - D^{-1}A and f = D^{-1}b
+ *    (or, with "split=" and "omega=", C = I - omega M^{-1}A for a relaxed,
+ *    block or approximate-inverse splitting)
  * 2. For each component x_i, simulate random walks using the matrix C
  * 3. Each walk contributes to the expected value of x_i
  *
  * BOINC Integration:
  * - Input: Matrix A, vector b, component indices to compute, number of walks
- * - Output: Computed values for specified components
+ *   (text, or the binary format of axb_input.h, which is mmapped)
+ * - The matrix can be a sticky file shared by all work units of a job;
+ *   each work unit then only adds a small parameter file (axb_params.h)
+ * - Output: Computed values for specified components and their standard errors
+ *   (text, or with "--binary_output" the checksummed record of mc_result.h)
+ * - A component stops early once its standard error reaches the work
+ *   unit's tolerance ("tol=" in the parameters, mc_stats.h)
+ * - "mode=suffix" lets each walk contribute to every component it visits
+ * - Variance reduction: tunable absorption ("absorb="), a Jacobi control
+ *   variate ("cv=") and antithetic walk pairs ("antithetic=1")
  * - Server merges results from multiple work units to get complete solution
+ * - Checkpoints record the component and walk in progress (mc_checkpoint.h)
+ * - Walks run on a work-stealing thread pool ("--nthreads N", mc_pool.h),
+ *   or on an OpenCL GPU in the GPU app versions (mc_kernels.cl)
+ * - "pilot=K" runs a short pilot on K components and reports what the
+ *   work unit generator needs to size work units (run_pilot())
  *
  * Licensed under GPL v3
  */
@@ -22,73 +38,397 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <stdint.h>
 #include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifdef _BOINC_
 #include "boinc_api.h"
 #include "filesys.h"
 #endif
 
-#define MAX_DIM 1000
+#include "mc_rng.h"
+#include "mc_checkpoint.h"
+#include "mc_result.h"
+#include "mc_alias.h"
+#include "mc_csr.h"
+#include "mc_pool.h"
+#include "mc_stats.h"
+#include "mc_walk.h"
+#include "mc_telemetry.h"
+#include "axb_input.h"
+#include "axb_params.h"
+#ifdef MC_OPENCL
+#include "mc_opencl.h"
+#endif
+
+#define CACHE_LINE 64                // Alignment of the matrix rows
 #define DEFAULT_WALKS 100000
+#define MAX_STEPS MC_WALK_MAX_STEPS  // Upper bound on the length of a walk
+#define MIN_ABSORB_PROB 0.01         // Lower bound of the per-row absorption
+#define MAX_WALKS 4294967295L        // Walk index must fit the 32-bit stream field
+#define WALKS_PER_TASK 1024          // Walks per scheduler task
+#define ROUND_TASKS_PER_THREAD 16    // Tasks per thread between checkpoint checks
+#define MAX_ROUND_TASKS 4096
+#define MAX_ROUND_STATS (1 << 20)    // Per-task statistics of a suffix-mode round
+#define CHECKPOINT_INTERVAL 60       // Seconds between checkpoints in standalone mode
+#define AXB_CHECKPOINT_VERSION 5
 
+// The matrices are kept in CSR form (mc_csr.h): memory and the cost of
+// building the walk tables scale with the number of nonzeros, so large
+// sparse systems (e.g. PDE discretizations) fit on a volunteer host.
 typedef struct {
-    int n;                    // Matrix dimension
-    double A[MAX_DIM][MAX_DIM]; // Coefficient matrix
-    double b[MAX_DIM];         // Right-hand side vector
-    double C[MAX_DIM][MAX_DIM]; // Iteration matrix C = I - D^{-1}A
-    double f[MAX_DIM];         // f = D^{-1}b
-    double row_sum[MAX_DIM];   // Sum of |C_ij| for each row (for transition probabilities)
+    int n;                     // Matrix dimension
+    mc_csr_t A;                // Coefficient matrix (freed once C and f are built,
+                               // unless the verification needs it)
+    void *input_map;           // Mapped binary input A points into, or NULL
+    size_t input_map_size;
+    mc_csr_t P;                // Approximate inverse of A (split=approx)
+    void *precond_map;         // Mapped binary input P points into, or NULL
+    size_t precond_map_size;
+    double *b;                 // Right-hand side vector
+    double *diag;              // Diagonal of A over omega (Jacobi splitting)
+    mc_csr_t C;                // Iteration matrix C = I - omega M^{-1}A (nonzeros only)
+    double *f;                 // f = omega M^{-1}b
+    double *row_sum;           // Sum of |C_ij| for each row (for transition probabilities)
+    double *absorb;            // Probability that a walk stops at each row
+    double *cv_base;           // Control variate y (the walks estimate x - y), or NULL
+    mc_alias_slot_t *alias;    // Row i's transitions are alias[C.row_ptr[i] .. C.row_ptr[i+1])
     int start_idx;             // First component to compute
     int end_idx;               // Last component to compute (inclusive)
-    long num_walks;            // Number of random walks per component
+    long num_walks;            // Number of random walks per component (at most, with tol)
+    uint64_t seed;             // Seed of the walk random streams (0 = not chosen yet)
+    double tol;                // Target standard error per component, 0 = none
+    long min_walks;            // Walks before the tolerance is checked
+    int mode;                  // Estimator, AXB_MODE_* (axb_params.h)
+    double absorb_prob;        // Absorption probability, or AXB_ABSORB_ROW
+    int cv_sweeps;             // Jacobi sweeps of the control variate, 0 = none
+    int antithetic;            // Run antithetic walk pairs
+    int split;                 // Splitting, AXB_SPLIT_* (axb_params.h)
+    double omega;              // Relaxation factor
+    int block_size;            // Block size of AXB_SPLIT_BLOCK
+    int pilot;                 // Components of a pilot run, 0 = normal run
 } MonteCarloData;
 
-// Initialize random number generator
-void init_random() {
-    unsigned int seed = time(NULL);
-#ifdef _BOINC_
-    // Use more varied seed for BOINC work units
-    seed ^= (unsigned int)getpid();
-#endif
-    srand(seed);
+// Checkpoint payload, followed by the statistics (mc_stats_t) of every
+// component. Whether a component is finished follows from its statistics.
+typedef struct {
+    uint64_t seed;
+    int32_t n;                 // Work unit identity, checked on resume
+    int32_t start_idx;
+    int32_t end_idx;
+    int32_t mode;
+    int64_t num_walks;
+    int64_t min_walks;
+    double tol;
+    double absorb_prob;
+    int32_t cv_sweeps;
+    int32_t antithetic;
+    int32_t split;
+    int32_t block_size;
+    double omega;
+    int32_t component;         // Component mode: component in progress (offset)
+    int32_t reserved;
+    int64_t sweep;             // Suffix mode: sweeps completed
+} AxbCheckpoint;
+
+// Matrix entries as read from the input, before conversion to CSR
+typedef struct {
+    int64_t count;
+    int64_t capacity;
+    int32_t *rows;
+    int32_t *cols;
+    double *vals;
+} CooEntries;
+
+// Allocate 'size' bytes aligned to a cache line. Returns NULL on failure.
+void *alloc_aligned(size_t size) {
+    void *ptr;
+    if (size == 0) size = 1;
+    if (posix_memalign(&ptr, CACHE_LINE, size) != 0) {
+        return NULL;
+    }
+    return ptr;
+}
+
+// Allocate the vectors of a system of dimension n
+int alloc_vectors(MonteCarloData *data, int n) {
+    data->n = n;
+    data->b = alloc_aligned(n * sizeof(double));
+    data->diag = alloc_aligned(n * sizeof(double));
+    data->f = alloc_aligned(n * sizeof(double));
+    data->row_sum = alloc_aligned(n * sizeof(double));
+    data->absorb = alloc_aligned(n * sizeof(double));
+
+    if (!data->b || !data->diag || !data->f || !data->row_sum || !data->absorb) {
+        fprintf(stderr, "Error: Cannot allocate memory for dimension %d\n", n);
+        return -1;
+    }
+    return 0;
+}
+
+// Release the coefficient matrix, unmapping the binary input it lives in
+void release_matrix(MonteCarloData *data) {
+    if (data->input_map) {
+        munmap(data->input_map, data->input_map_size);
+        data->input_map = NULL;
+        memset(&data->A, 0, sizeof(data->A));
+    } else {
+        mc_csr_free(&data->A);
+    }
+}
+
+// Release the approximate inverse
+void release_preconditioner(MonteCarloData *data) {
+    if (data->precond_map) {
+        munmap(data->precond_map, data->precond_map_size);
+        data->precond_map = NULL;
+        memset(&data->P, 0, sizeof(data->P));
+    } else {
+        mc_csr_free(&data->P);
+    }
+}
+
+void free_data(MonteCarloData *data) {
+    release_matrix(data);
+    release_preconditioner(data);
+    mc_csr_free(&data->C);
+    free(data->b);
+    free(data->diag);
+    free(data->f);
+    free(data->row_sum);
+    free(data->absorb);
+    free(data->cv_base);
+    free(data->alias);
+    data->b = data->diag = data->f = data->row_sum = data->absorb = data->cv_base = NULL;
+    data->alias = NULL;
+}
+
+// Append one matrix entry, growing the arrays as needed
+int coo_append(CooEntries *coo, int32_t row, int32_t col, double val) {
+    if (coo->count == coo->capacity) {
+        int64_t capacity = coo->capacity ? 2 * coo->capacity : 1024;
+        int32_t *rows = realloc(coo->rows, capacity * sizeof(int32_t));
+        if (rows) coo->rows = rows;
+        int32_t *cols = realloc(coo->cols, capacity * sizeof(int32_t));
+        if (cols) coo->cols = cols;
+        double *vals = realloc(coo->vals, capacity * sizeof(double));
+        if (vals) coo->vals = vals;
+        if (!rows || !cols || !vals) {
+            fprintf(stderr, "Error: Cannot allocate memory for the matrix\n");
+            return -1;
+        }
+        coo->capacity = capacity;
+    }
+
+    coo->rows[coo->count] = row;
+    coo->cols[coo->count] = col;
+    coo->vals[coo->count] = val;
+    coo->count++;
+    return 0;
+}
+
+void coo_free(CooEntries *coo) {
+    free(coo->rows);
+    free(coo->cols);
+    free(coo->vals);
+    memset(coo, 0, sizeof(*coo));
+}
+
+// Generate a seed for the random streams
+uint64_t make_seed() {
+    uint64_t seed;
+    FILE *urandom = fopen("/dev/urandom", "rb");
+    if (urandom) {
+        size_t got = fread(&seed, sizeof(seed), 1, urandom);
+        fclose(urandom);
+        if (got == 1) {
+            return seed;
+        }
+    }
+    return ((uint64_t)time(NULL) << 20) ^ (uint64_t)getpid();
+}
+
+// Position 'rng' at the start of the stream of one walk.
+// Every walk has its own stream, so its result depends only on
+// (seed, component, walk) and a resumed run repeats it exactly.
+static inline void walk_stream(mc_rng_t *rng, uint64_t seed, int component, long walk) {
+    mc_rng_init(rng, seed, ((uint64_t)component << 32) | (uint32_t)walk);
+}
+
+// Read the n x n dense matrix A, keeping only its nonzero entries
+int read_dense_matrix(FILE *fp, int n, CooEntries *coo) {
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            double value;
+            if (fscanf(fp, "%lf", &value) != 1) {
+                fprintf(stderr, "Error: Cannot read matrix element A[%d][%d]\n", i, j);
+                return -1;
+            }
+            if (value != 0.0 && coo_append(coo, i, j, value) < 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Read nnz "i j A_ij" triplets (0-based, any order, duplicates are summed)
+int read_sparse_matrix(FILE *fp, int n, long nnz, CooEntries *coo) {
+    for (long k = 0; k < nnz; k++) {
+        int i, j;
+        double value;
+        if (fscanf(fp, "%d %d %lf", &i, &j, &value) != 3) {
+            fprintf(stderr, "Error: Cannot read matrix entry %ld of %ld\n", k, nnz);
+            return -1;
+        }
+        if (i < 0 || i >= n || j < 0 || j >= n) {
+            fprintf(stderr, "Error: Matrix entry %ld has invalid position (%d, %d)\n", k, i, j);
+            return -1;
+        }
+        if (coo_append(coo, i, j, value) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Map a binary input (axb_input.h) and use its CSR arrays in place.
+// Returns 0 on success, 1 if the file is not in the binary format, -1 on error.
+int map_binary_input(const char *filename, MonteCarloData *data) {
+    struct stat st;
+    axb_input_view_t view;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open input file %s\n", filename);
+        return -1;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return 1;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 1;
+    }
+
+    if (!axb_input_is_binary(map, (size_t)st.st_size)) {
+        munmap(map, (size_t)st.st_size);
+        return 1;
+    }
+
+    const char *problem = axb_input_open(map, (size_t)st.st_size, &view);
+    if (problem) {
+        fprintf(stderr, "Error: Invalid binary input %s: %s\n", filename, problem);
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+
+    // The matrix is read sequentially once, to build C
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    const axb_input_header_t *h = view.header;
+    if (alloc_vectors(data, (int)h->n) < 0) {
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+
+    data->input_map = map;
+    data->input_map_size = (size_t)st.st_size;
+    data->A.n = (int)h->n;
+    data->A.nnz = h->nnz;
+    data->A.row_ptr = (int64_t *)view.row_ptr;
+    data->A.col = (int32_t *)view.col;
+    data->A.val = (double *)view.val;
+    memcpy(data->b, view.b, h->n * sizeof(double));
+
+    data->start_idx = (int)h->start_idx;
+    data->end_idx = (int)h->end_idx;
+    data->num_walks = (long)h->num_walks;
+    data->seed = h->seed;
+
+    return 0;
 }
 
-// Generate random double in [0, 1)
-double rand_double() {
-    return (double)rand() / (RAND_MAX + 1.0);
+// Use the work unit parameters of a parameter line
+void apply_params(MonteCarloData *data, const axb_params_t *params) {
+    data->start_idx = (int)params->start_idx;
+    data->end_idx = (int)params->end_idx;
+    data->num_walks = params->num_walks;
+    if (params->seed != 0) {
+        data->seed = params->seed;
+    }
+    data->tol = params->tol;
+    data->min_walks = params->min_walks;
+    data->mode = params->mode;
+    data->absorb_prob = params->absorb;
+    data->cv_sweeps = params->cv_sweeps;
+    data->antithetic = params->antithetic;
+    data->split = params->split;
+    data->omega = params->omega;
+    data->block_size = params->block_size;
+    data->pilot = params->pilot;
 }
 
 // Read matrix A and vector b from input file
+//
+// The matrix is either dense ("n" followed by n*n values) or sparse
+// ("sparse n nnz" followed by nnz "i j A_ij" triplets)
 int read_input(const char *filename, MonteCarloData *data) {
+    CooEntries coo;
+    char token[32];
+    long nnz = -1;
+    int n;
+
+    int retval = map_binary_input(filename, data);
+    if (retval <= 0) {
+        return retval;
+    }
+
     FILE *fp = fopen(filename, "r");
     if (!fp) {
         fprintf(stderr, "Error: Cannot open input file %s\n", filename);
         return -1;
     }
 
-    // Read dimension
-    if (fscanf(fp, "%d", &data->n) != 1) {
+    // Read dimension (and the number of entries of a sparse matrix)
+    int sparse = fscanf(fp, "%31s", token) == 1 && strcmp(token, "sparse") == 0;
+    if (sparse ? fscanf(fp, "%d %ld", &n, &nnz) != 2 : sscanf(token, "%d", &n) != 1) {
         fprintf(stderr, "Error: Cannot read matrix dimension\n");
         fclose(fp);
         return -1;
     }
 
-    if (data->n <= 0 || data->n > MAX_DIM) {
-        fprintf(stderr, "Error: Invalid dimension %d (must be 1-%d)\n", data->n, MAX_DIM);
+    if (n <= 0 || (sparse && nnz < 0)) {
+        fprintf(stderr, "Error: Invalid dimension %d\n", n);
+        fclose(fp);
+        return -1;
+    }
+
+    if (alloc_vectors(data, n) < 0) {
         fclose(fp);
         return -1;
     }
 
     // Read matrix A
-    for (int i = 0; i < data->n; i++) {
-        for (int j = 0; j < data->n; j++) {
-            if (fscanf(fp, "%lf", &data->A[i][j]) != 1) {
-                fprintf(stderr, "Error: Cannot read matrix element A[%d][%d]\n", i, j);
-                fclose(fp);
-                return -1;
-            }
-        }
+    memset(&coo, 0, sizeof(coo));
+    retval = sparse ? read_sparse_matrix(fp, n, nnz, &coo) : read_dense_matrix(fp, n, &coo);
+    if (retval == 0 && mc_csr_from_coo(&data->A, n, coo.count, coo.rows, coo.cols, coo.vals) < 0) {
+        fprintf(stderr, "Error: Cannot allocate memory for the matrix\n");
+        retval = -1;
+    }
+    coo_free(&coo);
+
+    if (retval < 0) {
+        fclose(fp);
+        return -1;
     }
 
     // Read vector b
@@ -100,41 +440,399 @@ int read_input(const char *filename, MonteCarloData *data) {
         }
     }
 
-    // Read work unit parameters
-    if (fscanf(fp, "%d %d %ld", &data->start_idx, &data->end_idx, &data->num_walks) != 3) {
+    // Read work unit parameters: the rest of the file is a parameter line
+    // (axb_params.h), "start_idx end_idx num_walks [key=value ...]"
+    char text[AXB_PARAMS_MAX_SIZE + 1], error[256];
+    size_t len = fread(text, 1, AXB_PARAMS_MAX_SIZE, fp);
+    text[len] = '\0';
+    fclose(fp);
+
+    axb_params_t params;
+    long start, end, walks;
+    if (sscanf(text, "%ld %ld %ld", &start, &end, &walks) != 3) {
         // Default: compute all components
         data->start_idx = 0;
         data->end_idx = data->n - 1;
         data->num_walks = DEFAULT_WALKS;
+        return 0;
     }
+    if (axb_params_parse(text, &params, error, sizeof(error)) < 0) {
+        fprintf(stderr, "Error: Invalid work unit parameters: %s\n", error);
+        return -1;
+    }
+    if (start < 0 || end >= data->n || start > end) {
+        fprintf(stderr, "Error: Invalid component range %ld %ld\n", start, end);
+        return -1;
+    }
+    apply_params(data, &params);
+    return 0;
+}
 
-    fclose(fp);
+// Apply a parameter file (axb_params.h), which overrides the component
+// range, number of walks, seed and tolerance stored with the matrix
+int read_params(const char *filename, MonteCarloData *data) {
+    axb_params_t params;
+    char error[256];
+
+    if (axb_params_read(filename, &params, error, sizeof(error)) < 0) {
+        fprintf(stderr, "Error: Invalid parameter file: %s\n", error);
+        return -1;
+    }
+
+    if (params.start_idx < 0 || params.end_idx >= data->n || params.start_idx > params.end_idx) {
+        fprintf(stderr, "Error: Invalid component range %ld %ld\n",
+                params.start_idx, params.end_idx);
+        return -1;
+    }
+
+    apply_params(data, &params);
     return 0;
 }
 
-// Prepare iteration matrix C = I - D^{-1}A and vector f = D^{-1}b
-// Using Jacobi iteration form (D is diagonal of A)
-int prepare_iteration_form(MonteCarloData *data) {
+// Read the approximate inverse P of A for split=approx. It comes in the
+// same formats as the matrix; the vector and parameters of the file are
+// not used.
+int read_preconditioner(const char *filename, MonteCarloData *data) {
+    MonteCarloData precond;
+
+    memset(&precond, 0, sizeof(precond));
+    if (read_input(filename, &precond) < 0) {
+        free_data(&precond);
+        return -1;
+    }
+    if (precond.n != data->n) {
+        fprintf(stderr, "Error: Preconditioner has dimension %d, the matrix %d\n",
+                precond.n, data->n);
+        free_data(&precond);
+        return -1;
+    }
+
+    // Take over P (and the mapping it lives in), free the rest
+    data->P = precond.A;
+    data->precond_map = precond.input_map;
+    data->precond_map_size = precond.input_map_size;
+    memset(&precond.A, 0, sizeof(precond.A));
+    precond.input_map = NULL;
+    free_data(&precond);
+    return 0;
+}
+
+// Check the work unit parameters once all inputs are read
+int check_parameters(MonteCarloData *data) {
+    if (data->start_idx < 0 || data->end_idx >= data->n || data->start_idx > data->end_idx ||
+        data->num_walks < 1 || data->num_walks > MAX_WALKS || data->tol < 0.0 ||
+        data->min_walks < 1) {
+        fprintf(stderr, "Error: Invalid work unit parameters %d %d %ld\n",
+                data->start_idx, data->end_idx, data->num_walks);
+        return -1;
+    }
+    if (data->antithetic && data->mode != AXB_MODE_COMPONENT) {
+        fprintf(stderr, "Error: Antithetic walks need mode=component\n");
+        return -1;
+    }
+    if (data->pilot && data->mode != AXB_MODE_COMPONENT) {
+        fprintf(stderr, "Error: A pilot run needs mode=component\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Absorption probability of every row. With absorb=row a walk continues
+// from row i with probability row_sum_i, so every step multiplies the
+// weight by exactly +-1: weights cannot grow, even when row sums approach 1.
+void choose_absorption(MonteCarloData *data) {
     for (int i = 0; i < data->n; i++) {
-        double diag = data->A[i][i];
+        if (data->absorb_prob == AXB_ABSORB_ROW) {
+            double p = 1.0 - data->row_sum[i];
+            data->absorb[i] = p > MIN_ABSORB_PROB ? p : MIN_ABSORB_PROB;
+        } else {
+            data->absorb[i] = data->absorb_prob;
+        }
+    }
+}
+
+// Build the alias table of every row of C over its nonzero entries.
+// Taking entry j of row i multiplies the walk weight by
+// sign(C_ij) * row_sum_i / (1 - absorb_i).
+int build_transition_tables(MonteCarloData *data) {
+    int retval = -1;
+
+    data->alias = alloc_aligned(data->C.nnz * sizeof(mc_alias_slot_t));
+    if (data->alias) {
+        retval = mc_walk_build_tables(&data->C, data->row_sum, data->absorb, data->alias);
+    }
+
+    if (retval < 0) {
+        fprintf(stderr, "Error: Cannot allocate transition tables\n");
+    }
+    return retval;
+}
+
+// Control variate: y = sum_{k<M} C^k f after M sweeps of x <- Cx + f approximates
+// x, and x - y solves the same system with f replaced by the residual
+// r = f + Cy - y = C^M f. The walks then estimate x - y, whose variance is
+// smaller the better y is, and y_i is added back to the results.
+int prepare_control_variate(MonteCarloData *data) {
+    int n = data->n;
+    double *y = alloc_aligned(n * sizeof(double));
+    double *next = alloc_aligned(n * sizeof(double));
+
+    if (!y || !next) {
+        fprintf(stderr, "Error: Cannot allocate the control variate\n");
+        free(y);
+        free(next);
+        return -1;
+    }
+
+    memset(y, 0, n * sizeof(double));
+    for (int sweep = 0; sweep <= data->cv_sweeps; sweep++) {
+        mc_csr_multiply(&data->C, y, next);
+        for (int i = 0; i < n; i++) {
+            next[i] += data->f[i];
+        }
+        if (sweep == data->cv_sweeps) {
+            break;      // next = Cy + f
+        }
+        double *swap = y;
+        y = next;
+        next = swap;
+    }
+
+    // f <- r = (Cy + f) - y
+    for (int i = 0; i < n; i++) {
+        data->f[i] = next[i] - y[i];
+    }
+
+    free(next);
+    data->cv_base = y;
+    return 0;
+}
+
+// Remove the entries of m that are exactly zero
+void drop_zeros(mc_csr_t *m) {
+    int64_t out = 0;
+    for (int i = 0; i < m->n; i++) {
+        int64_t begin = m->row_ptr[i];
+        m->row_ptr[i] = out;
+        for (int64_t k = begin; k < m->row_ptr[i + 1]; k++) {
+            if (m->val[k] != 0.0) {
+                m->col[out] = m->col[k];
+                m->val[out] = m->val[k];
+                out++;
+            }
+        }
+    }
+    m->row_ptr[m->n] = out;
+    m->nnz = out;
+}
+
+// Relaxed Jacobi splitting: C = I - omega D^{-1}A and f = omega D^{-1}b
+// (D is diagonal of A; omega = 1 is the plain Jacobi iteration)
+int build_jacobi_form(MonteCarloData *data) {
+    const mc_csr_t *A = &data->A;
+    double omega = data->omega;
+
+    // C has the structure of A, with a diagonal only if omega != 1
+    if (mc_csr_alloc(&data->C, data->n, A->nnz) < 0) {
+        fprintf(stderr, "Error: Cannot allocate the iteration matrix\n");
+        return -1;
+    }
+
+    int64_t out = 0;
+    for (int i = 0; i < data->n; i++) {
+        double diag = 0.0;
+
+        for (int64_t k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+            if (A->col[k] == i) diag = A->val[k];
+        }
 
         if (fabs(diag) < 1e-12) {
             fprintf(stderr, "Error: Zero diagonal element A[%d][%d] = %g\n", i, i, diag);
             return -1;
         }
 
-        // f_i = b_i / A_ii
-        data->f[i] = data->b[i] / diag;
+        // f_i = omega b_i / A_ii; A = (D / omega)(I - C) for the verification
+        data->diag[i] = diag / omega;
+        data->f[i] = omega * data->b[i] / diag;
 
-        // C_ij = delta_ij - A_ij/A_ii
-        data->row_sum[i] = 0.0;
-        for (int j = 0; j < data->n; j++) {
-            if (i == j) {
-                data->C[i][j] = 0.0;  // 1 - A_ii/A_ii = 0
-            } else {
-                data->C[i][j] = -data->A[i][j] / diag;
+        // C_ij = delta_ij - omega A_ij/A_ii (0 on the diagonal when omega = 1)
+        data->C.row_ptr[i] = out;
+        for (int64_t k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+            double c = (A->col[k] == i) ? 1.0 - omega : -omega * A->val[k] / diag;
+            if (c != 0.0) {
+                data->C.col[out] = A->col[k];
+                data->C.val[out] = c;
+                out++;
+            }
+        }
+    }
+    data->C.row_ptr[data->n] = out;
+    data->C.nnz = out;
+    return 0;
+}
+
+// Invert the k x k row-major matrix a into inv by Gauss-Jordan elimination
+// with partial pivoting (a is destroyed). Returns -1 if a is singular.
+int invert_dense(int k, double *a, double *inv) {
+    for (int i = 0; i < k * k; i++) {
+        inv[i] = (i / k == i % k) ? 1.0 : 0.0;
+    }
+
+    for (int col = 0; col < k; col++) {
+        int pivot = col;
+        for (int r = col + 1; r < k; r++) {
+            if (fabs(a[r * k + col]) > fabs(a[pivot * k + col])) pivot = r;
+        }
+        if (fabs(a[pivot * k + col]) < 1e-12) {
+            return -1;
+        }
+        if (pivot != col) {
+            for (int j = 0; j < k; j++) {
+                double t = a[col * k + j]; a[col * k + j] = a[pivot * k + j]; a[pivot * k + j] = t;
+                t = inv[col * k + j]; inv[col * k + j] = inv[pivot * k + j]; inv[pivot * k + j] = t;
+            }
+        }
+
+        double scale = 1.0 / a[col * k + col];
+        for (int j = 0; j < k; j++) {
+            a[col * k + j] *= scale;
+            inv[col * k + j] *= scale;
+        }
+        for (int r = 0; r < k; r++) {
+            double factor = a[r * k + col];
+            if (r == col || factor == 0.0) continue;
+            for (int j = 0; j < k; j++) {
+                a[r * k + j] -= factor * a[col * k + j];
+                inv[r * k + j] -= factor * inv[col * k + j];
+            }
+        }
+    }
+    return 0;
+}
+
+// Block Jacobi splitting: M holds the diagonal blocks A_II of block_size
+// consecutive rows, C = I - omega M^{-1}A and f = omega M^{-1}b. Within a
+// block C is (1 - omega) I exactly, so only the couplings between blocks
+// are computed.
+int build_block_form(MonteCarloData *data) {
+    const mc_csr_t *A = &data->A;
+    int K = data->block_size;
+    double omega = data->omega;
+    CooEntries coo;
+    int retval = 0;
+
+    double *block = malloc((size_t)K * K * sizeof(double));
+    double *inv = malloc((size_t)K * K * sizeof(double));
+    memset(&coo, 0, sizeof(coo));
+    if (!block || !inv) {
+        fprintf(stderr, "Error: Cannot allocate the diagonal blocks\n");
+        retval = -1;
+    }
+
+    for (int first = 0; first < data->n && retval == 0; first += K) {
+        int size = (data->n - first < K) ? data->n - first : K;
+
+        memset(block, 0, (size_t)size * size * sizeof(double));
+        for (int a = 0; a < size; a++) {
+            for (int64_t k = A->row_ptr[first + a]; k < A->row_ptr[first + a + 1]; k++) {
+                int j = A->col[k] - first;
+                if (j >= 0 && j < size) block[a * size + j] = A->val[k];
+            }
+        }
+        if (invert_dense(size, block, inv) < 0) {
+            fprintf(stderr, "Error: Singular diagonal block at rows %d-%d\n",
+                    first, first + size - 1);
+            retval = -1;
+            break;
+        }
+
+        for (int a = 0; a < size && retval == 0; a++) {
+            int i = first + a;
+
+            data->f[i] = 0.0;
+            for (int c = 0; c < size; c++) {
+                data->f[i] += omega * inv[a * size + c] * data->b[first + c];
+            }
+
+            if (omega != 1.0) {
+                retval = coo_append(&coo, i, i, 1.0 - omega);
+            }
+            for (int c = 0; c < size && retval == 0; c++) {
+                double weight = -omega * inv[a * size + c];
+                int r = first + c;
+                if (weight == 0.0) continue;
+
+                for (int64_t k = A->row_ptr[r]; k < A->row_ptr[r + 1] && retval == 0; k++) {
+                    int j = A->col[k];
+                    if (j < first || j >= first + size) {
+                        retval = coo_append(&coo, i, j, weight * A->val[k]);
+                    }
+                }
+            }
+        }
+    }
+
+    if (retval == 0 &&
+        mc_csr_from_coo(&data->C, data->n, coo.count, coo.rows, coo.cols, coo.vals) < 0) {
+        fprintf(stderr, "Error: Cannot allocate the iteration matrix\n");
+        retval = -1;
+    }
+    if (retval == 0) {
+        drop_zeros(&data->C);
+    }
+
+    coo_free(&coo);
+    free(block);
+    free(inv);
+    return retval;
+}
+
+// Approximate-inverse splitting: M^{-1} = P, a sparse approximation of
+// A^{-1} computed on the server, so C = I - omega PA and f = omega Pb.
+// The better P is, the smaller C and the shorter the walks.
+int build_approx_form(MonteCarloData *data) {
+    const mc_csr_t *A = &data->A, *P = &data->P;
+    double omega = data->omega;
+    CooEntries coo;
+    int retval = 0;
+
+    memset(&coo, 0, sizeof(coo));
+    for (int i = 0; i < data->n && retval == 0; i++) {
+        data->f[i] = 0.0;
+        retval = coo_append(&coo, i, i, 1.0);
+
+        for (int64_t p = P->row_ptr[i]; p < P->row_ptr[i + 1] && retval == 0; p++) {
+            int r = P->col[p];
+            double weight = -omega * P->val[p];
+
+            data->f[i] += omega * P->val[p] * data->b[r];
+            for (int64_t k = A->row_ptr[r]; k < A->row_ptr[r + 1] && retval == 0; k++) {
+                retval = coo_append(&coo, i, A->col[k], weight * A->val[k]);
             }
-            data->row_sum[i] += fabs(data->C[i][j]);
+        }
+    }
+
+    if (retval == 0 &&
+        mc_csr_from_coo(&data->C, data->n, coo.count, coo.rows, coo.cols, coo.vals) < 0) {
+        fprintf(stderr, "Error: Cannot allocate the iteration matrix\n");
+        retval = -1;
+    }
+    if (retval == 0) {
+        drop_zeros(&data->C);
+    }
+
+    coo_free(&coo);
+    return retval;
+}
+
+// Sum of |C_ij| of every row. Rows with a sum >= 1 do not contract.
+void compute_row_sums(MonteCarloData *data) {
+    double max_row_sum = 0.0;
+
+    for (int i = 0; i < data->n; i++) {
+        data->row_sum[i] = 0.0;
+        for (int64_t k = data->C.row_ptr[i]; k < data->C.row_ptr[i + 1]; k++) {
+            data->row_sum[i] += fabs(data->C.val[k]);
         }
 
         // Check convergence condition: row sum should be < 1
@@ -142,90 +840,864 @@ int prepare_iteration_form(MonteCarloData *data) {
             fprintf(stderr, "Warning: Row %d has sum %g >= 1, convergence not guaranteed\n",
                     i, data->row_sum[i]);
         }
+        if (data->row_sum[i] > max_row_sum) max_row_sum = data->row_sum[i];
     }
 
-    return 0;
+    printf("Iteration matrix: %ld nonzeros, max row sum of |C| %.6f\n",
+           (long)data->C.nnz, max_row_sum);
 }
 
-// Perform one random walk starting from state i
-// Returns the sum accumulated along the walk
-double random_walk(MonteCarloData *data, int start_state) {
-    const int MAX_STEPS = 10000;
-    const double TERMINATION_PROB = 0.1;  // Probability to terminate at each step
+// Prepare iteration matrix C = I - omega M^{-1}A and vector f = omega M^{-1}b
+// for the splitting of the work unit (by default Jacobi: M = D, the
+// diagonal of A, and omega = 1).
+// A is released afterwards unless the verification needs it: the walks only
+// need C and f, and for the Jacobi splitting the verification rebuilds A
+// from C and the diagonal.
+int prepare_iteration_form(MonteCarloData *data) {
+    int retval;
+
+    switch (data->split) {
+    case AXB_SPLIT_BLOCK:
+        retval = build_block_form(data);
+        break;
+    case AXB_SPLIT_APPROX:
+        retval = build_approx_form(data);
+        break;
+    default:
+        retval = build_jacobi_form(data);
+        break;
+    }
+    if (retval < 0) {
+        return -1;
+    }
+
+    compute_row_sums(data);
 
-    double sum = 0.0;
+    release_preconditioner(data);
+    if (data->split == AXB_SPLIT_JACOBI || data->start_idx != 0 || data->end_idx != data->n - 1) {
+        release_matrix(data);
+    }
+
+    if (data->cv_sweeps > 0 && prepare_control_variate(data) < 0) {
+        return -1;
+    }
+
+    choose_absorption(data);
+    return build_transition_tables(data);
+}
+
+// Perform one random walk starting from state i ('reflect': the antithetic
+// twin of the walk of this stream), see mc_walk.h
+// Returns the sum accumulated along the walk and counts the walk in 'walks'
+static inline double random_walk(MonteCarloData *data, int start_state, mc_rng_t *rng,
+                                 int reflect, mc_walks_t *walks) {
+    mc_walk_t walk = { data->C.row_ptr, data->alias, data->f, data->row_sum, data->absorb };
+    int length;
+    double sum = mc_walk_run(&walk, start_state, rng, reflect, &length);
+    mc_walks_add(walks, length);
+    return sum;
+}
+
+// Perform one random walk starting from state i and record its path:
+// states[0 .. steps) are the states visited, mult[k] the weight factor of
+// the move from states[k] to states[k+1]. Returns the number of states.
+int record_walk(MonteCarloData *data, int start_state, mc_rng_t *rng, int *states,
+                double *mult) {
     int current_state = start_state;
-    double weight = 1.0;
+    int steps = 0;
 
-    for (int step = 0; step < MAX_STEPS; step++) {
-        // Add contribution from current state
-        sum += weight * data->f[current_state];
+    while (steps < MAX_STEPS) {
+        states[steps++] = current_state;
 
-        // Terminate with some probability
-        if (rand_double() < TERMINATION_PROB) {
+        if (mc_rng_next_double(rng) < data->absorb[current_state]) {
             break;
         }
 
-        // Choose next state based on transition probabilities
-        // P(i -> j) = |C_ij| / sum_k |C_ik|
-        if (data->row_sum[current_state] < 1e-12) {
-            break;  // No transitions available
+        int64_t first = data->C.row_ptr[current_state];
+        int m = (int)(data->C.row_ptr[current_state + 1] - first);
+        if (m == 0 || data->row_sum[current_state] < 1e-12) {
+            break;
         }
 
-        double r = rand_double() * data->row_sum[current_state];
-        double cumsum = 0.0;
-        int next_state = current_state;
+        double u1 = mc_rng_next_double(rng);
+        double u2 = mc_rng_next_double(rng);
+        current_state = mc_alias_sample(data->alias + first, m, u1, u2, &mult[steps - 1]);
+    }
 
-        for (int j = 0; j < data->n; j++) {
-            cumsum += fabs(data->C[current_state][j]);
-            if (r <= cumsum) {
-                next_state = j;
-                // Update weight with sign of C_ij
-                weight *= (data->C[current_state][j] >= 0) ? 1.0 : -1.0;
-                weight *= data->row_sum[current_state] / (1.0 - TERMINATION_PROB);
-                break;
+    return steps;
+}
+
+// Save progress: the statistics of all components, the component in
+// progress (component mode) and the sweeps completed (suffix mode)
+int write_checkpoint(const char *filename, MonteCarloData *data, const mc_stats_t *stats,
+                     int component, long sweep) {
+    int num_components = data->end_idx - data->start_idx + 1;
+    size_t size = sizeof(AxbCheckpoint) + num_components * sizeof(mc_stats_t);
+    char *buffer = malloc(size);
+    if (!buffer) {
+        return -1;
+    }
+
+    AxbCheckpoint *ckpt = (AxbCheckpoint *)buffer;
+    memset(ckpt, 0, sizeof(*ckpt));
+    ckpt->seed = data->seed;
+    ckpt->n = data->n;
+    ckpt->start_idx = data->start_idx;
+    ckpt->end_idx = data->end_idx;
+    ckpt->mode = data->mode;
+    ckpt->num_walks = data->num_walks;
+    ckpt->min_walks = data->min_walks;
+    ckpt->tol = data->tol;
+    ckpt->absorb_prob = data->absorb_prob;
+    ckpt->cv_sweeps = data->cv_sweeps;
+    ckpt->antithetic = data->antithetic;
+    ckpt->split = data->split;
+    ckpt->block_size = data->block_size;
+    ckpt->omega = data->omega;
+    ckpt->component = component;
+    ckpt->sweep = sweep;
+    memcpy(buffer + sizeof(AxbCheckpoint), stats, num_components * sizeof(mc_stats_t));
+
+    int retval = mc_checkpoint_write(filename, MC_CHECKPOINT_APP_AXB, AXB_CHECKPOINT_VERSION,
+                                     buffer, size);
+    free(buffer);
+    return retval;
+}
+
+// Restore progress written by write_checkpoint().
+// Returns 0 and fills the outputs if a checkpoint for this work unit exists.
+int read_checkpoint(const char *filename, MonteCarloData *data, mc_stats_t *stats,
+                    int *component, long *sweep) {
+    int num_components = data->end_idx - data->start_idx + 1;
+    size_t capacity = sizeof(AxbCheckpoint) + num_components * sizeof(mc_stats_t);
+    size_t size;
+    char *buffer = malloc(capacity);
+    if (!buffer) {
+        return -1;
+    }
+
+    if (mc_checkpoint_read(filename, MC_CHECKPOINT_APP_AXB, AXB_CHECKPOINT_VERSION,
+                           buffer, capacity, &size) != 0) {
+        free(buffer);
+        return -1;
+    }
+
+    AxbCheckpoint *ckpt = (AxbCheckpoint *)buffer;
+    if (size != capacity || ckpt->n != data->n || ckpt->start_idx != data->start_idx ||
+        ckpt->end_idx != data->end_idx || ckpt->mode != data->mode ||
+        ckpt->num_walks != data->num_walks || ckpt->min_walks != data->min_walks ||
+        ckpt->tol != data->tol || ckpt->absorb_prob != data->absorb_prob ||
+        ckpt->cv_sweeps != data->cv_sweeps || ckpt->antithetic != data->antithetic ||
+        ckpt->split != data->split || ckpt->block_size != data->block_size ||
+        ckpt->omega != data->omega ||
+        ckpt->component < 0 || ckpt->component >= num_components ||
+        ckpt->sweep < 0 || ckpt->sweep > data->num_walks) {
+        fprintf(stderr, "Warning: Checkpoint %s does not match this work unit, ignoring it\n",
+                filename);
+        free(buffer);
+        return -1;
+    }
+
+    data->seed = ckpt->seed;
+    *component = ckpt->component;
+    *sweep = ckpt->sweep;
+    memcpy(stats, buffer + sizeof(AxbCheckpoint), num_components * sizeof(mc_stats_t));
+
+    free(buffer);
+    return 0;
+}
+
+// Value of "--name value" on the command line, or NULL
+const char *get_option(int argc, char **argv, const char *name) {
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            return argv[i + 1];
+        }
+    }
+    return NULL;
+}
+
+// Is the option "--name" (without a value) on the command line?
+int has_flag(int argc, char **argv, const char *name) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Number of worker threads: "--nthreads N" on the command line (set via
+// <cmdline> in app_config.xml or the app version), else 1
+int get_num_threads(int argc, char **argv) {
+    const char *option = get_option(argc, argv, "--nthreads");
+    int nthreads = option ? atoi(option) : 1;
+
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > MC_POOL_MAX_THREADS) nthreads = MC_POOL_MAX_THREADS;
+    return nthreads;
+}
+
+// Decide whether a checkpoint should be written now
+int time_to_checkpoint(time_t *last_checkpoint) {
+#ifdef _BOINC_
+    (void)last_checkpoint;
+    return boinc_time_to_checkpoint();
+#else
+    return time(NULL) - *last_checkpoint >= CHECKPOINT_INTERVAL;
+#endif
+}
+
+// One round of walks: a run of consecutive tasks.
+// Component mode: task t runs walks [task_begin[t], task_end[t]) of
+// component task_component[t] and stores their statistics in task_stats[t].
+// Suffix mode: task t runs sweeps [task_begin[t], task_end[t]), one walk
+// from every component per sweep, and stores the statistics of component c
+// in sweep_stats[t * num_components + c].
+// Either way task t counts its walks in task_walks[t] (mc_telemetry.h).
+typedef struct {
+    MonteCarloData *data;
+    long num_tasks;
+    int task_component[MAX_ROUND_TASKS];   // Offset from start_idx
+    long task_begin[MAX_ROUND_TASKS];
+    long task_end[MAX_ROUND_TASKS];
+    mc_stats_t task_stats[MAX_ROUND_TASKS];
+    mc_walks_t task_walks[MAX_ROUND_TASKS];
+    mc_stats_t *sweep_stats;
+    long *last_visit;                      // Per task and component, like sweep_stats
+} WalkRound;
+
+// Run the walks of one task (called from the pool threads)
+void run_walk_task(void *ctx, long task) {
+    WalkRound *round = (WalkRound *)ctx;
+    MonteCarloData *data = round->data;
+    int i = data->start_idx + round->task_component[task];
+    mc_walks_t *walks = &round->task_walks[task];
+    mc_stats_t stats;
+
+    mc_stats_init(&stats);
+    mc_walks_init(walks);
+    for (long walk = round->task_begin[task]; walk < round->task_end[task]; walk++) {
+        mc_rng_t rng;
+        walk_stream(&rng, data->seed, i, walk);
+        double score = random_walk(data, i, &rng, 0, walks);
+
+        if (data->antithetic) {
+            // The twin replays the same stream with reflected numbers;
+            // the pair's mean is one sample
+            walk_stream(&rng, data->seed, i, walk);
+            score = 0.5 * (score + random_walk(data, i, &rng, 1, walks));
+        }
+        mc_stats_add(&stats, score);
+    }
+
+    round->task_stats[task] = stats;
+}
+
+// Run the sweeps of one suffix-mode task (called from the pool threads)
+//
+// The part of a walk from step k on is itself a walk from states[k] with
+// weights relative to step k, so its sum is an estimate of x[states[k]].
+// Only the first visit of each component in a walk is used: by the Markov
+// property what follows it is independent of the walks of other sweeps, so
+// the samples of a component stay independent and their variance gives a
+// valid standard error.
+void run_sweep_task(void *ctx, long task) {
+    static __thread int states[MAX_STEPS];
+    static __thread double mult[MAX_STEPS];
+    static __thread double suffix[MAX_STEPS];
+    WalkRound *round = (WalkRound *)ctx;
+    MonteCarloData *data = round->data;
+    int num_components = data->end_idx - data->start_idx + 1;
+    mc_stats_t *stats = round->sweep_stats + task * num_components;
+    long *last_visit = round->last_visit + task * num_components;
+    mc_walks_t *walks = &round->task_walks[task];
+    long walk_id = 0;
+
+    mc_walks_init(walks);
+    for (int c = 0; c < num_components; c++) {
+        mc_stats_init(&stats[c]);
+        last_visit[c] = -1;
+    }
+
+    for (long sweep = round->task_begin[task]; sweep < round->task_end[task]; sweep++) {
+        for (int c = 0; c < num_components; c++, walk_id++) {
+            mc_rng_t rng;
+            walk_stream(&rng, data->seed, data->start_idx + c, sweep);
+            int steps = record_walk(data, data->start_idx + c, &rng, states, mult);
+            mc_walks_add(walks, steps);
+
+            // Sums of the suffixes, from the end of the walk backwards
+            suffix[steps - 1] = data->f[states[steps - 1]];
+            for (int k = steps - 2; k >= 0; k--) {
+                suffix[k] = data->f[states[k]] + mult[k] * suffix[k + 1];
+            }
+
+            for (int k = 0; k < steps; k++) {
+                int offset = states[k] - data->start_idx;
+                if (offset >= 0 && offset < num_components && last_visit[offset] != walk_id) {
+                    last_visit[offset] = walk_id;
+                    mc_stats_add(&stats[offset], suffix[k]);
+                }
             }
         }
+    }
+}
 
-        current_state = next_state;
+// Fill a round with up to max_tasks tasks starting at walk 'walk' of
+// component (offset) 'idx'. Tasks end at multiples of WALKS_PER_TASK, so
+// the split into tasks does not depend on the number of threads.
+void plan_round(WalkRound *round, MonteCarloData *data, int idx, long walk, long max_tasks) {
+    int num_components = data->end_idx - data->start_idx + 1;
+
+    round->num_tasks = 0;
+    while (idx < num_components && round->num_tasks < max_tasks) {
+        long end = (walk / WALKS_PER_TASK + 1) * WALKS_PER_TASK;
+        if (end > data->num_walks) end = data->num_walks;
+
+        round->task_component[round->num_tasks] = idx;
+        round->task_begin[round->num_tasks] = walk;
+        round->task_end[round->num_tasks] = end;
+        round->num_tasks++;
+
+        walk = end;
+        if (walk == data->num_walks) {
+            idx++;
+            walk = 0;
+        }
     }
+}
 
-    return sum;
+// Sweeps per suffix-mode task: about WALKS_PER_TASK walks
+long sweeps_per_task(MonteCarloData *data) {
+    long num_components = data->end_idx - data->start_idx + 1;
+    return num_components < WALKS_PER_TASK ? WALKS_PER_TASK / num_components : 1;
 }
 
+// Fill a suffix-mode round with up to max_tasks tasks starting at 'sweep'.
+// Like plan_round(), task boundaries do not depend on the number of threads.
+void plan_sweep_round(WalkRound *round, MonteCarloData *data, long sweep, long max_tasks) {
+    long per_task = sweeps_per_task(data);
+
+    round->num_tasks = 0;
+    while (sweep < data->num_walks && round->num_tasks < max_tasks) {
+        long end = (sweep / per_task + 1) * per_task;
+        if (end > data->num_walks) end = data->num_walks;
+
+        round->task_begin[round->num_tasks] = sweep;
+        round->task_end[round->num_tasks] = end;
+        round->num_tasks++;
+        sweep = end;
+    }
+}
+
+// Has a component with the walks in 'stats' reached the tolerance?
+int converged(MonteCarloData *data, const mc_stats_t *stats) {
+    return data->tol > 0.0 && stats->count >= data->min_walks && stats->count >= 2 &&
+           mc_stats_std_error(stats) <= data->tol;
+}
+
+// Is a component finished: all its walks run, or the tolerance reached?
+int component_done(MonteCarloData *data, const mc_stats_t *stats) {
+    return stats->count >= data->num_walks || converged(data, stats);
+}
+
+// Estimate of component (offset) idx from the statistics of its walks
+double component_value(MonteCarloData *data, int idx, const mc_stats_t *stats) {
+    return data->cv_base ? data->cv_base[data->start_idx + idx] + stats->mean : stats->mean;
+}
+
+void report_component(MonteCarloData *data, int idx, const mc_stats_t *stats) {
+    printf("x[%d] = %.10f +- %.3e (from %ld %s)\n", data->start_idx + idx,
+           component_value(data, idx, stats),
+           mc_stats_std_error(stats), (long)stats->count,
+           data->mode == AXB_MODE_SUFFIX ? "walk suffixes" : "walks");
+}
+
+// Walk tables on the GPU of a GPU app version (-DMC_OPENCL): the
+// component-mode tasks of a round run there with axb_walks of
+// mc_kernels.cl, one work-group per task, and give the same statistics
+// and counters as run_walk_task()
+typedef struct WalkDevice WalkDevice;
+
+#ifdef MC_OPENCL
+struct WalkDevice {
+    mc_cl_t cl;
+    cl_kernel kernel;
+    cl_mem row_ptr, alias, f, row_sum, absorb;
+    cl_mem task_component, task_begin, task_end, task_stats, task_walks;
+};
+
+// The kernel reads these arrays with the layouts of its own structs
+_Static_assert(sizeof(long) == sizeof(cl_long), "task_begin must be 64-bit");
+_Static_assert(sizeof(mc_alias_slot_t) == 32, "alias_slot_t layout");
+_Static_assert(sizeof(mc_stats_t) == 24, "stats_t layout");
+_Static_assert(sizeof(mc_walks_t) == (MC_TELEMETRY_BINS + 1) * 8, "walks_t layout");
+
+void close_walk_device(WalkDevice *device) {
+    cl_mem *buffers[] = { &device->row_ptr, &device->alias, &device->f, &device->row_sum,
+                          &device->absorb, &device->task_component, &device->task_begin,
+                          &device->task_end, &device->task_stats, &device->task_walks };
+
+    for (size_t k = 0; k < sizeof(buffers) / sizeof(buffers[0]); k++) {
+        if (*buffers[k]) clReleaseMemObject(*buffers[k]);
+        *buffers[k] = NULL;
+    }
+    if (device->kernel) clReleaseKernel(device->kernel);
+    device->kernel = NULL;
+    mc_cl_close(&device->cl);
+}
+
+// Open the GPU the client assigned and copy the walk tables to it.
+// Returns 0 on success, -1 if there is no usable device.
+int open_walk_device(WalkDevice *device, MonteCarloData *data, int argc, char **argv) {
+    int n = data->n;
+    int64_t nnz = data->C.row_ptr[n];
+
+    memset(device, 0, sizeof(*device));
+    if (mc_cl_open(&device->cl, argc, argv) < 0) {
+        return -1;
+    }
+    device->kernel = mc_cl_kernel(&device->cl, "axb_walks");
+    device->row_ptr = mc_cl_buffer(&device->cl, (n + 1) * sizeof(int64_t), data->C.row_ptr);
+    device->alias = mc_cl_buffer(&device->cl, nnz * sizeof(mc_alias_slot_t), data->alias);
+    device->f = mc_cl_buffer(&device->cl, n * sizeof(double), data->f);
+    device->row_sum = mc_cl_buffer(&device->cl, n * sizeof(double), data->row_sum);
+    device->absorb = mc_cl_buffer(&device->cl, n * sizeof(double), data->absorb);
+    device->task_component = mc_cl_buffer(&device->cl, MAX_ROUND_TASKS * sizeof(cl_int), NULL);
+    device->task_begin = mc_cl_buffer(&device->cl, MAX_ROUND_TASKS * sizeof(cl_long), NULL);
+    device->task_end = mc_cl_buffer(&device->cl, MAX_ROUND_TASKS * sizeof(cl_long), NULL);
+    device->task_stats = mc_cl_buffer(&device->cl, MAX_ROUND_TASKS * sizeof(mc_stats_t), NULL);
+    device->task_walks = mc_cl_buffer(&device->cl, MAX_ROUND_TASKS * sizeof(mc_walks_t), NULL);
+
+    if (!device->kernel || !device->row_ptr || !device->alias || !device->f ||
+        !device->row_sum || !device->absorb || !device->task_component ||
+        !device->task_begin || !device->task_end || !device->task_stats ||
+        !device->task_walks) {
+        close_walk_device(device);
+        return -1;
+    }
+
+    // The seed and the antithetic flag (arguments 5 and 6) are set per
+    // round: the seed may still be replaced by a checkpoint's
+    cl_int err = CL_SUCCESS;
+    err |= clSetKernelArg(device->kernel, 0, sizeof(cl_mem), &device->row_ptr);
+    err |= clSetKernelArg(device->kernel, 1, sizeof(cl_mem), &device->alias);
+    err |= clSetKernelArg(device->kernel, 2, sizeof(cl_mem), &device->f);
+    err |= clSetKernelArg(device->kernel, 3, sizeof(cl_mem), &device->row_sum);
+    err |= clSetKernelArg(device->kernel, 4, sizeof(cl_mem), &device->absorb);
+    err |= clSetKernelArg(device->kernel, 7, sizeof(cl_mem), &device->task_component);
+    err |= clSetKernelArg(device->kernel, 8, sizeof(cl_mem), &device->task_begin);
+    err |= clSetKernelArg(device->kernel, 9, sizeof(cl_mem), &device->task_end);
+    err |= clSetKernelArg(device->kernel, 10, sizeof(cl_mem), &device->task_stats);
+    err |= clSetKernelArg(device->kernel, 11, sizeof(cl_mem), &device->task_walks);
+    err |= clSetKernelArg(device->kernel, 12, MC_CL_LOCAL_SIZE * sizeof(cl_long), NULL);
+    if (mc_cl_check(err, "axb_walks arguments") < 0) {
+        close_walk_device(device);
+        return -1;
+    }
+
+    printf("Running the walks on OpenCL device %s\n", device->cl.name);
+    return 0;
+}
+
+// Run the tasks of a component-mode round on the device, filling
+// task_stats and task_walks. Returns 0 on success, -1 on a device error.
+int run_device_round(WalkDevice *device, WalkRound *round) {
+    cl_int component[MAX_ROUND_TASKS];
+    size_t count = round->num_tasks;
+    size_t local = MC_CL_LOCAL_SIZE, global = count * MC_CL_LOCAL_SIZE;
+    cl_command_queue queue = device->cl.queue;
+    cl_ulong seed = round->data->seed;
+    cl_int antithetic = round->data->antithetic;
+    cl_int err = CL_SUCCESS;
+
+    if (count == 0) return 0;
+
+    err |= clSetKernelArg(device->kernel, 5, sizeof(seed), &seed);
+    err |= clSetKernelArg(device->kernel, 6, sizeof(antithetic), &antithetic);
+
+    // The kernel takes absolute component indices
+    for (size_t t = 0; t < count; t++) {
+        component[t] = round->data->start_idx + round->task_component[t];
+    }
+    err |= clEnqueueWriteBuffer(queue, device->task_component, CL_FALSE, 0,
+                                count * sizeof(cl_int), component, 0, NULL, NULL);
+    err |= clEnqueueWriteBuffer(queue, device->task_begin, CL_FALSE, 0,
+                                count * sizeof(cl_long), round->task_begin, 0, NULL, NULL);
+    err |= clEnqueueWriteBuffer(queue, device->task_end, CL_FALSE, 0,
+                                count * sizeof(cl_long), round->task_end, 0, NULL, NULL);
+    if (err == CL_SUCCESS) {
+        err = clEnqueueNDRangeKernel(queue, device->kernel, 1, NULL, &global, &local,
+                                     0, NULL, NULL);
+    }
+    if (err == CL_SUCCESS) {
+        err = clEnqueueReadBuffer(queue, device->task_stats, CL_FALSE, 0,
+                                  count * sizeof(mc_stats_t), round->task_stats, 0, NULL, NULL);
+    }
+    if (err == CL_SUCCESS) {
+        err = clEnqueueReadBuffer(queue, device->task_walks, CL_TRUE, 0,
+                                  count * sizeof(mc_walks_t), round->task_walks, 0, NULL, NULL);
+    }
+    return mc_cl_check(err, "axb_walks");
+}
+#endif
+
 // Compute solution components using Monte Carlo
-void compute_solution(MonteCarloData *data, double *x_partial) {
+//
+// The walks run in rounds on a work-stealing thread pool (mc_pool.h).
+// Task statistics are merged in task order, and each walk has its own
+// random stream, so the result depends only on the seed, not on the number
+// of threads or on where a checkpoint was taken. The tolerance is checked
+// after every task, so a component stops at the same walk every time; what
+// the rest of the round computed for it is discarded.
+//
+// In component mode the walks of one component run before those of the
+// next. In suffix mode every sweep starts one walk at each component and
+// each walk adds a sample to every component of the range it visits; the
+// run ends once all components are finished.
+//
+// Each component's value, standard error and number of samples go to
+// x_partial, std_error and samples. The walks and checkpoints of this run
+// are counted in 'telemetry'. If
+// 'device' is not NULL the component-mode rounds run on it; a round
+// falls back to the thread pool if the device fails.
+int compute_solution(MonteCarloData *data, double *x_partial, double *std_error,
+                     int64_t *samples, const char *checkpoint_file, int nthreads, WalkDevice *device,
+                     mc_telemetry_t *telemetry) {
     int num_components = data->end_idx - data->start_idx + 1;
+    int suffix_mode = data->mode == AXB_MODE_SUFFIX;
+    int idx = 0;                // Component mode: component in progress
+    long sweep = 0;             // Suffix mode: sweeps completed
+    long total_walks = 0;
 
-    printf("Computing components %d to %d using %ld walks each\n",
-           data->start_idx, data->end_idx, data->num_walks);
+    if (data->tol > 0.0) {
+        printf("Computing components %d to %d to a standard error of %g (%ld to %ld %s each)\n",
+               data->start_idx, data->end_idx, data->tol, data->min_walks, data->num_walks,
+               suffix_mode ? "samples" : "walks");
+    } else {
+        printf("Computing components %d to %d using %ld %s each\n",
+               data->start_idx, data->end_idx, data->num_walks,
+               suffix_mode ? "samples" : "walks");
+    }
 
-    for (int idx = 0; idx < num_components; idx++) {
-        int i = data->start_idx + idx;
-        double sum = 0.0;
+    mc_stats_t *stats = malloc(num_components * sizeof(mc_stats_t));
+    unsigned char *done = calloc(num_components, 1);
+    WalkRound *round = calloc(1, sizeof(WalkRound));
+    mc_pool_t *pool = malloc(sizeof(mc_pool_t));
+    if (!stats || !done || !round || !pool) {
+        fprintf(stderr, "Error: Cannot allocate the walk scheduler\n");
+        free(stats);
+        free(done);
+        free(round);
+        free(pool);
+        return -1;
+    }
+    round->data = data;
 
-        for (long walk = 0; walk < data->num_walks; walk++) {
-            sum += random_walk(data, i);
+    for (int c = 0; c < num_components; c++) {
+        mc_stats_init(&stats[c]);
+    }
+    if (read_checkpoint(checkpoint_file, data, stats, &idx, &sweep) == 0) {
+        if (suffix_mode) {
+            printf("Resuming from checkpoint at sweep %ld\n", sweep);
+        } else {
+            printf("Resuming from checkpoint at component %d, walk %ld\n",
+                   data->start_idx + idx, (long)stats[idx].count);
+        }
+    }
+
+    int remaining = 0;
+    for (int c = 0; c < num_components; c++) {
+        done[c] = suffix_mode ? component_done(data, &stats[c]) : c < idx;
+        remaining += !done[c];
+    }
+
+    nthreads = mc_pool_create(pool, nthreads);
+    printf("Using %d worker thread(s)\n", nthreads);
+    telemetry->threads = nthreads;
 
+    long round_tasks = (long)nthreads * ROUND_TASKS_PER_THREAD;
+    if (round_tasks > MAX_ROUND_TASKS) round_tasks = MAX_ROUND_TASKS;
+    if (device && !suffix_mode) {
+        // A GPU needs every task of the round to fill it
+        round_tasks = MAX_ROUND_TASKS;
+    }
+
+    time_t last_checkpoint = time(NULL);
+    int retval = 0;
+
+    if (suffix_mode) {
+        // Every task keeps statistics for all components of the range
+        if (round_tasks * num_components > MAX_ROUND_STATS) {
+            round_tasks = MAX_ROUND_STATS / num_components;
+            if (round_tasks < nthreads) round_tasks = nthreads;
+        }
+        round->sweep_stats = malloc(round_tasks * num_components * sizeof(mc_stats_t));
+        round->last_visit = malloc(round_tasks * num_components * sizeof(long));
+        if (!round->sweep_stats || !round->last_visit) {
+            fprintf(stderr, "Error: Cannot allocate the walk scheduler\n");
+            retval = -1;
+        }
+    }
+
+    while (retval == 0 && remaining > 0) {
 #ifdef _BOINC_
-            // Report progress to BOINC
-            if (walk % 1000 == 0) {
-                double progress = (idx + (double)walk / data->num_walks) / num_components;
-                boinc_fraction_done(progress);
+        // Report progress to BOINC
+        double progress = suffix_mode ? (double)sweep / data->num_walks :
+            (idx + (double)stats[idx].count / data->num_walks) / num_components;
+        boinc_fraction_done(progress);
+#endif
+        if (time_to_checkpoint(&last_checkpoint)) {
+            double checkpoint_start = mc_telemetry_now();
+            if (write_checkpoint(checkpoint_file, data, stats, idx, sweep) < 0) {
+                fprintf(stderr, "Error: Cannot write checkpoint %s\n", checkpoint_file);
+                retval = -1;
+                break;
             }
+            mc_telemetry_checkpoint(telemetry, mc_telemetry_now() - checkpoint_start);
+            last_checkpoint = time(NULL);
+#ifdef _BOINC_
+            boinc_checkpoint_completed();
 #endif
         }
 
-        // Average over all walks
-        x_partial[idx] = sum / data->num_walks;
+        if (suffix_mode) {
+            plan_sweep_round(round, data, sweep, round_tasks);
+            mc_pool_run(pool, round->num_tasks, run_sweep_task, round);
+        } else {
+            plan_round(round, data, idx, stats[idx].count, round_tasks);
+            int on_device = 0;
+#ifdef MC_OPENCL
+            if (device) {
+                on_device = run_device_round(device, round) == 0;
+                if (!on_device) {
+                    fprintf(stderr, "Warning: OpenCL device failed, running the walks on the CPU\n");
+                    device = NULL;
+                }
+            }
+#endif
+            if (!on_device) {
+                mc_pool_run(pool, round->num_tasks, run_walk_task, round);
+            }
+        }
+        if (round->num_tasks == 0) {
+            break;      // No walks left (cannot happen with consistent statistics)
+        }
+
+        // Every walk run counts, including those of components that
+        // stopped at their tolerance during the round
+        for (long t = 0; t < round->num_tasks; t++) {
+            mc_walks_merge(&telemetry->walks, &round->task_walks[t]);
+        }
+
+        // Deterministic reduction, in task order
+        for (long t = 0; t < round->num_tasks && remaining > 0; t++) {
+            if (suffix_mode) {
+                for (int c = 0; c < num_components; c++) {
+                    if (!done[c]) {
+                        mc_stats_merge(&stats[c], &round->sweep_stats[t * num_components + c]);
+                    }
+                }
+                for (int c = 0; c < num_components; c++) {
+                    if (!done[c] && component_done(data, &stats[c])) {
+                        done[c] = 1;
+                        remaining--;
+                        report_component(data, c, &stats[c]);
+                    }
+                }
+                total_walks += (round->task_end[t] - round->task_begin[t]) * num_components;
+                sweep = round->task_end[t];
+                continue;
+            }
 
-        printf("x[%d] = %.10f (from %ld walks)\n", i, x_partial[idx], data->num_walks);
+            if (round->task_component[t] != idx) {
+                continue;   // Component already stopped at its tolerance
+            }
+            mc_stats_merge(&stats[idx], &round->task_stats[t]);
+            // An antithetic pair is two walks
+            total_walks +=
+                (round->task_end[t] - round->task_begin[t]) * (data->antithetic ? 2 : 1);
+
+            if (component_done(data, &stats[idx])) {
+                done[idx] = 1;
+                remaining--;
+                report_component(data, idx, &stats[idx]);
+                idx++;
+            }
+        }
     }
+
+    if (retval == 0) {
+        // Average over the walks
+        for (int c = 0; c < num_components; c++) {
+            x_partial[c] = component_value(data, c, &stats[c]);
+            std_error[c] = mc_stats_std_error(&stats[c]);
+            samples[c] = stats[c].count;
+        }
+        printf("Total walks this run: %ld\n", total_walks);
+        telemetry->samples = total_walks;
+    }
+
+    mc_pool_destroy(pool);
+    free(pool);
+    free(round->sweep_stats);
+    free(round->last_visit);
+    free(round);
+    free(stats);
+    free(done);
+    return retval;
 }
 
-// Write results to output file
-int write_output(const char *filename, MonteCarloData *data, double *x_partial) {
+// Pilot run: a round of one task per pilot component, timed per task
+typedef struct {
+    WalkRound *round;
+    double task_seconds[MAX_ROUND_TASKS];
+} PilotRound;
+
+void run_pilot_task(void *ctx, long task) {
+    PilotRound *pilot = (PilotRound *)ctx;
+    double start = mc_telemetry_now();
+    run_walk_task(pilot->round, task);
+    pilot->task_seconds[task] = mc_telemetry_now() - start;
+}
+
+// Run the num_walks walks of a pilot at data->pilot components spread
+// evenly over the range (the midpoints of equal slices) and write the
+// cost report tools/generate_axb_work.py sizes work units from:
+//
+//   pilot <components> walks <num_walks> threads <threads>
+//   <component> <value> <std_error> <variance> <mean_walk_length> <seconds>
+//
+// The variance is that of one sample (an antithetic pair counts as one),
+// the walk length the mean number of states a walk visited and the
+// seconds the time the component's walks took on one thread.
+int run_pilot(MonteCarloData *data, const char *filename, int nthreads,
+              mc_telemetry_t *telemetry) {
+    int num_components = data->end_idx - data->start_idx + 1;
+    int pilot_components = data->pilot < num_components ? data->pilot : num_components;
+    WalkRound *round = calloc(1, sizeof(WalkRound));
+    PilotRound *pilot = malloc(sizeof(PilotRound));
+    mc_pool_t *pool = malloc(sizeof(mc_pool_t));
+
+    if (!round || !pilot || !pool) {
+        fprintf(stderr, "Error: Cannot allocate the pilot run\n");
+        free(round);
+        free(pilot);
+        free(pool);
+        return -1;
+    }
+    printf("Pilot run: %ld walks at %d of components %d to %d%s\n",
+           data->num_walks, pilot_components, data->start_idx, data->end_idx,
+           data->tol > 0.0 ? " (tolerance ignored)" : "");
+
+    round->data = data;
+    round->num_tasks = pilot_components;
+    for (int k = 0; k < pilot_components; k++) {
+        round->task_component[k] =
+            (int)(((2 * (long)k + 1) * num_components) / (2 * pilot_components));
+        round->task_begin[k] = 0;
+        round->task_end[k] = data->num_walks;
+    }
+    pilot->round = round;
+
+    nthreads = mc_pool_create(pool, nthreads);
+    telemetry->threads = nthreads;
+    mc_pool_run(pool, round->num_tasks, run_pilot_task, pilot);
+    mc_pool_destroy(pool);
+    free(pool);
+
+    int retval = 0;
     FILE *fp = fopen(filename, "w");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot create output file %s\n", filename);
+        retval = -1;
+    } else {
+        fprintf(fp, "pilot %d walks %ld threads %d\n", pilot_components, data->num_walks,
+                nthreads);
+    }
+
+    for (int k = 0; k < pilot_components; k++) {
+        const mc_stats_t *stats = &round->task_stats[k];
+        const mc_walks_t *walks = &round->task_walks[k];
+        long long runs = 0;
+        for (int bin = 0; bin < MC_TELEMETRY_BINS; bin++) {
+            runs += walks->length_hist[bin];
+        }
+        double length = runs > 0 ? 1.0 + (double)walks->transitions / runs : 0.0;
+        double error = mc_stats_std_error(stats);
+
+        report_component(data, round->task_component[k], stats);
+        if (fp) {
+            fprintf(fp, "%d %.15e %.15e %.15e %.6f %.6f\n",
+                    data->start_idx + round->task_component[k],
+                    component_value(data, round->task_component[k], stats), error,
+                    error * error * (double)stats->count, length, pilot->task_seconds[k]);
+        }
+        mc_walks_merge(&telemetry->walks, walks);
+        telemetry->samples += stats->count * (data->antithetic ? 2 : 1);
+    }
+
+    if (fp && fclose(fp) != 0) {
+        fprintf(stderr, "Error: Cannot write output file %s\n", filename);
+        retval = -1;
+    }
+    free(round);
+    free(pilot);
+    return retval;
+}
+
+// Open the output file, through the BOINC file layer in BOINC builds
+static FILE *open_output(const char *filename, const char *mode) {
+#ifdef _BOINC_
+    return boinc_fopen(filename, mode);
+#else
+    return fopen(filename, mode);
+#endif
+}
+
+// Write results to output file: the text format, or with 'binary' the
+// mc_result.h record with the sample count of every component
+int write_output(const char *filename, MonteCarloData *data, double *x_partial,
+                 double *std_error, int64_t *samples, int binary) {
+    int num_components = data->end_idx - data->start_idx + 1;
+
+    if (binary) {
+        mc_result_axb_t *entries = malloc(num_components * sizeof(mc_result_axb_t));
+        mc_result_header_t header;
+        if (!entries) {
+            fprintf(stderr, "Error: Cannot allocate the output record\n");
+            return -1;
+        }
+
+        memset(&header, 0, sizeof(header));
+        header.start_idx = data->start_idx;
+        header.end_idx = data->end_idx;
+        header.num_walks = data->num_walks;
+        header.seed = data->seed;
+        for (int i = 0; i < num_components; i++) {
+            entries[i].value = x_partial[i];
+            entries[i].std_error = std_error[i];
+            entries[i].samples = samples[i];
+        }
+
+        FILE *fp = open_output(filename, "wb");
+        if (!fp) {
+            fprintf(stderr, "Error: Cannot create output file %s\n", filename);
+            free(entries);
+            return -1;
+        }
+        int retval = mc_result_write(fp, MC_RESULT_APP_AXB, &header, entries,
+                                     sizeof(mc_result_axb_t), num_components);
+        if (fclose(fp) != 0) retval = -1;
+        free(entries);
+        if (retval < 0) {
+            fprintf(stderr, "Error: Cannot write output file %s\n", filename);
+        }
+        return retval;
+    }
+
+    FILE *fp = open_output(filename, "w");
     if (!fp) {
         fprintf(stderr, "Error: Cannot create output file %s\n", filename);
         return -1;
@@ -234,10 +1706,9 @@ int write_output(const char *filename, MonteCarloData *data, double *x_partial)
     // Write which components were computed
     fprintf(fp, "%d %d\n", data->start_idx, data->end_idx);
 
-    // Write the computed values
-    int num_components = data->end_idx - data->start_idx + 1;
+    // Write the computed values and their standard errors
     for (int i = 0; i < num_components; i++) {
-        fprintf(fp, "%.15e\n", x_partial[i]);
+        fprintf(fp, "%.15e %.15e\n", x_partial[i], std_error[i]);
     }
 
     fclose(fp);
@@ -254,17 +1725,30 @@ void verify_solution(MonteCarloData *data, double *x) {
 
     double max_error = 0.0;
     double norm_b = 0.0;
+    double *Ax = malloc(data->n * sizeof(double));
 
-    for (int i = 0; i < data->n; i++) {
-        double Ax_i = 0.0;
-        for (int j = 0; j < data->n; j++) {
-            Ax_i += data->A[i][j] * x[j];
+    if (!Ax) {
+        return;
+    }
+
+    if (data->A.row_ptr) {
+        mc_csr_multiply(&data->A, x, Ax);
+    } else {
+        // Jacobi: A = (D / omega)(I - C), so (Ax)_i = diag_i * (x_i - (Cx)_i)
+        mc_csr_multiply(&data->C, x, Ax);
+        for (int i = 0; i < data->n; i++) {
+            Ax[i] = data->diag[i] * (x[i] - Ax[i]);
         }
-        double error = fabs(Ax_i - data->b[i]);
+    }
+
+    for (int i = 0; i < data->n; i++) {
+        double error = fabs(Ax[i] - data->b[i]);
         if (error > max_error) max_error = error;
         norm_b += data->b[i] * data->b[i];
     }
 
+    free(Ax);
+
     norm_b = sqrt(norm_b);
     printf("Max absolute error: %.10e\n", max_error);
     printf("Relative error: %.10e\n", max_error / norm_b);
@@ -272,37 +1756,96 @@ void verify_solution(MonteCarloData *data, double *x) {
 
 int main(int argc, char **argv) {
     MonteCarloData data;
-    double x_partial[MAX_DIM];
+    double *x_partial, *std_error;
+    int64_t *samples;
     const char *input_file = "input.txt";
+    const char *params_file = NULL;
+    const char *precond_file = NULL;
     const char *output_file = "output.txt";
+    char checkpoint_file[512];
+    mc_telemetry_t telemetry;
+    double phase_start;
+
+    int nthreads = get_num_threads(argc, argv);
+    mc_telemetry_init(&telemetry, nthreads);
 
 #ifdef _BOINC_
-    int retval = boinc_init();
+    // The walks run on several threads, so BOINC must suspend and resume
+    // the whole process rather than only the main thread
+    BOINC_OPTIONS options;
+    memset(&options, 0, sizeof(options));
+    options.main_program = 1;
+    options.check_heartbeat = 1;
+    options.handle_process_control = 1;
+    options.send_status_msgs = 1;
+    options.direct_process_action = 1;
+    options.multi_thread = 1;
+
+    int retval = boinc_init_options(&options);
     if (retval) {
         fprintf(stderr, "BOINC initialization failed: %d\n", retval);
         exit(retval);
     }
 
-    // Get input/output file paths from BOINC
-    char resolved_input[512], resolved_output[512];
-    boinc_resolve_filename_s("input.txt", resolved_input, sizeof(resolved_input));
-    boinc_resolve_filename_s("output.txt", resolved_output, sizeof(resolved_output));
+    // Get input/output file paths from BOINC. Work units made from a
+    // shared matrix (templates/axb_in.xml) have "matrix" and "params";
+    // self-contained ones have a single "input.txt".
+    char resolved_input[512], resolved_params[512], resolved_output[512];
+    char resolved_precond[512];
+    boinc_resolve_filename("params", resolved_params, sizeof(resolved_params));
+    if (boinc_file_exists(resolved_params)) {
+        boinc_resolve_filename("matrix", resolved_input, sizeof(resolved_input));
+        params_file = resolved_params;
+    } else {
+        boinc_resolve_filename("input.txt", resolved_input, sizeof(resolved_input));
+    }
+    // Work units with split=approx also ship the approximate inverse
+    // (templates/axb_precond_in.xml)
+    boinc_resolve_filename("precond", resolved_precond, sizeof(resolved_precond));
+    if (boinc_file_exists(resolved_precond)) {
+        precond_file = resolved_precond;
+    }
+    boinc_resolve_filename("output.txt", resolved_output, sizeof(resolved_output));
     input_file = resolved_input;
     output_file = resolved_output;
+    boinc_resolve_filename("checkpoint.bin", checkpoint_file, sizeof(checkpoint_file));
 #else
-    // Command line arguments for standalone testing
-    if (argc > 1) input_file = argv[1];
-    if (argc > 2) output_file = argv[2];
+    // Command line arguments for standalone testing:
+    // [--nthreads N] [--device N] [--binary_output] input [output [params [precond]]],
+    // where input may be a shared matrix file
+    int num_args = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--nthreads") == 0 || strcmp(argv[i], "--device") == 0) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--binary_output") == 0) {
+            continue;
+        }
+        switch (num_args++) {
+        case 0: input_file = argv[i]; break;
+        case 1: output_file = argv[i]; break;
+        case 2: params_file = argv[i]; break;
+        case 3: precond_file = argv[i]; break;
+        }
+    }
+
+    // Keep the checkpoint next to the output so work units run in the
+    // same directory do not pick up each other's progress
+    snprintf(checkpoint_file, sizeof(checkpoint_file), "%s.ckpt", output_file);
 #endif
 
     printf("Ulam-von Neumann Monte Carlo Solver for Ax = b\n");
     printf("==============================================\n\n");
 
-    // Initialize random number generator
-    init_random();
-
     // Read input
+    phase_start = mc_telemetry_now();
     printf("Reading input from %s...\n", input_file);
+    memset(&data, 0, sizeof(data));
+    data.min_walks = AXB_PARAMS_MIN_WALKS;
+    data.absorb_prob = AXB_PARAMS_ABSORB;
+    data.omega = 1.0;
+    data.block_size = AXB_PARAMS_BLOCK;
     if (read_input(input_file, &data) < 0) {
         fprintf(stderr, "Failed to read input\n");
 #ifdef _BOINC_
@@ -311,9 +1854,79 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    if ((params_file && read_params(params_file, &data) < 0) || check_parameters(&data) < 0) {
+        fprintf(stderr, "Failed to read work unit parameters\n");
+#ifdef _BOINC_
+        boinc_finish(1);
+#endif
+        return 1;
+    }
+
+    if (data.split == AXB_SPLIT_APPROX) {
+        if (!precond_file) {
+            fprintf(stderr, "Error: split=approx needs a preconditioner file\n");
+#ifdef _BOINC_
+            boinc_finish(1);
+#endif
+            return 1;
+        }
+        printf("Reading preconditioner from %s...\n", precond_file);
+        if (read_preconditioner(precond_file, &data) < 0) {
+            fprintf(stderr, "Failed to read preconditioner\n");
+#ifdef _BOINC_
+            boinc_finish(1);
+#endif
+            return 1;
+        }
+    } else if (precond_file) {
+        fprintf(stderr, "Warning: Ignoring %s, the work unit does not use split=approx\n",
+                precond_file);
+    }
+    mc_telemetry_phase(&telemetry, MC_PHASE_READ, phase_start);
+
     printf("System dimension: %d x %d\n", data.n, data.n);
     printf("Computing components: %d to %d\n", data.start_idx, data.end_idx);
-    printf("Number of walks per component: %ld\n\n", data.num_walks);
+    printf("Number of walks per component: %ld%s\n", data.num_walks,
+           data.mode == AXB_MODE_SUFFIX ? " (samples, walk suffixes included)" : "");
+    if (data.tol > 0.0) {
+        printf("Target standard error: %g (after at least %ld walks)\n", data.tol, data.min_walks);
+    }
+    if (data.absorb_prob == AXB_ABSORB_ROW) {
+        printf("Absorption probability: 1 - row sum (at least %g)\n", MIN_ABSORB_PROB);
+    } else {
+        printf("Absorption probability: %g\n", data.absorb_prob);
+    }
+    if (data.cv_sweeps > 0) {
+        printf("Control variate: %d Jacobi sweeps\n", data.cv_sweeps);
+    }
+    if (data.antithetic) {
+        printf("Antithetic walk pairs\n");
+    }
+    if (data.split != AXB_SPLIT_JACOBI || data.omega != 1.0) {
+        static const char *split_names[] = {"Jacobi", "block Jacobi", "approximate inverse"};
+        printf("Splitting: %s", split_names[data.split]);
+        if (data.split == AXB_SPLIT_BLOCK) printf(", blocks of %d rows", data.block_size);
+        printf(", omega = %g\n", data.omega);
+    }
+    printf("\n");
+
+    // Seed for the random streams, unless the work unit sets one
+    // (replaced by the saved one when resuming)
+    if (data.seed == 0) {
+        data.seed = make_seed();
+    }
+
+    phase_start = mc_telemetry_now();
+    x_partial = alloc_aligned((data.end_idx - data.start_idx + 1) * sizeof(double));
+    std_error = alloc_aligned((data.end_idx - data.start_idx + 1) * sizeof(double));
+    samples = alloc_aligned((data.end_idx - data.start_idx + 1) * sizeof(int64_t));
+    if (!x_partial || !std_error || !samples) {
+        fprintf(stderr, "Failed to allocate the solution vector\n");
+#ifdef _BOINC_
+        boinc_finish(1);
+#endif
+        return 1;
+    }
 
     // Prepare iteration form
     if (prepare_iteration_form(&data) < 0) {
@@ -323,18 +1936,77 @@ int main(int argc, char **argv) {
 #endif
         return 1;
     }
+    mc_telemetry_phase(&telemetry, MC_PHASE_SETUP, phase_start);
+
+    // A pilot run writes its cost report and stops
+    if (data.pilot) {
+        phase_start = mc_telemetry_now();
+        int pilot_status = run_pilot(&data, output_file, nthreads, &telemetry);
+        mc_telemetry_phase(&telemetry, MC_PHASE_COMPUTE, phase_start);
+
+        free(x_partial);
+        free(std_error);
+        free(samples);
+        free_data(&data);
+        if (pilot_status < 0) {
+            fprintf(stderr, "Pilot run failed\n");
+#ifdef _BOINC_
+            boinc_finish(1);
+#endif
+            return 1;
+        }
+
+        printf("Done!\n");
+        fflush(stdout);
+        mc_telemetry_write(stderr, &telemetry, "axb_montecarlo");
+#ifdef _BOINC_
+        boinc_finish(0);
+#endif
+        return 0;
+    }
+
+    // GPU app versions run the component-mode walks on the device; the
+    // results are those of the CPU, so a checkpoint resumes on either
+    WalkDevice *device = NULL;
+#ifdef MC_OPENCL
+    WalkDevice walk_device;
+    if (data.mode == AXB_MODE_COMPONENT) {
+        if (open_walk_device(&walk_device, &data, argc, argv) == 0) {
+            device = &walk_device;
+        } else {
+            fprintf(stderr, "Warning: No usable OpenCL device, running the walks on the CPU\n");
+        }
+    }
+#endif
 
     // Compute solution
-    compute_solution(&data, x_partial);
+    phase_start = mc_telemetry_now();
+    int compute_status = compute_solution(&data, x_partial, std_error, samples, checkpoint_file,
+                                          nthreads, device, &telemetry);
+#ifdef MC_OPENCL
+    if (device) close_walk_device(device);
+#endif
+    if (compute_status < 0) {
+        fprintf(stderr, "Failed to compute solution\n");
+#ifdef _BOINC_
+        boinc_finish(1);
+#endif
+        return 1;
+    }
+    mc_telemetry_phase(&telemetry, MC_PHASE_COMPUTE, phase_start);
 
     // Verify if complete solution
+    phase_start = mc_telemetry_now();
     if (data.start_idx == 0 && data.end_idx == data.n - 1) {
         verify_solution(&data, x_partial);
     }
+    mc_telemetry_phase(&telemetry, MC_PHASE_VERIFY, phase_start);
 
     // Write output
+    phase_start = mc_telemetry_now();
     printf("\nWriting output to %s...\n", output_file);
-    if (write_output(output_file, &data, x_partial) < 0) {
+    if (write_output(output_file, &data, x_partial, std_error, samples,
+                     has_flag(argc, argv, "--binary_output")) < 0) {
         fprintf(stderr, "Failed to write output\n");
 #ifdef _BOINC_
         boinc_finish(1);
@@ -342,8 +2014,22 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    mc_telemetry_phase(&telemetry, MC_PHASE_OUTPUT, phase_start);
+
+    // The result is safely written, the checkpoint is no longer needed
+    unlink(checkpoint_file);
+
+    free(x_partial);
+    free(std_error);
+    free(samples);
+    free_data(&data);
+
     printf("Done!\n");
 
+    // Performance counters for the server, see mc_telemetry.h
+    fflush(stdout);
+    mc_telemetry_write(stderr, &telemetry, "axb_montecarlo");
+
 #ifdef _BOINC_
     boinc_finish(0);
 #endif
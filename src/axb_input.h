@@ -0,0 +1,121 @@
+/*
+ * axb_input.h
+ *
+ * Binary work unit input format for the Ax=b Monte Carlo solver
+ *
+ * The text formats store every value as "%.15e", which makes a 1000x1000
+ * input about 22 MB and takes seconds to parse. The binary format holds the
+ * same data as raw little-endian arrays, so the client can mmap the file
+ * and use the matrix in place:
+ *
+ *   axb_input_header_t      64 bytes
+ *   int64_t  row_ptr[n+1]   CSR row offsets of A
+ *   int32_t  col[nnz]       column of each entry (ascending within a row),
+ *                           zero-padded to a multiple of 8 bytes
+ *   double   val[nnz]       value of each entry
+ *   double   b[n]           right-hand side
+ *
+ * Shared by the client (Axb-MonteCarlo.c), the validator and, through
+ * the same layout, tools/generate_axb_work.py.
+ *
+ * Licensed under GPL v3
+ */
+
+#ifndef AXB_INPUT_H
+#define AXB_INPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define AXB_INPUT_MAGIC   0x49425841u       // "AXBI" in file byte order
+#define AXB_INPUT_VERSION 1
+
+typedef struct {
+    uint32_t magic;             // AXB_INPUT_MAGIC
+    uint32_t version;           // AXB_INPUT_VERSION
+    int64_t n;                  // Matrix dimension
+    int64_t nnz;                // Stored entries of A
+    int64_t start_idx;          // First component to compute
+    int64_t end_idx;            // Last component to compute (inclusive)
+    int64_t num_walks;          // Random walks per component
+    uint64_t seed;              // Seed of the walk streams, 0 = chosen by the client
+    uint64_t reserved;          // Zero
+} axb_input_header_t;
+
+// Arrays of a binary input, pointing into the file image
+typedef struct {
+    const axb_input_header_t *header;
+    const int64_t *row_ptr;
+    const int32_t *col;
+    const double *val;
+    const double *b;
+} axb_input_view_t;
+
+// Byte offsets of the arrays of an input with the given n and nnz
+static inline void axb_input_layout(int64_t n, int64_t nnz, size_t *col_offset,
+                                    size_t *val_offset, size_t *b_offset, size_t *total) {
+    size_t row_ptr_offset = sizeof(axb_input_header_t);
+    *col_offset = row_ptr_offset + (size_t)(n + 1) * sizeof(int64_t);
+    *val_offset = *col_offset + ((size_t)nnz * sizeof(int32_t) + 7) / 8 * 8;
+    *b_offset = *val_offset + (size_t)nnz * sizeof(double);
+    *total = *b_offset + (size_t)n * sizeof(double);
+}
+
+// Does the buffer start like a binary input? (Text inputs start with a digit
+// or "sparse", so the first four bytes tell the formats apart.)
+static inline int axb_input_is_binary(const void *data, size_t size) {
+    uint32_t magic;
+    if (size < sizeof(magic)) return 0;
+    memcpy(&magic, data, sizeof(magic));
+    return magic == AXB_INPUT_MAGIC;
+}
+
+// Validate a binary input image of 'size' bytes at 'base' (8-byte aligned,
+// e.g. an mmap) and fill 'view'. Checks the header, the file size and the
+// CSR structure, so a damaged download cannot make the walks index out of
+// bounds. Returns NULL on success or a description of the problem.
+static inline const char *axb_input_open(const void *base, size_t size, axb_input_view_t *view) {
+    const axb_input_header_t *h = (const axb_input_header_t *)base;
+    const char *bytes = (const char *)base;
+    size_t col_offset, val_offset, b_offset, total;
+    uint32_t big_endian_magic = ((AXB_INPUT_MAGIC & 0xFFu) << 24) | ((AXB_INPUT_MAGIC & 0xFF00u) << 8) |
+                                ((AXB_INPUT_MAGIC >> 8) & 0xFF00u) | (AXB_INPUT_MAGIC >> 24);
+
+    if (size < sizeof(axb_input_header_t)) return "file is shorter than the header";
+    if (h->magic == big_endian_magic) return "byte order of this host is not supported";
+    if (h->magic != AXB_INPUT_MAGIC) return "bad magic number";
+    if (h->version != AXB_INPUT_VERSION) return "unsupported format version";
+    if (h->n <= 0 || h->n > INT32_MAX || h->nnz < 0) return "invalid dimension";
+    if (h->start_idx < 0 || h->end_idx >= h->n || h->start_idx > h->end_idx ||
+        h->num_walks < 1) {
+        return "invalid work unit parameters";
+    }
+
+    axb_input_layout(h->n, h->nnz, &col_offset, &val_offset, &b_offset, &total);
+    if (size != total) return "file size does not match the header";
+
+    view->header = h;
+    view->row_ptr = (const int64_t *)(bytes + sizeof(axb_input_header_t));
+    view->col = (const int32_t *)(bytes + col_offset);
+    view->val = (const double *)(bytes + val_offset);
+    view->b = (const double *)(bytes + b_offset);
+
+    if (view->row_ptr[0] != 0 || view->row_ptr[h->n] != h->nnz) return "invalid row offsets";
+    for (int64_t i = 0; i < h->n; i++) {
+        // Row i must lie within col[] before any of its entries is read
+        if (view->row_ptr[i + 1] < view->row_ptr[i] || view->row_ptr[i + 1] > h->nnz) {
+            return "invalid row offsets";
+        }
+        for (int64_t k = view->row_ptr[i]; k < view->row_ptr[i + 1]; k++) {
+            if (view->col[k] < 0 || view->col[k] >= h->n ||
+                (k > view->row_ptr[i] && view->col[k] <= view->col[k - 1])) {
+                return "invalid column index";
+            }
+        }
+    }
+
+    return NULL;
+}
+
+#endif
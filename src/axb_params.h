@@ -0,0 +1,229 @@
+/*
+ * axb_params.h
+ *
+ * Per-work-unit parameters of the Ax=b Monte Carlo solver
+ *
+ * All work units of a job share one (sticky) matrix file; what differs
+ * between them is a one-line parameter file:
+ *
+ *   start_idx end_idx num_walks [key=value ...]
+ *
+ * Known keys:
+ *   seed=N      seed of the walk streams (default: chosen by the client)
+ *   tol=E       stop a component once the standard error of its estimate
+ *               is at most E; num_walks is then only an upper bound
+ *               (default: 0, always run num_walks walks)
+ *   min_walks=N walks to run before the tolerance is checked (default: 1024)
+ *   mode=M      estimator: "component" (default) starts num_walks walks at
+ *               every component; "suffix" starts walks at all components
+ *               in turn and lets every walk contribute to each component
+ *               of the range it visits (num_walks = samples per component)
+ *   absorb=P    probability that a walk stops at each step (default: 0.1),
+ *               or "absorb=row" to stop at state i with 1 - row_sum_i, which
+ *               keeps the walk weights at +-1
+ *   cv=M        control variate: M sweeps of x <- Cx + f give an
+ *               approximation y of x, the walks only estimate the
+ *               remainder x - y (default: 0)
+ *   antithetic=1  pair every walk with a twin using the reflected random
+ *               numbers and use the mean of the two (component mode only)
+ *   split=S     splitting A = M - N that defines C = I - omega M^{-1} A:
+ *               "jacobi" (default, M = diagonal of A), "block" (M = the
+ *               diagonal blocks of A) or "approx" (M^{-1} = an approximate
+ *               inverse shipped with the work unit as file "precond")
+ *   omega=W     relaxation factor in (0, 2) (default: 1)
+ *   block=K     block size of split=block (default: 8)
+ *   pilot=K     pilot run: num_walks walks at each of K components spread
+ *               evenly over the range, ignoring tol; the output reports
+ *               their variance, walk length and time instead of a
+ *               solution (mode=component only, see
+ *               tools/generate_axb_work.py --pilot-app)
+ *
+ * Unknown keys are an error, so a work unit never silently runs with
+ * settings it did not ask for. Shared by the client and the validator.
+ *
+ * Licensed under GPL v3
+ */
+
+#ifndef AXB_PARAMS_H
+#define AXB_PARAMS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define AXB_PARAMS_MAX_SIZE 4096    // Parameter files are tiny
+#define AXB_PARAMS_MIN_WALKS 1024   // Default for min_walks
+
+#define AXB_MODE_COMPONENT 0        // One estimate per walk, of its start
+#define AXB_MODE_SUFFIX 1           // One estimate per visited component
+
+#define AXB_PARAMS_ABSORB 0.1       // Default absorption probability
+#define AXB_ABSORB_ROW -1.0         // absorb=row: per-row probability
+#define AXB_PARAMS_MAX_CV 1000      // Upper bound on cv=M
+
+#define AXB_SPLIT_JACOBI 0
+#define AXB_SPLIT_BLOCK 1
+#define AXB_SPLIT_APPROX 2
+#define AXB_PARAMS_BLOCK 8          // Default block size
+#define AXB_PARAMS_MAX_BLOCK 1024
+#define AXB_PARAMS_MAX_PILOT 4096   // Upper bound on pilot=K
+
+typedef struct {
+    long start_idx;             // First component to compute
+    long end_idx;               // Last component to compute (inclusive)
+    long num_walks;             // Random walks per component
+    uint64_t seed;              // 0 = not set
+    double tol;                 // Target standard error, 0 = none
+    long min_walks;             // Walks before the tolerance is checked
+    int mode;                   // AXB_MODE_*
+    double absorb;              // Absorption probability or AXB_ABSORB_ROW
+    int cv_sweeps;              // Jacobi sweeps of the control variate, 0 = none
+    int antithetic;             // Antithetic walk pairs
+    int split;                  // AXB_SPLIT_*
+    double omega;               // Relaxation factor
+    int block_size;             // Block size of AXB_SPLIT_BLOCK
+    int pilot;                  // Components of a pilot run, 0 = normal run
+} axb_params_t;
+
+// Fill in the defaults of everything but the three positional values
+static inline void axb_params_defaults(axb_params_t *params) {
+    params->seed = 0;
+    params->tol = 0.0;
+    params->min_walks = AXB_PARAMS_MIN_WALKS;
+    params->mode = AXB_MODE_COMPONENT;
+    params->absorb = AXB_PARAMS_ABSORB;
+    params->cv_sweeps = 0;
+    params->antithetic = 0;
+    params->split = AXB_SPLIT_JACOBI;
+    params->omega = 1.0;
+    params->block_size = AXB_PARAMS_BLOCK;
+    params->pilot = 0;
+}
+
+// Parse one "key=value" token into 'params'. Returns 0 or -1 if unknown.
+static inline int axb_params_set(axb_params_t *params, const char *token) {
+    char *end;
+
+    if (strncmp(token, "seed=", 5) == 0) {
+        params->seed = strtoull(token + 5, &end, 0);
+        return (*end == '\0' && end != token + 5) ? 0 : -1;
+    }
+    if (strncmp(token, "tol=", 4) == 0) {
+        params->tol = strtod(token + 4, &end);
+        return (*end == '\0' && end != token + 4 && params->tol >= 0.0) ? 0 : -1;
+    }
+    if (strncmp(token, "min_walks=", 10) == 0) {
+        params->min_walks = strtol(token + 10, &end, 10);
+        return (*end == '\0' && end != token + 10 && params->min_walks >= 1) ? 0 : -1;
+    }
+    if (strcmp(token, "mode=component") == 0) {
+        params->mode = AXB_MODE_COMPONENT;
+        return 0;
+    }
+    if (strcmp(token, "mode=suffix") == 0) {
+        params->mode = AXB_MODE_SUFFIX;
+        return 0;
+    }
+    if (strcmp(token, "absorb=row") == 0) {
+        params->absorb = AXB_ABSORB_ROW;
+        return 0;
+    }
+    if (strncmp(token, "absorb=", 7) == 0) {
+        params->absorb = strtod(token + 7, &end);
+        return (*end == '\0' && end != token + 7 && params->absorb > 0.0 &&
+                params->absorb < 1.0) ? 0 : -1;
+    }
+    if (strncmp(token, "cv=", 3) == 0) {
+        long sweeps = strtol(token + 3, &end, 10);
+        params->cv_sweeps = (int)sweeps;
+        return (*end == '\0' && end != token + 3 && sweeps >= 0 &&
+                sweeps <= AXB_PARAMS_MAX_CV) ? 0 : -1;
+    }
+    if (strcmp(token, "split=jacobi") == 0) {
+        params->split = AXB_SPLIT_JACOBI;
+        return 0;
+    }
+    if (strcmp(token, "split=block") == 0) {
+        params->split = AXB_SPLIT_BLOCK;
+        return 0;
+    }
+    if (strcmp(token, "split=approx") == 0) {
+        params->split = AXB_SPLIT_APPROX;
+        return 0;
+    }
+    if (strncmp(token, "omega=", 6) == 0) {
+        params->omega = strtod(token + 6, &end);
+        return (*end == '\0' && end != token + 6 && params->omega > 0.0 &&
+                params->omega < 2.0) ? 0 : -1;
+    }
+    if (strncmp(token, "block=", 6) == 0) {
+        long size = strtol(token + 6, &end, 10);
+        params->block_size = (int)size;
+        return (*end == '\0' && end != token + 6 && size >= 1 &&
+                size <= AXB_PARAMS_MAX_BLOCK) ? 0 : -1;
+    }
+    if (strncmp(token, "pilot=", 6) == 0) {
+        long components = strtol(token + 6, &end, 10);
+        params->pilot = (int)components;
+        return (*end == '\0' && end != token + 6 && components >= 1 &&
+                components <= AXB_PARAMS_MAX_PILOT) ? 0 : -1;
+    }
+    if (strcmp(token, "antithetic=0") == 0 || strcmp(token, "antithetic=1") == 0) {
+        params->antithetic = token[11] == '1';
+        return 0;
+    }
+    return -1;
+}
+
+// Parse parameter text. On error returns -1 and describes the problem in
+// 'error' (error_size bytes).
+static inline int axb_params_parse(const char *text, axb_params_t *params,
+                                   char *error, size_t error_size) {
+    char token[256];
+    int used;
+
+    memset(params, 0, sizeof(*params));
+    axb_params_defaults(params);
+
+    if (sscanf(text, "%ld %ld %ld%n", &params->start_idx, &params->end_idx,
+               &params->num_walks, &used) != 3) {
+        snprintf(error, error_size, "expected \"start_idx end_idx num_walks\"");
+        return -1;
+    }
+    text += used;
+
+    while (sscanf(text, "%255s%n", token, &used) == 1) {
+        if (axb_params_set(params, token) < 0) {
+            snprintf(error, error_size, "invalid parameter \"%.64s\"", token);
+            return -1;
+        }
+        text += used;
+    }
+
+    return 0;
+}
+
+// Read and parse a parameter file
+static inline int axb_params_read(const char *path, axb_params_t *params,
+                                  char *error, size_t error_size) {
+    char text[AXB_PARAMS_MAX_SIZE + 1];
+
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        snprintf(error, error_size, "cannot open %s", path);
+        return -1;
+    }
+    size_t len = fread(text, 1, AXB_PARAMS_MAX_SIZE + 1, fp);
+    fclose(fp);
+
+    if (len > AXB_PARAMS_MAX_SIZE) {
+        snprintf(error, error_size, "%s is too large for a parameter file", path);
+        return -1;
+    }
+    text[len] = '\0';
+
+    return axb_params_parse(text, params, error, error_size);
+}
+
+#endif
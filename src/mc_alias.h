@@ -0,0 +1,103 @@
+/*
+ * mc_alias.h
+ *
+ * Walker alias tables for the Ax=b random walks
+ *
+ * A random walk leaves state i for state j with probability
+ * |C_ij| / sum_k |C_ik|. Scanning the row for every step costs O(n);
+ * an alias table (Walker 1977, built with Vose's method) samples the
+ * same distribution in O(1) from two uniform numbers:
+ *
+ *   slot  = floor(u1 * m)                  m = entries in the row
+ *   pick  = (u2 < slot.prob) ? 0 : 1       own entry or its alias
+ *
+ * Each choice also carries the factor the walk weight is multiplied by
+ * when it is taken (the sign of C_ij times row_sum / (1 - p_stop)), so
+ * the walk loop does not have to look at C at all.
+ *
+ * Header-only so it can be used from both solvers.
+ *
+ * Licensed under GPL v3
+ */
+
+#ifndef MC_ALIAS_H
+#define MC_ALIAS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct {
+    double prob;            // Probability of keeping choice 0
+    int32_t column[2];      // 0: this slot's own entry, 1: its alias
+    double mult[2];         // Weight multiplier of each choice
+} mc_alias_slot_t;
+
+// Build the alias table of one row in slots[0..m-1].
+// weight[k] >= 0 is the (unnormalized) probability of entry k, which
+// leads to column[k] and multiplies the walk weight by mult[k].
+// Returns 0 on success, -1 if memory is exhausted.
+static inline int mc_alias_build(mc_alias_slot_t *slots, int m, const double *weight,
+                                 const int32_t *column, const double *mult) {
+    double total = 0.0;
+    int *small, *large;
+    int num_small = 0, num_large = 0;
+
+    if (m <= 0) return 0;
+
+    for (int k = 0; k < m; k++) {
+        total += weight[k];
+    }
+
+    small = (int *)malloc(2 * (size_t)m * sizeof(int));
+    if (!small) return -1;
+    large = small + m;
+
+    // Scale so the average slot holds probability 1
+    for (int k = 0; k < m; k++) {
+        slots[k].prob = (total > 0.0) ? weight[k] * m / total : 1.0;
+        slots[k].column[0] = slots[k].column[1] = column[k];
+        slots[k].mult[0] = slots[k].mult[1] = mult[k];
+
+        if (slots[k].prob < 1.0) {
+            small[num_small++] = k;
+        } else {
+            large[num_large++] = k;
+        }
+    }
+
+    // Fill each under-full slot with probability taken from an over-full one
+    while (num_small > 0 && num_large > 0) {
+        int s = small[--num_small];
+        int l = large[num_large - 1];
+
+        slots[s].column[1] = column[l];
+        slots[s].mult[1] = mult[l];
+        slots[l].prob -= 1.0 - slots[s].prob;
+
+        if (slots[l].prob < 1.0) {
+            num_large--;
+            small[num_small++] = l;
+        }
+    }
+
+    // Whatever is left is 1 up to rounding error
+    while (num_large > 0) slots[large[--num_large]].prob = 1.0;
+    while (num_small > 0) slots[small[--num_small]].prob = 1.0;
+
+    free(small);
+    return 0;
+}
+
+// Draw one entry from a row table of m > 0 slots using u1, u2 in [0, 1).
+// Returns the column and stores the weight multiplier in *mult.
+static inline int mc_alias_sample(const mc_alias_slot_t *slots, int m, double u1, double u2,
+                                  double *mult) {
+    int k = (int)(u1 * m);
+    if (k >= m) k = m - 1;      // Guard against rounding when u1 is close to 1
+
+    int pick = (u2 < slots[k].prob) ? 0 : 1;
+    *mult = slots[k].mult[pick];
+    return slots[k].column[pick];
+}
+
+#endif
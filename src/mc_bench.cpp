@@ -0,0 +1,912 @@
+/*
+ * Benchmark driver for the Monte Carlo kernels
+ *
+ * Times the kernels both apps spend their time in, on generated inputs,
+ * and writes one record per case as JSON and/or CSV:
+ *
+ *   pi        PI sampling kernels of pi_compute (pi_kernels.cpp), per
+ *             kernel (scalar, avx2, avx512, neon) and thread count
+ *   rng       Philox generator (mc_rng.h): raw blocks and doubles
+ *   walk      random walks of Axb-MonteCarlo.c (mc_walk.h) on random
+ *             sparse systems, per dimension, nonzeros per row, row sum of
+ *             |C|, absorption, plain or antithetic walks and thread count
+ *   converge  error of a few components against the exact solution after
+ *             each doubling of the walks, as a function of time
+ *
+ * The systems are x = Cx + f with f = (I - C) * 1, so every component of
+ * the solution is 1 and the error of an estimate is known without a
+ * direct solve. Each case runs in a child process, so the peak RSS
+ * reported for it is that of the case alone. Times are wall clock; setup
+ * (building the system and its tables) is reported separately.
+ *
+ * Usage:
+ *   mc_bench [--suites pi,rng,walk,converge] [--threads 1,4] [--dims 1000,100000]
+ *            [--nnz 4,32] [--rho 0.9] [--absorb 0.1,row] [--walks 1000000]
+ *            [--variants plain,antithetic] [--kernels all] [--pi-samples N]
+ *            [--rng-samples N] [--components K] [--converge-walks N]
+ *            [--seed S] [--json FILE] [--csv FILE]
+ *
+ * List options take comma-separated values and every combination is run.
+ * "make bench" runs the default sweep and writes bench.json and bench.csv.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "mc_rng.h"
+#include "mc_csr.h"
+#include "mc_alias.h"
+#include "mc_pool.h"
+#include "mc_stats.h"
+#include "mc_walk.h"
+#include "pi_kernels.h"
+
+#define PI_SAMPLES_PER_TASK (1LL << 20)
+#define RNG_SAMPLES_PER_TASK (1LL << 20)
+#define WALKS_PER_TASK 1024             // As in Axb-MonteCarlo.c
+#define MIN_ABSORB_PROB 0.01            // As in Axb-MonteCarlo.c
+#define CONVERGE_FIRST_WALKS 256        // Walks per component of the first point
+#define ABSORB_ROW -1.0                 // --absorb row: 1 - row sum per row
+
+// One benchmark record. Fields that do not apply to a suite are NAN and
+// come out as null (JSON) or empty (CSV).
+struct BENCH_RESULT {
+    char suite[16];
+    char variant[16];               // Kernel, generator or walk variant
+    char absorb[16];
+    double n;                       // Dimension
+    double nnz_per_row;
+    double rho;                     // Row sum of |C|
+    double threads;
+    double walks;                   // Walks or pairs (per component for converge)
+    double samples;                 // Points, random numbers or walks (two per pair)
+    double seconds;
+    double setup_seconds;
+    double samples_per_sec;
+    double ns_per_sample;
+    double steps;                   // States visited by all walks
+    double steps_per_sec;
+    double ns_per_step;
+    double mean_walk_length;
+    double error;                   // |estimate - exact|
+    double std_error;
+    double peak_rss_kb;
+};
+
+// Output columns, in order
+struct FIELD {
+    const char* name;
+    double BENCH_RESULT::*value;
+};
+
+static const FIELD fields[] = {
+    { "n", &BENCH_RESULT::n },
+    { "nnz_per_row", &BENCH_RESULT::nnz_per_row },
+    { "rho", &BENCH_RESULT::rho },
+    { "threads", &BENCH_RESULT::threads },
+    { "walks", &BENCH_RESULT::walks },
+    { "samples", &BENCH_RESULT::samples },
+    { "seconds", &BENCH_RESULT::seconds },
+    { "setup_seconds", &BENCH_RESULT::setup_seconds },
+    { "samples_per_sec", &BENCH_RESULT::samples_per_sec },
+    { "ns_per_sample", &BENCH_RESULT::ns_per_sample },
+    { "steps", &BENCH_RESULT::steps },
+    { "steps_per_sec", &BENCH_RESULT::steps_per_sec },
+    { "ns_per_step", &BENCH_RESULT::ns_per_step },
+    { "mean_walk_length", &BENCH_RESULT::mean_walk_length },
+    { "error", &BENCH_RESULT::error },
+    { "std_error", &BENCH_RESULT::std_error },
+    { "peak_rss_kb", &BENCH_RESULT::peak_rss_kb },
+};
+
+#define NUM_FIELDS (sizeof(fields) / sizeof(fields[0]))
+
+struct BENCH_CONFIG {
+    std::vector<std::string> suites;
+    std::vector<long> threads;
+    std::vector<long> dims;
+    std::vector<long> nnz;
+    std::vector<double> rho;
+    std::vector<double> absorb;     // ABSORB_ROW for "row"
+    std::vector<long> walks;
+    std::vector<std::string> variants;
+    std::vector<std::string> kernels;
+    long long pi_samples;
+    long long rng_samples;
+    long components;
+    long converge_walks;
+    uint64_t seed;
+    const char* json_file;
+    const char* csv_file;
+};
+
+// Wall clock time in seconds
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static BENCH_RESULT new_result(const char* suite, const char* variant) {
+    BENCH_RESULT r;
+    memset(&r, 0, sizeof(r));
+    snprintf(r.suite, sizeof(r.suite), "%s", suite);
+    snprintf(r.variant, sizeof(r.variant), "%s", variant);
+    for (size_t i = 0; i < NUM_FIELDS; i++) {
+        r.*fields[i].value = NAN;
+    }
+    return r;
+}
+
+// Fill the rates from samples, steps and seconds
+static void set_rates(BENCH_RESULT& r) {
+    if (r.seconds > 0) {
+        r.samples_per_sec = r.samples / r.seconds;
+        r.ns_per_sample = r.seconds * 1e9 / r.samples;
+        if (!std::isnan(r.steps)) {
+            r.steps_per_sec = r.steps / r.seconds;
+            r.ns_per_step = r.seconds * 1e9 / r.steps;
+        }
+    }
+    if (!std::isnan(r.steps)) {
+        r.mean_walk_length = r.steps / r.samples;
+    }
+}
+
+static mc_pool_t* start_pool(long nthreads) {
+    mc_pool_t* pool = (mc_pool_t*)malloc(sizeof(mc_pool_t));
+    if (!pool) {
+        fprintf(stderr, "Error: Cannot allocate the thread pool\n");
+        exit(1);
+    }
+    mc_pool_create(pool, (int)nthreads);
+    return pool;
+}
+
+static void stop_pool(mc_pool_t* pool) {
+    mc_pool_destroy(pool);
+    free(pool);
+}
+
+// ---------------------------------------------------------------------
+// pi: points in the quarter circle
+// ---------------------------------------------------------------------
+
+struct PI_JOB {
+    const PI_KERNEL* kernel;
+    uint32_t key[2];
+    long long samples;
+    std::vector<long long> hits;    // Per task
+};
+
+static void pi_task(void* ctx, long task) {
+    PI_JOB* job = (PI_JOB*)ctx;
+    long long begin = task * PI_SAMPLES_PER_TASK;
+    long long end = begin + PI_SAMPLES_PER_TASK;
+    if (end > job->samples) end = job->samples;
+    job->hits[task] = job->kernel->count(job->key, begin, end);
+}
+
+static std::vector<BENCH_RESULT> bench_pi(const BENCH_CONFIG& cfg, const PI_KERNEL* kernel,
+                                          long nthreads) {
+    PI_JOB job;
+    mc_rng_t rng;
+    mc_rng_init(&rng, cfg.seed, 0);
+    job.kernel = kernel;
+    job.key[0] = rng.key[0];
+    job.key[1] = rng.key[1];
+    job.samples = cfg.pi_samples;
+    long ntasks = (long)((job.samples + PI_SAMPLES_PER_TASK - 1) / PI_SAMPLES_PER_TASK);
+    job.hits.assign(ntasks, 0);
+
+    mc_pool_t* pool = start_pool(nthreads);
+    double start = now();
+    mc_pool_run(pool, ntasks, pi_task, &job);
+    double seconds = now() - start;
+
+    BENCH_RESULT r = new_result("pi", kernel->name);
+    long long hits = 0;
+    for (long t = 0; t < ntasks; t++) hits += job.hits[t];
+    double p = (double)hits / (double)job.samples;
+
+    r.threads = pool->nthreads;
+    r.samples = (double)job.samples;
+    r.seconds = seconds;
+    r.error = fabs(4.0 * p - M_PI);
+    r.std_error = 4.0 * sqrt(p * (1.0 - p) / (double)job.samples);
+    set_rates(r);
+    stop_pool(pool);
+    return std::vector<BENCH_RESULT>(1, r);
+}
+
+// ---------------------------------------------------------------------
+// rng: Philox throughput
+// ---------------------------------------------------------------------
+
+struct RNG_JOB {
+    bool blocks;                    // Raw blocks instead of doubles
+    uint64_t seed;
+    long long samples;
+    std::vector<double> sums;       // Per task, keeps the work observable
+};
+
+static void rng_task(void* ctx, long task) {
+    RNG_JOB* job = (RNG_JOB*)ctx;
+    long long begin = task * RNG_SAMPLES_PER_TASK;
+    long long end = begin + RNG_SAMPLES_PER_TASK;
+    if (end > job->samples) end = job->samples;
+
+    mc_rng_t rng;
+    mc_rng_init(&rng, job->seed, (uint64_t)task);
+    double sum = 0.0;
+
+    if (job->blocks) {
+        // One sample is one 4x32-bit block, as used by the PI kernels
+        uint32_t out[4];
+        uint32_t acc = 0;
+        for (long long i = begin; i < end; i++) {
+            mc_rng_block(rng.key, rng.stream, (uint64_t)i, out);
+            acc ^= out[0] ^ out[1] ^ out[2] ^ out[3];
+        }
+        sum = acc;
+    } else {
+        for (long long i = begin; i < end; i++) {
+            sum += mc_rng_next_double(&rng);
+        }
+    }
+    job->sums[task] = sum;
+}
+
+static std::vector<BENCH_RESULT> bench_rng(const BENCH_CONFIG& cfg, bool blocks, long nthreads) {
+    RNG_JOB job;
+    job.blocks = blocks;
+    job.seed = cfg.seed;
+    job.samples = cfg.rng_samples;
+    long ntasks = (long)((job.samples + RNG_SAMPLES_PER_TASK - 1) / RNG_SAMPLES_PER_TASK);
+    job.sums.assign(ntasks, 0.0);
+
+    mc_pool_t* pool = start_pool(nthreads);
+    double start = now();
+    mc_pool_run(pool, ntasks, rng_task, &job);
+    double seconds = now() - start;
+
+    BENCH_RESULT r = new_result("rng", blocks ? "philox_block" : "philox_double");
+    r.threads = pool->nthreads;
+    r.samples = (double)job.samples;
+    r.seconds = seconds;
+    if (!blocks) {
+        // Doubles are uniform on [0, 1): their mean should be 1/2
+        double mean = 0.0;
+        for (long t = 0; t < ntasks; t++) mean += job.sums[t];
+        mean /= (double)job.samples;
+        r.error = fabs(mean - 0.5);
+        r.std_error = sqrt(1.0 / 12.0 / (double)job.samples);
+    }
+    set_rates(r);
+    stop_pool(pool);
+    return std::vector<BENCH_RESULT>(1, r);
+}
+
+// ---------------------------------------------------------------------
+// walk and converge: random walks on x = Cx + f
+// ---------------------------------------------------------------------
+
+struct WALK_SYSTEM {
+    mc_csr_t C;
+    std::vector<double> f;
+    std::vector<double> row_sum;
+    std::vector<double> absorb;
+    mc_alias_slot_t* alias;
+    mc_walk_t walk;
+};
+
+// Random C with about nnz_per_row off-diagonal entries per row, random
+// signs and row sums of |C| equal to rho; f = (I - C) * 1
+static int build_system(WALK_SYSTEM& sys, long n, long nnz_per_row, double rho,
+                        double absorb_prob, uint64_t seed) {
+    long m = nnz_per_row < n - 1 ? nnz_per_row : n - 1;
+    int64_t nnz = (int64_t)n * m;
+    std::vector<int32_t> rows(nnz), cols(nnz);
+    std::vector<double> vals(nnz);
+    mc_rng_t rng;
+
+    mc_rng_init(&rng, seed, ~0ULL);
+    for (long i = 0; i < n; i++) {
+        double total = 0.0;
+        for (long k = 0; k < m; k++) {
+            int64_t e = (int64_t)i * m + k;
+            long j = (long)(mc_rng_next_double(&rng) * (n - 1));
+            rows[e] = (int32_t)i;
+            cols[e] = (int32_t)(j >= i ? j + 1 : j);
+            vals[e] = 0.5 + mc_rng_next_double(&rng);
+            total += vals[e];
+        }
+        for (long k = 0; k < m; k++) {
+            int64_t e = (int64_t)i * m + k;
+            vals[e] *= rho / total;
+            if (mc_rng_next_double(&rng) < 0.5) vals[e] = -vals[e];
+        }
+    }
+
+    if (mc_csr_from_coo(&sys.C, (int)n, nnz, rows.data(), cols.data(), vals.data()) < 0) {
+        return -1;
+    }
+
+    sys.f.assign(n, 1.0);
+    sys.row_sum.assign(n, 0.0);
+    sys.absorb.assign(n, absorb_prob);
+    for (long i = 0; i < n; i++) {
+        for (int64_t k = sys.C.row_ptr[i]; k < sys.C.row_ptr[i + 1]; k++) {
+            sys.f[i] -= sys.C.val[k];
+            sys.row_sum[i] += fabs(sys.C.val[k]);
+        }
+        if (absorb_prob == ABSORB_ROW) {
+            double p = 1.0 - sys.row_sum[i];
+            sys.absorb[i] = p > MIN_ABSORB_PROB ? p : MIN_ABSORB_PROB;
+        }
+    }
+
+    sys.alias = (mc_alias_slot_t*)malloc((sys.C.nnz > 0 ? sys.C.nnz : 1) * sizeof(mc_alias_slot_t));
+    if (!sys.alias ||
+        mc_walk_build_tables(&sys.C, sys.row_sum.data(), sys.absorb.data(), sys.alias) < 0) {
+        return -1;
+    }
+
+    sys.walk.row_ptr = sys.C.row_ptr;
+    sys.walk.alias = sys.alias;
+    sys.walk.f = sys.f.data();
+    sys.walk.row_sum = sys.row_sum.data();
+    sys.walk.absorb = sys.absorb.data();
+    return 0;
+}
+
+static void free_system(WALK_SYSTEM& sys) {
+    mc_csr_free(&sys.C);
+    free(sys.alias);
+}
+
+// A range of walks of one component; component < 0: walk w starts at
+// component w mod n
+struct WALK_TASK {
+    long component;
+    long begin;
+    long end;
+    mc_stats_t stats;
+    long long steps;
+};
+
+struct WALK_JOB {
+    const WALK_SYSTEM* sys;
+    uint64_t seed;
+    bool antithetic;
+    std::vector<WALK_TASK> tasks;
+};
+
+static void walk_task(void* ctx, long task) {
+    WALK_JOB* job = (WALK_JOB*)ctx;
+    WALK_TASK& t = job->tasks[task];
+    long n = job->sys->C.n;
+    mc_stats_t stats;
+    long long steps = 0;
+
+    mc_stats_init(&stats);
+    for (long w = t.begin; w < t.end; w++) {
+        long i = t.component >= 0 ? t.component : w % n;
+        long walk = t.component >= 0 ? w : w / n;
+        uint64_t stream = ((uint64_t)i << 32) | (uint32_t)walk;
+        mc_rng_t rng;
+        int length;
+
+        mc_rng_init(&rng, job->seed, stream);
+        double score = mc_walk_run(&job->sys->walk, (int)i, &rng, 0, &length);
+        steps += length;
+
+        if (job->antithetic) {
+            mc_rng_init(&rng, job->seed, stream);
+            score = 0.5 * (score + mc_walk_run(&job->sys->walk, (int)i, &rng, 1, &length));
+            steps += length;
+        }
+        mc_stats_add(&stats, score);
+    }
+
+    t.stats = stats;
+    t.steps = steps;
+}
+
+static void add_task(WALK_JOB& job, long component, long begin, long end) {
+    WALK_TASK t;
+    t.component = component;
+    t.begin = begin;
+    t.end = end;
+    job.tasks.push_back(t);
+}
+
+static void describe_system(BENCH_RESULT& r, const WALK_SYSTEM& sys, long nnz_per_row,
+                            double rho, double absorb_prob) {
+    r.n = sys.C.n;
+    r.nnz_per_row = (double)nnz_per_row;
+    r.rho = rho;
+    if (absorb_prob == ABSORB_ROW) {
+        snprintf(r.absorb, sizeof(r.absorb), "row");
+    } else {
+        snprintf(r.absorb, sizeof(r.absorb), "%g", absorb_prob);
+    }
+}
+
+// Throughput: 'walks' walks spread over all components
+static std::vector<BENCH_RESULT> bench_walk(const BENCH_CONFIG& cfg, long n, long nnz_per_row,
+                                            double rho, double absorb_prob, long walks,
+                                            const std::string& variant, long nthreads) {
+    std::vector<BENCH_RESULT> results;
+    WALK_SYSTEM sys;
+    double setup_start = now();
+    if (build_system(sys, n, nnz_per_row, rho, absorb_prob, cfg.seed) < 0) {
+        fprintf(stderr, "Error: Cannot allocate a system of dimension %ld\n", n);
+        return results;
+    }
+    double setup_seconds = now() - setup_start;
+
+    WALK_JOB job;
+    job.sys = &sys;
+    job.seed = cfg.seed;
+    job.antithetic = variant == "antithetic";
+    for (long w = 0; w < walks; w += WALKS_PER_TASK) {
+        add_task(job, -1, w, w + WALKS_PER_TASK < walks ? w + WALKS_PER_TASK : walks);
+    }
+
+    mc_pool_t* pool = start_pool(nthreads);
+    double start = now();
+    mc_pool_run(pool, (long)job.tasks.size(), walk_task, &job);
+    double seconds = now() - start;
+
+    // Every walk estimates a component of the solution, and all are 1
+    mc_stats_t stats;
+    long long steps = 0;
+    mc_stats_init(&stats);
+    for (size_t t = 0; t < job.tasks.size(); t++) {
+        mc_stats_merge(&stats, &job.tasks[t].stats);
+        steps += job.tasks[t].steps;
+    }
+
+    BENCH_RESULT r = new_result("walk", variant.c_str());
+    describe_system(r, sys, nnz_per_row, rho, absorb_prob);
+    r.threads = pool->nthreads;
+    r.walks = (double)walks;
+    r.samples = (double)walks * (job.antithetic ? 2 : 1);
+    r.seconds = seconds;
+    r.setup_seconds = setup_seconds;
+    r.steps = (double)steps;
+    r.error = fabs(stats.mean - 1.0);
+    r.std_error = mc_stats_std_error(&stats);
+    set_rates(r);
+    results.push_back(r);
+
+    stop_pool(pool);
+    free_system(sys);
+    return results;
+}
+
+// Error against time: the walks per component double from point to point
+static std::vector<BENCH_RESULT> bench_converge(const BENCH_CONFIG& cfg, long n,
+                                                long nnz_per_row, double rho,
+                                                double absorb_prob,
+                                                const std::string& variant, long nthreads) {
+    std::vector<BENCH_RESULT> results;
+    WALK_SYSTEM sys;
+    double setup_start = now();
+    if (build_system(sys, n, nnz_per_row, rho, absorb_prob, cfg.seed) < 0) {
+        fprintf(stderr, "Error: Cannot allocate a system of dimension %ld\n", n);
+        return results;
+    }
+    double setup_seconds = now() - setup_start;
+
+    long components = cfg.components < n ? cfg.components : n;
+    std::vector<mc_stats_t> stats(components);
+    for (long c = 0; c < components; c++) mc_stats_init(&stats[c]);
+
+    mc_pool_t* pool = start_pool(nthreads);
+    double seconds = 0.0;
+    long long steps = 0;
+    long done = 0;
+
+    for (long walks = CONVERGE_FIRST_WALKS; done < cfg.converge_walks; walks *= 2) {
+        if (walks > cfg.converge_walks) walks = cfg.converge_walks;
+
+        WALK_JOB job;
+        job.sys = &sys;
+        job.seed = cfg.seed;
+        job.antithetic = variant == "antithetic";
+        for (long c = 0; c < components; c++) {
+            for (long w = done; w < walks; w += WALKS_PER_TASK) {
+                add_task(job, c, w, w + WALKS_PER_TASK < walks ? w + WALKS_PER_TASK : walks);
+            }
+        }
+
+        double start = now();
+        mc_pool_run(pool, (long)job.tasks.size(), walk_task, &job);
+        seconds += now() - start;
+
+        for (size_t t = 0; t < job.tasks.size(); t++) {
+            mc_stats_merge(&stats[job.tasks[t].component], &job.tasks[t].stats);
+            steps += job.tasks[t].steps;
+        }
+        done = walks;
+
+        // Worst component of the point
+        BENCH_RESULT r = new_result("converge", variant.c_str());
+        describe_system(r, sys, nnz_per_row, rho, absorb_prob);
+        r.threads = pool->nthreads;
+        r.walks = (double)walks;
+        r.samples = (double)walks * components * (variant == "antithetic" ? 2 : 1);
+        r.seconds = seconds;
+        r.setup_seconds = setup_seconds;
+        r.steps = (double)steps;
+        r.error = 0.0;
+        r.std_error = 0.0;
+        for (long c = 0; c < components; c++) {
+            r.error = fmax(r.error, fabs(stats[c].mean - 1.0));
+            r.std_error = fmax(r.std_error, mc_stats_std_error(&stats[c]));
+        }
+        set_rates(r);
+        results.push_back(r);
+    }
+
+    stop_pool(pool);
+    free_system(sys);
+    return results;
+}
+
+// ---------------------------------------------------------------------
+// Driver
+// ---------------------------------------------------------------------
+
+// One line per record on stdout, with the fields that apply
+static void print_result(const BENCH_RESULT& r) {
+    static const char* shown[] = { "n", "nnz_per_row", "threads", "walks", "seconds",
+                                   "samples_per_sec", "ns_per_step", "error", "peak_rss_kb" };
+
+    printf("%-8s %-13s", r.suite, r.variant);
+    for (size_t i = 0; i < sizeof(shown) / sizeof(shown[0]); i++) {
+        for (size_t k = 0; k < NUM_FIELDS; k++) {
+            double value = r.*fields[k].value;
+            if (!strcmp(fields[k].name, shown[i]) && !std::isnan(value)) {
+                printf(" %s=%.4g", shown[i], value);
+            }
+        }
+    }
+    printf("\n");
+}
+
+// Run one case in a child process and add the peak RSS of the child to
+// its records
+static void run_case(const std::function<std::vector<BENCH_RESULT>()>& fn,
+                     std::vector<BENCH_RESULT>& all) {
+    int fds[2];
+    fflush(stdout);
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        std::vector<BENCH_RESULT> results = fn();
+        const char* p = (const char*)results.data();
+        size_t left = results.size() * sizeof(BENCH_RESULT);
+        while (left > 0) {
+            ssize_t written = write(fds[1], p, left);
+            if (written <= 0) _exit(1);
+            p += written;
+            left -= written;
+        }
+        _exit(0);
+    }
+
+    close(fds[1]);
+    std::vector<BENCH_RESULT> results;
+    BENCH_RESULT r;
+    size_t got = 0;
+    ssize_t len;
+    while ((len = read(fds[0], (char*)&r + got, sizeof(r) - got)) > 0) {
+        got += len;
+        if (got == sizeof(r)) {
+            results.push_back(r);
+            got = 0;
+        }
+    }
+    close(fds[0]);
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Warning: benchmark case failed\n");
+    }
+
+    for (size_t i = 0; i < results.size(); i++) {
+        results[i].peak_rss_kb = (double)usage.ru_maxrss;
+        print_result(results[i]);
+        all.push_back(results[i]);
+    }
+}
+
+static void write_number(FILE* f, double value, bool json) {
+    if (std::isnan(value)) {
+        if (json) fprintf(f, "null");
+    } else if (value == floor(value) && fabs(value) < 1e15) {
+        fprintf(f, "%.0f", value);
+    } else {
+        fprintf(f, "%.6g", value);
+    }
+}
+
+static int write_json(const char* filename, const std::vector<BENCH_RESULT>& results) {
+    FILE* f = fopen(filename, "w");
+    if (!f) return -1;
+
+    const PI_KERNEL* kernel = select_pi_kernel(NULL);
+    fprintf(f, "{\n  \"benchmark\": \"mc_bench\",\n  \"cpus\": %ld,\n  \"pi_kernel\": \"%s\",\n",
+            sysconf(_SC_NPROCESSORS_ONLN), kernel ? kernel->name : "");
+    fprintf(f, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BENCH_RESULT& r = results[i];
+        fprintf(f, "    {\"suite\": \"%s\", \"variant\": \"%s\", \"absorb\": ", r.suite, r.variant);
+        if (r.absorb[0]) fprintf(f, "\"%s\"", r.absorb);
+        else fprintf(f, "null");
+        for (size_t k = 0; k < NUM_FIELDS; k++) {
+            fprintf(f, ", \"%s\": ", fields[k].name);
+            write_number(f, r.*fields[k].value, true);
+        }
+        fprintf(f, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f);
+}
+
+static int write_csv(const char* filename, const std::vector<BENCH_RESULT>& results) {
+    FILE* f = fopen(filename, "w");
+    if (!f) return -1;
+
+    fprintf(f, "suite,variant,absorb");
+    for (size_t k = 0; k < NUM_FIELDS; k++) fprintf(f, ",%s", fields[k].name);
+    fprintf(f, "\n");
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const BENCH_RESULT& r = results[i];
+        fprintf(f, "%s,%s,%s", r.suite, r.variant, r.absorb);
+        for (size_t k = 0; k < NUM_FIELDS; k++) {
+            fprintf(f, ",");
+            write_number(f, r.*fields[k].value, false);
+        }
+        fprintf(f, "\n");
+    }
+    return fclose(f);
+}
+
+// Split "a,b,c"
+static std::vector<std::string> split_list(const char* arg) {
+    std::vector<std::string> items;
+    std::string s(arg);
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t comma = s.find(',', start);
+        if (comma == std::string::npos) comma = s.size();
+        if (comma > start) items.push_back(s.substr(start, comma - start));
+        start = comma + 1;
+    }
+    return items;
+}
+
+static std::vector<long> parse_longs(const char* option, const char* arg) {
+    std::vector<long> values;
+    std::vector<std::string> items = split_list(arg);
+    for (size_t i = 0; i < items.size(); i++) {
+        char* end;
+        double v = strtod(items[i].c_str(), &end);  // Accepts 1e6
+        if (*end || v < 1) {
+            fprintf(stderr, "Error: %s needs positive integers, got %s\n", option, arg);
+            exit(1);
+        }
+        values.push_back((long)v);
+    }
+    return values;
+}
+
+static std::vector<double> parse_doubles(const char* option, const char* arg, bool allow_row) {
+    std::vector<double> values;
+    std::vector<std::string> items = split_list(arg);
+    for (size_t i = 0; i < items.size(); i++) {
+        if (allow_row && items[i] == "row") {
+            values.push_back(ABSORB_ROW);
+            continue;
+        }
+        char* end;
+        double v = strtod(items[i].c_str(), &end);
+        if (*end || !(v > 0.0 && v < 1.0)) {
+            fprintf(stderr, "Error: %s needs values in (0, 1), got %s\n", option, arg);
+            exit(1);
+        }
+        values.push_back(v);
+    }
+    return values;
+}
+
+static bool has(const std::vector<std::string>& list, const char* item) {
+    for (size_t i = 0; i < list.size(); i++) {
+        if (list[i] == item) return true;
+    }
+    return false;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --suites LIST         pi,rng,walk,converge (default: all)\n"
+        "  --threads LIST        thread counts (default: 1 and all CPUs)\n"
+        "  --dims LIST           walk/converge dimensions (default: 1000,100000)\n"
+        "  --nnz LIST            nonzeros per row of C (default: 4,32)\n"
+        "  --rho LIST            row sums of |C| in (0, 1) (default: 0.9)\n"
+        "  --absorb LIST         absorption probabilities or \"row\" (default: 0.1)\n"
+        "  --walks LIST          walks per walk case (default: 1000000)\n"
+        "  --variants LIST       plain,antithetic (default: both)\n"
+        "  --kernels LIST        PI kernels, or \"all\" supported here (default: all)\n"
+        "  --pi-samples N        points per PI case (default: 1e8)\n"
+        "  --rng-samples N       numbers per RNG case (default: 1e8)\n"
+        "  --components K        components of a converge case (default: 8)\n"
+        "  --converge-walks N    walks per component of the last point (default: 65536)\n"
+        "  --seed S              seed of the systems and walks (default: 1)\n"
+        "  --json FILE           write the records as JSON\n"
+        "  --csv FILE            write the records as CSV\n",
+        prog);
+}
+
+int main(int argc, char** argv) {
+    BENCH_CONFIG cfg;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    cfg.suites = split_list("pi,rng,walk,converge");
+    cfg.threads.push_back(1);
+    if (cpus > 1) cfg.threads.push_back(cpus);
+    cfg.dims = parse_longs("--dims", "1000,100000");
+    cfg.nnz = parse_longs("--nnz", "4,32");
+    cfg.rho = parse_doubles("--rho", "0.9", false);
+    cfg.absorb = parse_doubles("--absorb", "0.1", true);
+    cfg.walks = parse_longs("--walks", "1000000");
+    cfg.variants = split_list("plain,antithetic");
+    cfg.kernels = split_list("all");
+    cfg.pi_samples = 100000000LL;
+    cfg.rng_samples = 100000000LL;
+    cfg.components = 8;
+    cfg.converge_walks = 65536;
+    cfg.seed = 1;
+    cfg.json_file = NULL;
+    cfg.csv_file = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char* opt = argv[i];
+        if (!strcmp(opt, "--help") || !strcmp(opt, "-h")) {
+            usage(argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        const char* arg = argv[++i];
+
+        if (!strcmp(opt, "--suites")) cfg.suites = split_list(arg);
+        else if (!strcmp(opt, "--threads")) cfg.threads = parse_longs(opt, arg);
+        else if (!strcmp(opt, "--dims")) cfg.dims = parse_longs(opt, arg);
+        else if (!strcmp(opt, "--nnz")) cfg.nnz = parse_longs(opt, arg);
+        else if (!strcmp(opt, "--rho")) cfg.rho = parse_doubles(opt, arg, false);
+        else if (!strcmp(opt, "--absorb")) cfg.absorb = parse_doubles(opt, arg, true);
+        else if (!strcmp(opt, "--walks")) cfg.walks = parse_longs(opt, arg);
+        else if (!strcmp(opt, "--variants")) cfg.variants = split_list(arg);
+        else if (!strcmp(opt, "--kernels")) cfg.kernels = split_list(arg);
+        else if (!strcmp(opt, "--pi-samples")) cfg.pi_samples = parse_longs(opt, arg)[0];
+        else if (!strcmp(opt, "--rng-samples")) cfg.rng_samples = parse_longs(opt, arg)[0];
+        else if (!strcmp(opt, "--components")) cfg.components = parse_longs(opt, arg)[0];
+        else if (!strcmp(opt, "--converge-walks")) cfg.converge_walks = parse_longs(opt, arg)[0];
+        else if (!strcmp(opt, "--seed")) cfg.seed = strtoull(arg, NULL, 10);
+        else if (!strcmp(opt, "--json")) cfg.json_file = arg;
+        else if (!strcmp(opt, "--csv")) cfg.csv_file = arg;
+        else {
+            fprintf(stderr, "Error: Unknown option %s\n", opt);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < cfg.variants.size(); i++) {
+        if (cfg.variants[i] != "plain" && cfg.variants[i] != "antithetic") {
+            fprintf(stderr, "Error: Unknown walk variant %s\n", cfg.variants[i].c_str());
+            return 1;
+        }
+    }
+
+    // Kernels to time: the named ones, or every one this CPU supports
+    std::vector<const PI_KERNEL*> kernels;
+    const char* known[] = { "avx512", "avx2", "neon", "scalar" };
+    for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+        if (has(cfg.kernels, "all") || has(cfg.kernels, known[i])) {
+            const PI_KERNEL* kernel = select_pi_kernel(known[i]);
+            if (kernel) {
+                kernels.push_back(kernel);
+            } else if (has(cfg.kernels, known[i])) {
+                fprintf(stderr, "Warning: PI kernel %s not available here\n", known[i]);
+            }
+        }
+    }
+
+    std::vector<BENCH_RESULT> results;
+
+    if (has(cfg.suites, "pi")) {
+        for (size_t k = 0; k < kernels.size(); k++) {
+            for (size_t t = 0; t < cfg.threads.size(); t++) {
+                run_case([&, k, t] { return bench_pi(cfg, kernels[k], cfg.threads[t]); }, results);
+            }
+        }
+    }
+
+    if (has(cfg.suites, "rng")) {
+        for (int blocks = 1; blocks >= 0; blocks--) {
+            for (size_t t = 0; t < cfg.threads.size(); t++) {
+                run_case([&, blocks, t] { return bench_rng(cfg, blocks != 0, cfg.threads[t]); },
+                         results);
+            }
+        }
+    }
+
+    if (has(cfg.suites, "walk")) {
+        for (long n : cfg.dims)
+        for (long nnz : cfg.nnz)
+        for (double rho : cfg.rho)
+        for (double absorb : cfg.absorb)
+        for (long walks : cfg.walks)
+        for (const std::string& variant : cfg.variants)
+        for (long threads : cfg.threads) {
+            run_case([&] {
+                return bench_walk(cfg, n, nnz, rho, absorb, walks, variant, threads);
+            }, results);
+        }
+    }
+
+    if (has(cfg.suites, "converge")) {
+        // On the first system of the sweep, with all threads
+        long threads = cfg.threads.back();
+        for (const std::string& variant : cfg.variants) {
+            run_case([&] {
+                return bench_converge(cfg, cfg.dims[0], cfg.nnz[0], cfg.rho[0], cfg.absorb[0],
+                                      variant, threads);
+            }, results);
+        }
+    }
+
+    if (cfg.json_file) {
+        if (write_json(cfg.json_file, results) != 0) {
+            fprintf(stderr, "Error: Cannot write %s\n", cfg.json_file);
+            return 1;
+        }
+        printf("Wrote %s\n", cfg.json_file);
+    }
+    if (cfg.csv_file) {
+        if (write_csv(cfg.csv_file, results) != 0) {
+            fprintf(stderr, "Error: Cannot write %s\n", cfg.csv_file);
+            return 1;
+        }
+        printf("Wrote %s\n", cfg.csv_file);
+    }
+    return 0;
+}
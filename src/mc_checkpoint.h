@@ -0,0 +1,200 @@
+/*
+ * mc_checkpoint.h
+ *
+ * Crash-safe binary checkpoints for the Monte Carlo applications
+ *
+ * A checkpoint is one record:
+ *
+ *   mc_checkpoint_header_t   magic, format, app id, payload version,
+ *                            payload size, payload CRC-32, header CRC-32
+ *   payload                  application-defined bytes
+ *
+ * Writes go to "<path>.tmp", which is flushed, fsync'ed and then renamed
+ * over <path>. rename() is atomic, so a crash at any point leaves either
+ * the previous checkpoint or the new one, never a torn file. Readers
+ * reject records with a wrong magic, app id, payload version, size or
+ * checksum, and the application then starts from scratch.
+ *
+ * Header-only so it can be used from both the C and C++ applications.
+ * Checkpoints are host-local, so the payload is stored in native byte order.
+ *
+ * Licensed under GPL v3
+ */
+
+#ifndef MC_CHECKPOINT_H
+#define MC_CHECKPOINT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define MC_CHECKPOINT_MAGIC  0x4B43434Du    // "MCCK"
+#define MC_CHECKPOINT_FORMAT 1              // Layout of mc_checkpoint_header_t
+
+// Application ids, so one app never resumes from another app's file
+#define MC_CHECKPOINT_APP_PI  1
+#define MC_CHECKPOINT_APP_AXB 2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t format;            // MC_CHECKPOINT_FORMAT
+    uint32_t app_id;            // MC_CHECKPOINT_APP_*
+    uint32_t payload_version;   // Layout version of the application payload
+    uint64_t payload_size;      // Bytes following the header
+    uint32_t payload_crc;       // CRC-32 of the payload
+    uint32_t header_crc;        // CRC-32 of all fields above
+} mc_checkpoint_header_t;
+
+// CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320).
+// Pass 0 as crc for the first block; chain calls for more data.
+static inline uint32_t mc_crc32(uint32_t crc, const void *data, size_t len) {
+    static uint32_t table[256];
+    static int table_ready = 0;
+
+    if (!table_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            }
+            table[i] = c;
+        }
+        table_ready = 1;
+    }
+
+    const unsigned char *p = (const unsigned char *)data;
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// fsync the directory containing 'path' so the rename itself is durable
+static inline void mc_checkpoint_sync_dir(const char *path) {
+    char dir[1024];
+    const char *slash = strrchr(path, '/');
+
+    if (!slash) {
+        strcpy(dir, ".");
+    } else {
+        size_t len = (size_t)(slash - path);
+        if (len == 0) len = 1;                  // Root directory
+        if (len >= sizeof(dir)) return;
+        memcpy(dir, path, len);
+        dir[len] = '\0';
+    }
+
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// Atomically replace the checkpoint at 'path'.
+// Returns 0 on success, -1 on error (the previous checkpoint is kept).
+static inline int mc_checkpoint_write(const char *path, uint32_t app_id, uint32_t payload_version,
+                                      const void *payload, size_t size) {
+    char tmp_path[1024];
+    mc_checkpoint_header_t header;
+
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        fprintf(stderr, "checkpoint: path too long: %s\n", path);
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = MC_CHECKPOINT_MAGIC;
+    header.format = MC_CHECKPOINT_FORMAT;
+    header.app_id = app_id;
+    header.payload_version = payload_version;
+    header.payload_size = size;
+    header.payload_crc = mc_crc32(0, payload, size);
+    header.header_crc = mc_crc32(0, &header, offsetof(mc_checkpoint_header_t, header_crc));
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (!fp) {
+        fprintf(stderr, "checkpoint: cannot create %s\n", tmp_path);
+        return -1;
+    }
+
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             (size == 0 || fwrite(payload, size, 1, fp) == 1) &&
+             fflush(fp) == 0 &&
+             fsync(fileno(fp)) == 0;
+
+    if (fclose(fp) != 0) ok = 0;
+
+    if (!ok) {
+        fprintf(stderr, "checkpoint: error writing %s\n", tmp_path);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    if (rename(tmp_path, path) != 0) {
+        fprintf(stderr, "checkpoint: cannot rename %s to %s\n", tmp_path, path);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    mc_checkpoint_sync_dir(path);
+    return 0;
+}
+
+// Read and verify the checkpoint at 'path' into 'payload' (capacity bytes).
+// The payload size is stored in *size (may be NULL if the caller expects
+// exactly 'capacity' bytes). Returns 0 on success, -1 if there is no
+// usable checkpoint.
+static inline int mc_checkpoint_read(const char *path, uint32_t app_id, uint32_t payload_version,
+                                     void *payload, size_t capacity, size_t *size) {
+    mc_checkpoint_header_t header;
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return -1;      // No checkpoint yet
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        header.magic != MC_CHECKPOINT_MAGIC ||
+        header.header_crc != mc_crc32(0, &header, offsetof(mc_checkpoint_header_t, header_crc))) {
+        fprintf(stderr, "checkpoint: %s is not a valid checkpoint, ignoring it\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    if (header.format != MC_CHECKPOINT_FORMAT || header.app_id != app_id ||
+        header.payload_version != payload_version) {
+        fprintf(stderr, "checkpoint: %s has format %u, app %u, version %u "
+                "(expected %u, %u, %u), ignoring it\n", path,
+                header.format, header.app_id, header.payload_version,
+                MC_CHECKPOINT_FORMAT, app_id, payload_version);
+        fclose(fp);
+        return -1;
+    }
+
+    if (header.payload_size > capacity || (!size && header.payload_size != capacity)) {
+        fprintf(stderr, "checkpoint: %s has unexpected payload size %llu\n",
+                path, (unsigned long long)header.payload_size);
+        fclose(fp);
+        return -1;
+    }
+
+    size_t payload_size = (size_t)header.payload_size;
+    int ok = (payload_size == 0 || fread(payload, payload_size, 1, fp) == 1) &&
+             mc_crc32(0, payload, payload_size) == header.payload_crc;
+    fclose(fp);
+
+    if (!ok) {
+        fprintf(stderr, "checkpoint: %s is truncated or corrupt, ignoring it\n", path);
+        return -1;
+    }
+
+    if (size) *size = payload_size;
+    return 0;
+}
+
+#endif
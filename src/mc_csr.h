@@ -0,0 +1,135 @@
+/*
+ * mc_csr.h
+ *
+ * Compressed sparse row (CSR) matrices for the Ax=b Monte Carlo solver
+ *
+ * Row i holds the entries col[row_ptr[i] .. row_ptr[i+1]) with values
+ * val[...], columns ascending. Memory and the cost of a pass over the
+ * matrix scale with the number of nonzeros, not with n^2.
+ *
+ * Matrices arriving as unordered (row, column, value) triplets (COO) are
+ * converted with mc_csr_from_coo(); duplicate entries are summed.
+ *
+ * Header-only so it can be used from the client and the server tools.
+ *
+ * Licensed under GPL v3
+ */
+
+#ifndef MC_CSR_H
+#define MC_CSR_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int n;                  // Number of rows (and columns)
+    int64_t nnz;            // Number of stored entries
+    int64_t *row_ptr;       // n + 1 row offsets
+    int32_t *col;           // Column of each entry
+    double *val;            // Value of each entry
+} mc_csr_t;
+
+// Allocate an n x n matrix with room for nnz entries (row_ptr zeroed).
+// Returns 0 on success, -1 if memory is exhausted.
+static inline int mc_csr_alloc(mc_csr_t *m, int n, int64_t nnz) {
+    m->n = n;
+    m->nnz = nnz;
+    m->row_ptr = (int64_t *)calloc((size_t)n + 1, sizeof(int64_t));
+    m->col = (int32_t *)malloc((nnz > 0 ? (size_t)nnz : 1) * sizeof(int32_t));
+    m->val = (double *)malloc((nnz > 0 ? (size_t)nnz : 1) * sizeof(double));
+
+    if (!m->row_ptr || !m->col || !m->val) {
+        free(m->row_ptr);
+        free(m->col);
+        free(m->val);
+        memset(m, 0, sizeof(*m));
+        return -1;
+    }
+    return 0;
+}
+
+static inline void mc_csr_free(mc_csr_t *m) {
+    free(m->row_ptr);
+    free(m->col);
+    free(m->val);
+    memset(m, 0, sizeof(*m));
+}
+
+// Build an n x n CSR matrix from nnz triplets (rows[k], cols[k], vals[k])
+// in any order. Entries of the same position are summed. Indices must be
+// in [0, n). Returns 0 on success, -1 if memory is exhausted.
+static inline int mc_csr_from_coo(mc_csr_t *m, int n, int64_t nnz, const int32_t *rows,
+                                  const int32_t *cols, const double *vals) {
+    int64_t *next;
+
+    if (mc_csr_alloc(m, n, nnz) < 0) return -1;
+
+    next = (int64_t *)malloc(((size_t)n + 1) * sizeof(int64_t));
+    if (!next) {
+        mc_csr_free(m);
+        return -1;
+    }
+
+    // Counting sort by row
+    for (int64_t k = 0; k < nnz; k++) {
+        m->row_ptr[rows[k] + 1]++;
+    }
+    for (int i = 0; i < n; i++) {
+        m->row_ptr[i + 1] += m->row_ptr[i];
+    }
+    memcpy(next, m->row_ptr, ((size_t)n + 1) * sizeof(int64_t));
+    for (int64_t k = 0; k < nnz; k++) {
+        int64_t pos = next[rows[k]]++;
+        m->col[pos] = cols[k];
+        m->val[pos] = vals[k];
+    }
+
+    // Sort each row by column (insertion sort: rows are short) and merge duplicates
+    int64_t out = 0;
+    for (int i = 0; i < n; i++) {
+        int64_t begin = m->row_ptr[i], end = m->row_ptr[i + 1];
+
+        for (int64_t k = begin + 1; k < end; k++) {
+            int32_t c = m->col[k];
+            double v = m->val[k];
+            int64_t p = k;
+            while (p > begin && m->col[p - 1] > c) {
+                m->col[p] = m->col[p - 1];
+                m->val[p] = m->val[p - 1];
+                p--;
+            }
+            m->col[p] = c;
+            m->val[p] = v;
+        }
+
+        m->row_ptr[i] = out;
+        for (int64_t k = begin; k < end; k++) {
+            if (out > m->row_ptr[i] && m->col[out - 1] == m->col[k]) {
+                m->val[out - 1] += m->val[k];
+            } else {
+                m->col[out] = m->col[k];
+                m->val[out] = m->val[k];
+                out++;
+            }
+        }
+    }
+    m->row_ptr[n] = out;
+    m->nnz = out;
+
+    free(next);
+    return 0;
+}
+
+// y = M x
+static inline void mc_csr_multiply(const mc_csr_t *m, const double *x, double *y) {
+    for (int i = 0; i < m->n; i++) {
+        double sum = 0.0;
+        for (int64_t k = m->row_ptr[i]; k < m->row_ptr[i + 1]; k++) {
+            sum += m->val[k] * x[m->col[k]];
+        }
+        y[i] = sum;
+    }
+}
+
+#endif
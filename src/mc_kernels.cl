@@ -0,0 +1,269 @@
+/*
+ * mc_kernels.cl
+ *
+ * OpenCL kernels of the GPU app versions (built with -DMC_OPENCL)
+ *
+ * They compute exactly what the CPU code computes, so a work unit gives
+ * the same result, the same checkpoints and the same validator verdict
+ * whichever app version runs it:
+ *
+ * - Philox4x32-10 and the bits-to-double mapping are those of mc_rng.h,
+ *   so every sample and walk uses the stream it uses on the CPU.
+ * - pi_count is the scalar kernel of pi_kernels.cpp. The hits are
+ *   integers, so the work-group tree reduction is exact in any order.
+ * - axb_walks runs one task of Axb-MonteCarlo.c (a component and a range
+ *   of at most AXB_TASK_WALKS walks) per work-group. The walk is the loop
+ *   of mc_walk.h. The group keeps the walk scores in local memory and
+ *   folds them into the task's statistics in walk order, as
+ *   run_walk_task() does, so the mean and variance match bit for bit.
+ *
+ * FP_CONTRACT is off for the same reason the CPU code is compiled with
+ * -ffp-contract=off: a fused multiply-add rounds differently.
+ *
+ * The host code embeds this file as a string (mc_kernels_cl.h, made by
+ * the Makefile) and builds it at run time, see mc_opencl.h.
+ *
+ * Licensed under GPL v3
+ */
+
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#pragma OPENCL FP_CONTRACT OFF
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+#define WALK_MAX_STEPS 10000        // MC_WALK_MAX_STEPS
+#define TELEMETRY_BINS 16           // MC_TELEMETRY_BINS
+#define AXB_TASK_WALKS 1024         // WALKS_PER_TASK of Axb-MonteCarlo.c
+
+// Same layouts as mc_alias_slot_t, mc_stats_t and mc_walks_t
+typedef struct {
+    double prob;
+    int column[2];
+    double mult[2];
+} alias_slot_t;
+
+typedef struct {
+    long count;
+    double mean;
+    double m2;
+} stats_t;
+
+typedef struct {
+    long transitions;
+    long length_hist[TELEMETRY_BINS];
+} walks_t;
+
+// mc_rng_block(): block 'block' of stream 'stream' under key (k0, k1)
+void philox_block(uint k0, uint k1, ulong stream, ulong block, uint out[4]) {
+    uint c0 = (uint)block, c1 = (uint)(block >> 32);
+    uint c2 = (uint)stream, c3 = (uint)(stream >> 32);
+
+    for (int round = 0; round < 10; round++) {
+        if (round > 0) {
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        uint lo0 = PHILOX_M0 * c0, hi0 = mul_hi(PHILOX_M0, c0);
+        uint lo1 = PHILOX_M1 * c2, hi1 = mul_hi(PHILOX_M1, c2);
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+    }
+
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// mc_rng_u64_to_double()
+double u64_to_double(ulong u) {
+    return as_double((u >> 12) | 0x3FF0000000000000UL) - 1.0;
+}
+
+// The state of mc_rng_t: one stream, read a block of four words at a time
+typedef struct {
+    uint k0, k1;
+    ulong stream;
+    ulong block;
+    uint buf[4];
+    int pos;
+} rng_t;
+
+void rng_init(rng_t *rng, ulong seed, ulong stream) {
+    rng->k0 = (uint)seed;
+    rng->k1 = (uint)(seed >> 32);
+    rng->stream = stream;
+    rng->block = 0;
+    rng->pos = 4;
+}
+
+uint rng_next_u32(rng_t *rng) {
+    if (rng->pos == 4) {
+        philox_block(rng->k0, rng->k1, rng->stream, rng->block++, rng->buf);
+        rng->pos = 0;
+    }
+    return rng->buf[rng->pos++];
+}
+
+// mc_walk_uniform(): the next double of the stream, reflected for the
+// antithetic twin (mc_rng_reflect())
+double walk_uniform(rng_t *rng, int reflect) {
+    ulong lo = rng_next_u32(rng);
+    ulong hi = rng_next_u32(rng);
+    double u = u64_to_double(lo | (hi << 32));
+    return reflect ? (1.0 - 0x1p-52) - u : u;
+}
+
+/*
+ * Count the samples of [begin, end) of stream 0 inside the quarter circle.
+ * Work-item i of the launch takes samples begin + i, begin + i + size, ...;
+ * each work-group writes its hits to partial[group], local_hits has one
+ * slot per work-item (the local size must be a power of two).
+ */
+__kernel void pi_count(uint k0, uint k1, long begin, long end,
+                       __global long *partial, __local long *local_hits) {
+    size_t lid = get_local_id(0);
+    long hits = 0;
+
+    for (long i = begin + (long)get_global_id(0); i < end; i += (long)get_global_size(0)) {
+        uint c[4];
+        philox_block(k0, k1, 0, (ulong)i, c);
+        double x = u64_to_double((ulong)c[0] | ((ulong)c[1] << 32));
+        double y = u64_to_double((ulong)c[2] | ((ulong)c[3] << 32));
+        hits += (x * x + y * y <= 1.0);
+    }
+
+    local_hits[lid] = hits;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (size_t half = get_local_size(0) / 2; half > 0; half /= 2) {
+        if (lid < half) {
+            local_hits[lid] += local_hits[lid + half];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (lid == 0) {
+        partial[get_group_id(0)] = local_hits[0];
+    }
+}
+
+// mc_walk_run(): the sum of one walk from 'state'; *length receives the
+// number of states it visited
+double walk_run(__global const long *row_ptr, __global const alias_slot_t *alias,
+                __global const double *f, __global const double *row_sum,
+                __global const double *absorb, int state, rng_t *rng, int reflect,
+                int *length) {
+    double sum = 0.0;
+    double weight = 1.0;
+    int step;
+
+    for (step = 0; step < WALK_MAX_STEPS; step++) {
+        sum += weight * f[state];
+
+        if (walk_uniform(rng, reflect) < absorb[state]) {
+            break;
+        }
+
+        long first = row_ptr[state];
+        int m = (int)(row_ptr[state + 1] - first);
+        if (m == 0 || row_sum[state] < 1e-12) {
+            break;
+        }
+
+        // mc_alias_sample()
+        double u1 = walk_uniform(rng, reflect);
+        double u2 = walk_uniform(rng, reflect);
+        int k = (int)(u1 * m);
+        if (k >= m) k = m - 1;
+        int pick = (u2 < alias[first + k].prob) ? 0 : 1;
+        weight *= alias[first + k].mult[pick];
+        state = alias[first + k].column[pick];
+    }
+
+    *length = step < WALK_MAX_STEPS ? step + 1 : step;
+    return sum;
+}
+
+// mc_walks_add()
+void count_walk(__local int *hist, long *transitions, int length) {
+    int bin = 31 - clz((uint)length);
+    if (bin >= TELEMETRY_BINS) bin = TELEMETRY_BINS - 1;
+    atomic_inc(&hist[bin]);
+    *transitions += length - 1;
+}
+
+/*
+ * One task per work-group: walks [task_begin[t], task_end[t]) of
+ * component task_component[t] (at most AXB_TASK_WALKS of them), with the
+ * streams of walk_stream() in Axb-MonteCarlo.c. Writes the statistics of
+ * the walk scores to stats[t] and the walk counters to walks[t].
+ * local_transitions has one slot per work-item (a power of two).
+ */
+__kernel void axb_walks(__global const long *row_ptr, __global const alias_slot_t *alias,
+                        __global const double *f, __global const double *row_sum,
+                        __global const double *absorb, ulong seed, int antithetic,
+                        __global const int *task_component, __global const long *task_begin,
+                        __global const long *task_end, __global stats_t *stats,
+                        __global walks_t *walks, __local long *local_transitions) {
+    __local double scores[AXB_TASK_WALKS];
+    __local int hist[TELEMETRY_BINS];
+
+    size_t t = get_group_id(0);
+    size_t lid = get_local_id(0);
+    int i = task_component[t];
+    long begin = task_begin[t];
+    long num_walks = task_end[t] - begin;
+    long transitions = 0;
+
+    for (size_t bin = lid; bin < TELEMETRY_BINS; bin += get_local_size(0)) {
+        hist[bin] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (long k = (long)lid; k < num_walks; k += (long)get_local_size(0)) {
+        ulong stream = ((ulong)(uint)i << 32) | (uint)(begin + k);
+        rng_t rng;
+        int length;
+
+        rng_init(&rng, seed, stream);
+        double score = walk_run(row_ptr, alias, f, row_sum, absorb, i, &rng, 0, &length);
+        count_walk(hist, &transitions, length);
+
+        if (antithetic) {
+            rng_init(&rng, seed, stream);
+            score = 0.5 * (score + walk_run(row_ptr, alias, f, row_sum, absorb, i, &rng, 1,
+                                            &length));
+            count_walk(hist, &transitions, length);
+        }
+        scores[k] = score;
+    }
+
+    local_transitions[lid] = transitions;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (size_t half = get_local_size(0) / 2; half > 0; half /= 2) {
+        if (lid < half) {
+            local_transitions[lid] += local_transitions[lid + half];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (lid == 0) {
+        // mc_stats_add() over the scores, in walk order
+        stats_t s = { 0, 0.0, 0.0 };
+        for (long k = 0; k < num_walks; k++) {
+            s.count++;
+            double delta = scores[k] - s.mean;
+            s.mean += delta / (double)s.count;
+            s.m2 += delta * (scores[k] - s.mean);
+        }
+        stats[t] = s;
+        walks[t].transitions = local_transitions[0];
+    }
+    for (size_t bin = lid; bin < TELEMETRY_BINS; bin += get_local_size(0)) {
+        walks[t].length_hist[bin] = hist[bin];
+    }
+}
@@ -0,0 +1,251 @@
+/*
+ * mc_lu.h
+ *
+ * Dense LU factorization with partial pivoting, the direct reference
+ * solver for the Ax=b Monte Carlo apps
+ *
+ * mc_lu_factor() computes PA = LU of an n x n matrix, right-looking and
+ * in panels of MC_LU_BLOCK columns:
+ *
+ *   1. the panel (all rows from the diagonal down) is factored column by
+ *      column, choosing each pivot from the whole remaining column;
+ *   2. the panel's rows of the matrix to its right are solved with the
+ *      panel's unit lower triangle, giving the block row of U;
+ *   3. the trailing matrix is updated with the product of the panel's L
+ *      and U blocks, which is where O(n^3) of the work is.
+ *
+ * Rows are held through an array of row pointers, so a pivot swap
+ * exchanges two pointers instead of two rows. The trailing update is
+ * split into tasks of MC_LU_TASK_ROWS rows, run on a thread pool
+ * (mc_pool.h) when one is given, and walks the columns in tiles of
+ * MC_LU_TILE so the block row of U it reads stays in cache. Every element
+ * is updated by one task in a fixed order, so the factors do not depend
+ * on the number of threads.
+ *
+ * Built with -DMC_LU_LAPACK (and linked with -llapack), the factorization
+ * and solve are LAPACK's dgetrf/dgetrs instead.
+ *
+ * Header-only and valid C and C++, so the standalone solver
+ * (simpleAxbMC.c) and the server tools (axb_assimilator.cpp) share it.
+ *
+ * Licensed under GPL v3
+ */
+
+#ifndef MC_LU_H
+#define MC_LU_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mc_pool.h"
+
+#define MC_LU_BLOCK 64          // Columns per panel
+#define MC_LU_TILE 256          // Columns per tile of the trailing update
+#define MC_LU_TASK_ROWS 32      // Rows per trailing update task
+
+#ifdef MC_LU_LAPACK
+#define MC_LU_BACKEND "LAPACK"
+#else
+#define MC_LU_BACKEND "blocked LU"
+#endif
+
+#ifdef MC_LU_LAPACK
+#ifdef __cplusplus
+extern "C" {
+#endif
+void dgetrf_(const int *m, const int *n, double *a, const int *lda, int *ipiv, int *info);
+void dgetrs_(const char *trans, const int *n, const int *nrhs, const double *a,
+             const int *lda, const int *ipiv, double *b, const int *ldb, int *info);
+#ifdef __cplusplus
+}
+#endif
+#endif
+
+// Factors of PA = LU: row i of the factored matrix is row[i], holding L
+// (unit diagonal, not stored) left of the diagonal and U from it on.
+// perm[i] is the row of A that ended up as row i.
+typedef struct {
+    int n;
+    double *data;           // n * n values, rows in their original order
+    double **row;
+    int *perm;
+} mc_lu_t;
+
+// Allocate the factors of an n x n matrix.
+// Returns 0 on success, -1 if memory is exhausted.
+static inline int mc_lu_alloc(mc_lu_t *lu, int n) {
+    lu->n = n;
+    lu->data = (double *)malloc((size_t)n * n * sizeof(double));
+    lu->row = (double **)malloc((size_t)n * sizeof(double *));
+    lu->perm = (int *)malloc((size_t)n * sizeof(int));
+
+    if (!lu->data || !lu->row || !lu->perm) {
+        free(lu->data);
+        free(lu->row);
+        free(lu->perm);
+        memset(lu, 0, sizeof(*lu));
+        return -1;
+    }
+    return 0;
+}
+
+static inline void mc_lu_free(mc_lu_t *lu) {
+    free(lu->data);
+    free(lu->row);
+    free(lu->perm);
+    memset(lu, 0, sizeof(*lu));
+}
+
+// Trailing update of one panel: rows and columns [end, n) less the
+// product of L's columns [begin, end) and U's rows [begin, end)
+typedef struct {
+    mc_lu_t *lu;
+    int begin;
+    int end;
+} mc_lu_update_t;
+
+static inline void mc_lu_update_task(void *ctx, long task) {
+    const mc_lu_update_t *u = (const mc_lu_update_t *)ctx;
+    double **row = u->lu->row;
+    int n = u->lu->n;
+    int first = u->end + (int)task * MC_LU_TASK_ROWS;
+    int last = first + MC_LU_TASK_ROWS < n ? first + MC_LU_TASK_ROWS : n;
+
+    for (int j0 = u->end; j0 < n; j0 += MC_LU_TILE) {
+        int j1 = j0 + MC_LU_TILE < n ? j0 + MC_LU_TILE : n;
+
+        for (int i = first; i < last; i++) {
+            double *ri = row[i];
+            int p = u->begin;
+
+            // Four rows of U per pass over the row, so ri[j] is loaded
+            // and stored once for every four updates
+            for (; p + 4 <= u->end; p += 4) {
+                double l0 = ri[p], l1 = ri[p + 1], l2 = ri[p + 2], l3 = ri[p + 3];
+                const double *r0 = row[p], *r1 = row[p + 1], *r2 = row[p + 2], *r3 = row[p + 3];
+                for (int j = j0; j < j1; j++) {
+                    ri[j] -= l0 * r0[j] + l1 * r1[j] + l2 * r2[j] + l3 * r3[j];
+                }
+            }
+            for (; p < u->end; p++) {
+                double l = ri[p];
+                const double *rp = row[p];
+                for (int j = j0; j < j1; j++) {
+                    ri[j] -= l * rp[j];
+                }
+            }
+        }
+    }
+}
+
+// Factor the n x n matrix A (row i at A + i * lda) into 'lu', allocated
+// for n by mc_lu_alloc(). 'pool' runs the trailing updates; NULL runs
+// them on the calling thread.
+// Returns 0 on success, 1 if A is singular (a zero pivot).
+static inline int mc_lu_factor(mc_lu_t *lu, const double *A, size_t lda, mc_pool_t *pool) {
+    int n = lu->n;
+
+    for (int i = 0; i < n; i++) {
+        memcpy(lu->data + (size_t)i * n, A + i * lda, (size_t)n * sizeof(double));
+        lu->row[i] = lu->data + (size_t)i * n;
+        lu->perm[i] = i;
+    }
+
+#ifdef MC_LU_LAPACK
+    // Row-major A is column-major A^T, and dgetrs solves with its
+    // transpose; perm holds dgetrf's pivots
+    int info;
+    (void)pool;
+    dgetrf_(&n, &n, lu->data, &n, lu->perm, &info);
+    return info < 0 ? -1 : info > 0;
+#else
+    double **row = lu->row;
+
+    for (int k0 = 0; k0 < n; k0 += MC_LU_BLOCK) {
+        int k1 = k0 + MC_LU_BLOCK < n ? k0 + MC_LU_BLOCK : n;
+
+        // 1. Factor the panel, columns [k0, k1)
+        for (int k = k0; k < k1; k++) {
+            int pivot = k;
+            for (int i = k + 1; i < n; i++) {
+                if (fabs(row[i][k]) > fabs(row[pivot][k])) pivot = i;
+            }
+            if (row[pivot][k] == 0.0) {
+                return 1;
+            }
+            if (pivot != k) {
+                double *tmp_row = row[k];
+                row[k] = row[pivot];
+                row[pivot] = tmp_row;
+                int tmp = lu->perm[k];
+                lu->perm[k] = lu->perm[pivot];
+                lu->perm[pivot] = tmp;
+            }
+
+            const double *rk = row[k];
+            double inv_pivot = 1.0 / rk[k];
+            for (int i = k + 1; i < n; i++) {
+                double *ri = row[i];
+                double l = ri[k] * inv_pivot;
+                ri[k] = l;
+                for (int j = k + 1; j < k1; j++) {
+                    ri[j] -= l * rk[j];
+                }
+            }
+        }
+        if (k1 == n) break;
+
+        // 2. Block row of U: solve the panel's rows with its unit lower triangle
+        for (int i = k0 + 1; i < k1; i++) {
+            double *ri = row[i];
+            for (int p = k0; p < i; p++) {
+                double l = ri[p];
+                const double *rp = row[p];
+                for (int j = k1; j < n; j++) {
+                    ri[j] -= l * rp[j];
+                }
+            }
+        }
+
+        // 3. Trailing update
+        mc_lu_update_t update = { lu, k0, k1 };
+        long ntasks = (n - k1 + MC_LU_TASK_ROWS - 1) / MC_LU_TASK_ROWS;
+        if (pool) {
+            mc_pool_run(pool, ntasks, mc_lu_update_task, &update);
+        } else {
+            for (long t = 0; t < ntasks; t++) {
+                mc_lu_update_task(&update, t);
+            }
+        }
+    }
+    return 0;
+#endif
+}
+
+// Solve Ax = b with the factors of A; x and b must not overlap
+static inline void mc_lu_solve(const mc_lu_t *lu, const double *b, double *x) {
+    int n = lu->n;
+
+#ifdef MC_LU_LAPACK
+    int one = 1, info;
+    memcpy(x, b, (size_t)n * sizeof(double));
+    dgetrs_("T", &n, &one, lu->data, &n, lu->perm, x, &n, &info);
+#else
+    // Ly = Pb, then Ux = y, both in x
+    for (int i = 0; i < n; i++) {
+        const double *ri = lu->row[i];
+        double sum = b[lu->perm[i]];
+        for (int j = 0; j < i; j++) sum -= ri[j] * x[j];
+        x[i] = sum;
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        const double *ri = lu->row[i];
+        double sum = x[i];
+        for (int j = i + 1; j < n; j++) sum -= ri[j] * x[j];
+        x[i] = sum / ri[i];
+    }
+#endif
+}
+
+#endif
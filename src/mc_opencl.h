@@ -0,0 +1,188 @@
+/*
+ * mc_opencl.h
+ *
+ * OpenCL device setup of the GPU app versions
+ *
+ * The GPU versions of pi_compute and axb_montecarlo are the CPU apps built
+ * with -DMC_OPENCL; they run their kernels (mc_kernels.cl) on the device
+ * this header opens. Each GPU plan class (templates/plan_class_spec.xml)
+ * is built with MC_OPENCL_VENDOR set to its vendor's platform name, and
+ * the client puts the index of the GPU it assigned on the command line
+ * as "--device N". mc_cl_open() takes the Nth GPU with double precision
+ * support on the platforms of that vendor. Without "--device" (standalone
+ * testing) it falls back to any OpenCL device, e.g. a CPU runtime.
+ *
+ * The kernel source is compiled into the app (mc_kernels_cl.h, made from
+ * mc_kernels.cl by the Makefile) and built for the device at run time.
+ *
+ * Header-only and valid C and C++, like the mc_*.h modules.
+ *
+ * Licensed under GPL v3
+ */
+
+#ifndef MC_OPENCL_H
+#define MC_OPENCL_H
+
+#define CL_TARGET_OPENCL_VERSION 120
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "mc_kernels_cl.h"
+
+#define MC_CL_LOCAL_SIZE 64         // Work-items per work-group (a power of two)
+#define MC_CL_MAX_DEVICES 16        // Per platform
+
+typedef struct {
+    cl_device_id device;
+    cl_context context;
+    cl_command_queue queue;
+    cl_program program;
+    char name[256];
+} mc_cl_t;
+
+// Report a failed OpenCL call. Returns -1 if 'err' is an error, else 0.
+static inline int mc_cl_check(cl_int err, const char *what) {
+    if (err == CL_SUCCESS) return 0;
+    fprintf(stderr, "OpenCL error %d: %s\n", (int)err, what);
+    return -1;
+}
+
+// Does 'vendor' contain 'wanted', ignoring case?
+static inline int mc_cl_vendor_matches(const char *vendor, const char *wanted) {
+    size_t len = strlen(wanted);
+    for (const char *p = vendor; *p; p++) {
+        size_t k = 0;
+        while (k < len && p[k] && tolower((unsigned char)p[k]) == tolower((unsigned char)wanted[k])) {
+            k++;
+        }
+        if (k == len) return 1;
+    }
+    return 0;
+}
+
+// The index-th device of 'type' with double precision on the platforms of
+// 'vendor' (NULL: all platforms). Returns 0 and sets *device, or -1.
+static inline int mc_cl_find_device(cl_device_type type, const char *vendor, int index,
+                                    cl_device_id *device) {
+    cl_platform_id platforms[MC_CL_MAX_DEVICES];
+    cl_uint num_platforms = 0;
+
+    if (clGetPlatformIDs(MC_CL_MAX_DEVICES, platforms, &num_platforms) != CL_SUCCESS) {
+        return -1;
+    }
+    if (num_platforms > MC_CL_MAX_DEVICES) num_platforms = MC_CL_MAX_DEVICES;
+
+    for (cl_uint p = 0; p < num_platforms; p++) {
+        char name[256] = "";
+        cl_device_id devices[MC_CL_MAX_DEVICES];
+        cl_uint num_devices = 0;
+
+        clGetPlatformInfo(platforms[p], CL_PLATFORM_VENDOR, sizeof(name) - 1, name, NULL);
+        if (vendor && !mc_cl_vendor_matches(name, vendor)) continue;
+        if (clGetDeviceIDs(platforms[p], type, MC_CL_MAX_DEVICES, devices,
+                           &num_devices) != CL_SUCCESS) {
+            continue;
+        }
+        if (num_devices > MC_CL_MAX_DEVICES) num_devices = MC_CL_MAX_DEVICES;
+
+        for (cl_uint d = 0; d < num_devices; d++) {
+            cl_device_fp_config fp64 = 0;
+            clGetDeviceInfo(devices[d], CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp64), &fp64, NULL);
+            if (fp64 == 0) continue;
+            if (index-- == 0) {
+                *device = devices[d];
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+// Open the device (see above), create its queue and build the kernels.
+// Returns 0 on success, -1 (and says why on stderr) if there is no usable
+// device.
+static inline int mc_cl_open(mc_cl_t *cl, int argc, char **argv) {
+    const char *vendor = NULL;
+    int index = 0, assigned = 0;
+    cl_int err;
+
+#ifdef MC_OPENCL_VENDOR
+    vendor = MC_OPENCL_VENDOR;
+#endif
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--device") == 0) {
+            index = atoi(argv[i + 1]);
+            assigned = 1;
+        }
+    }
+
+    memset(cl, 0, sizeof(*cl));
+    if (mc_cl_find_device(CL_DEVICE_TYPE_GPU, vendor, index, &cl->device) < 0 &&
+        (assigned || mc_cl_find_device(CL_DEVICE_TYPE_ALL, NULL, index, &cl->device) < 0)) {
+        fprintf(stderr, "OpenCL: no %s %d with double precision%s%s\n",
+                assigned ? "GPU" : "device", index, vendor ? " from " : "", vendor ? vendor : "");
+        return -1;
+    }
+    clGetDeviceInfo(cl->device, CL_DEVICE_NAME, sizeof(cl->name) - 1, cl->name, NULL);
+
+    cl->context = clCreateContext(NULL, 1, &cl->device, NULL, NULL, &err);
+    if (mc_cl_check(err, "clCreateContext") < 0) return -1;
+    cl->queue = clCreateCommandQueue(cl->context, cl->device, 0, &err);
+    if (mc_cl_check(err, "clCreateCommandQueue") < 0) {
+        clReleaseContext(cl->context);
+        return -1;
+    }
+
+    const char *source = mc_kernels_cl;
+    cl->program = clCreateProgramWithSource(cl->context, 1, &source, NULL, &err);
+    if (err == CL_SUCCESS) {
+        err = clBuildProgram(cl->program, 1, &cl->device, "", NULL, NULL);
+        if (err != CL_SUCCESS) {
+            char log[4096] = "";
+            clGetProgramBuildInfo(cl->program, cl->device, CL_PROGRAM_BUILD_LOG,
+                                  sizeof(log) - 1, log, NULL);
+            fprintf(stderr, "OpenCL: cannot build the kernels for %s:\n%s\n", cl->name, log);
+        }
+    }
+    if (mc_cl_check(err, "building mc_kernels.cl") < 0) {
+        if (cl->program) clReleaseProgram(cl->program);
+        clReleaseCommandQueue(cl->queue);
+        clReleaseContext(cl->context);
+        return -1;
+    }
+    return 0;
+}
+
+// The kernel 'name' of the program, or NULL
+static inline cl_kernel mc_cl_kernel(mc_cl_t *cl, const char *name) {
+    cl_int err;
+    cl_kernel kernel = clCreateKernel(cl->program, name, &err);
+    return mc_cl_check(err, name) < 0 ? NULL : kernel;
+}
+
+// A device buffer of 'size' bytes: a read-only copy of 'data', or
+// read-write and uninitialized if 'data' is NULL. Returns NULL on failure.
+static inline cl_mem mc_cl_buffer(mc_cl_t *cl, size_t size, const void *data) {
+    cl_int err;
+    cl_mem_flags flags = data ? CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR : CL_MEM_READ_WRITE;
+    cl_mem buffer = clCreateBuffer(cl->context, flags, size > 0 ? size : 1, (void *)data, &err);
+    return mc_cl_check(err, "clCreateBuffer") < 0 ? NULL : buffer;
+}
+
+static inline void mc_cl_close(mc_cl_t *cl) {
+    if (cl->program) clReleaseProgram(cl->program);
+    if (cl->queue) clReleaseCommandQueue(cl->queue);
+    if (cl->context) clReleaseContext(cl->context);
+    memset(cl, 0, sizeof(*cl));
+}
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * mc_pool.h
+ *
+ * Work-stealing thread pool for the Ax=b random walks
+ *
+ * mc_pool_run() executes tasks 0 .. ntasks-1 on all threads of the pool
+ * and returns when every task has finished. The tasks are first split into
+ * one contiguous block per thread; a thread takes tasks from the front of
+ * its own block and, once that is empty, steals from the back of the
+ * others'. Walk lengths are geometric, so some tasks take much longer than
+ * others and a static split alone would leave threads idle at the end of
+ * every round.
+ *
+ * Tasks write their results to their own slots (indexed by task number),
+ * so the caller can combine them in task order and get the same answer
+ * for any number of threads.
+ *
+ * The calling thread works as thread 0; the pool starts nthreads-1 helpers.
+ * Header-only, like the other mc_*.h modules.
+ *
+ * Licensed under GPL v3
+ */
+
+#ifndef MC_POOL_H
+#define MC_POOL_H
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MC_POOL_MAX_THREADS 256
+
+typedef void (*mc_pool_task_fn)(void *ctx, long task);
+
+// Remaining tasks [head, tail) of one thread, padded to a cache line so
+// the owner and the thieves of different threads do not share one
+typedef struct {
+    pthread_mutex_t lock;
+    long head;
+    long tail;
+} __attribute__((aligned(64))) mc_pool_queue_t;
+
+typedef struct mc_pool mc_pool_t;
+
+typedef struct {
+    mc_pool_t *pool;
+    int id;
+} mc_pool_worker_t;
+
+struct mc_pool {
+    int nthreads;
+    mc_pool_queue_t queue[MC_POOL_MAX_THREADS];
+    pthread_t threads[MC_POOL_MAX_THREADS];
+    mc_pool_worker_t workers[MC_POOL_MAX_THREADS];
+
+    pthread_mutex_t lock;       // Protects the fields below
+    pthread_cond_t start;       // A new batch or shutdown
+    pthread_cond_t done;        // A helper finished the batch
+    long batch;                 // Number of the current batch
+    int busy;                   // Helpers still working on it
+    int shutdown;
+
+    mc_pool_task_fn fn;
+    void *ctx;
+};
+
+// Take the next task of thread 'id': its own first, else steal the last
+// task of another thread. Returns -1 when no tasks are left anywhere.
+static inline long mc_pool_next_task(mc_pool_t *pool, int id) {
+    mc_pool_queue_t *own = &pool->queue[id];
+    long task = -1;
+
+    pthread_mutex_lock(&own->lock);
+    if (own->head < own->tail) {
+        task = own->head++;
+    }
+    pthread_mutex_unlock(&own->lock);
+    if (task >= 0) return task;
+
+    for (int k = 1; k < pool->nthreads && task < 0; k++) {
+        mc_pool_queue_t *victim = &pool->queue[(id + k) % pool->nthreads];
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->head < victim->tail) {
+            task = --victim->tail;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return task;
+}
+
+static inline void mc_pool_work(mc_pool_t *pool, int id) {
+    long task;
+    while ((task = mc_pool_next_task(pool, id)) >= 0) {
+        pool->fn(pool->ctx, task);
+    }
+}
+
+static inline void *mc_pool_helper_main(void *arg) {
+    mc_pool_worker_t *worker = (mc_pool_worker_t *)arg;
+    mc_pool_t *pool = worker->pool;
+    long seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->batch == seen && !pool->shutdown) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->batch;
+        pthread_mutex_unlock(&pool->lock);
+
+        mc_pool_work(pool, worker->id);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// Start a pool of nthreads threads (the caller included).
+// Returns the number of threads actually available (at least 1).
+static inline int mc_pool_create(mc_pool_t *pool, int nthreads) {
+    memset(pool, 0, sizeof(*pool));
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > MC_POOL_MAX_THREADS) nthreads = MC_POOL_MAX_THREADS;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (int i = 0; i < MC_POOL_MAX_THREADS; i++) {
+        pthread_mutex_init(&pool->queue[i].lock, NULL);
+    }
+
+    pool->nthreads = 1;
+    for (int i = 1; i < nthreads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        if (pthread_create(&pool->threads[i], NULL, mc_pool_helper_main, &pool->workers[i]) != 0) {
+            break;      // Run with the threads we have
+        }
+        pool->nthreads++;
+    }
+    return pool->nthreads;
+}
+
+// Run tasks 0 .. ntasks-1 as fn(ctx, task) and wait for all of them
+static inline void mc_pool_run(mc_pool_t *pool, long ntasks, mc_pool_task_fn fn, void *ctx) {
+    int nthreads = pool->nthreads;
+
+    for (int i = 0; i < nthreads; i++) {
+        pool->queue[i].head = ntasks * i / nthreads;
+        pool->queue[i].tail = ntasks * (i + 1) / nthreads;
+    }
+    pool->fn = fn;
+    pool->ctx = ctx;
+
+    if (nthreads == 1) {
+        mc_pool_work(pool, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->busy = nthreads - 1;
+    pool->batch++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    mc_pool_work(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Stop the helper threads
+static inline void mc_pool_destroy(mc_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (int i = 0; i < MC_POOL_MAX_THREADS; i++) {
+        pthread_mutex_destroy(&pool->queue[i].lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+}
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * mc_result.h
+ *
+ * Binary result records of the Monte Carlo applications
+ *
+ * The text outputs print every value with "%.15e" or on a labelled line,
+ * and the server has to parse them back, losing the last bits of every
+ * double. A binary result is one record the server reads with a single
+ * fread and uses in place:
+ *
+ *   mc_result_header_t     magic, format, app id, entry size, range,
+ *                          walks, seed, entry count, CRC-32s
+ *   entries[count]         mc_result_pi_t or mc_result_axb_t
+ *
+ * Results travel between hosts, so the record is little-endian, the byte
+ * order the apps are built for (as in axb_input.h); a record from a
+ * big-endian host is reported, not misread. The CRC-32 of mc_checkpoint.h
+ * covers the header and the entries, so a damaged or truncated upload is
+ * rejected before any value is used.
+ *
+ * The apps write this format instead of their text output when started
+ * with "--binary_output" (e.g. "create_work --command_line --binary_output").
+ * The server code accepts both and tells them apart by the magic.
+ *
+ * Header-only and valid C and C++, like the mc_*.h modules.
+ *
+ * Licensed under GPL v3
+ */
+
+#ifndef MC_RESULT_H
+#define MC_RESULT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mc_checkpoint.h"
+
+#define MC_RESULT_MAGIC  0x5352434Du        // "MCRS" in file byte order
+#define MC_RESULT_FORMAT 1                  // Layout of the header and entries
+
+// Application ids, the same as those of the checkpoints
+#define MC_RESULT_APP_PI  MC_CHECKPOINT_APP_PI
+#define MC_RESULT_APP_AXB MC_CHECKPOINT_APP_AXB
+
+typedef struct {
+    uint32_t magic;             // MC_RESULT_MAGIC
+    uint32_t format;            // MC_RESULT_FORMAT
+    uint32_t app_id;            // MC_RESULT_APP_*
+    uint32_t entry_size;        // Bytes per entry
+    int64_t start_idx;          // axb: first component; pi: 0
+    int64_t end_idx;            // axb: last component; pi: last experiment
+    int64_t num_walks;          // axb: walks per component; pi: total iterations
+    uint64_t seed;              // axb: seed of the walk streams; pi: of experiment 0
+    uint64_t count;             // Entries following the header
+    uint32_t entries_crc;       // CRC-32 of the entries
+    uint32_t header_crc;        // CRC-32 of all fields above
+} mc_result_header_t;
+
+// One experiment of pi_compute
+typedef struct {
+    int64_t hits;               // Points in circle
+    int64_t iterations;
+    uint64_t seed;
+    double pi;                  // 4 * hits / iterations
+    double std_error;           // From the observed hit rate
+} mc_result_pi_t;
+
+// One component of axb_montecarlo
+typedef struct {
+    double value;
+    double std_error;
+    int64_t samples;            // Walks (suffix mode: samples) averaged
+} mc_result_axb_t;
+
+// Write a result record to 'fp', opened by the caller ("wb", through
+// boinc_fopen() in the BOINC builds of both apps) and closed by it. The
+// caller fills the range fields of 'header' (start_idx to seed); the rest
+// is set here.
+// Returns 0 on success, -1 on a write error.
+static inline int mc_result_write(FILE *fp, uint32_t app_id, mc_result_header_t *header,
+                                  const void *entries, size_t entry_size, size_t count) {
+    header->magic = MC_RESULT_MAGIC;
+    header->format = MC_RESULT_FORMAT;
+    header->app_id = app_id;
+    header->entry_size = (uint32_t)entry_size;
+    header->count = count;
+    header->entries_crc = mc_crc32(0, entries, entry_size * count);
+    header->header_crc = mc_crc32(0, header, offsetof(mc_result_header_t, header_crc));
+
+    int ok = fwrite(header, sizeof(*header), 1, fp) == 1 &&
+             (count == 0 || fwrite(entries, entry_size, count, fp) == count);
+    return ok ? 0 : -1;
+}
+
+// Does the buffer start like a binary result? (The text outputs start with
+// a letter or a digit, so the first four bytes tell the formats apart.)
+static inline int mc_result_is_binary(const void *data, size_t size) {
+    uint32_t magic;
+    if (size < sizeof(magic)) return 0;
+    memcpy(&magic, data, sizeof(magic));
+    return magic == MC_RESULT_MAGIC ||
+           magic == (((MC_RESULT_MAGIC & 0xFFu) << 24) | ((MC_RESULT_MAGIC & 0xFF00u) << 8) |
+                     ((MC_RESULT_MAGIC >> 8) & 0xFF00u) | (MC_RESULT_MAGIC >> 24));
+}
+
+// Read the whole file at 'path' with one fread into a malloc'ed buffer
+// (8-byte aligned, so a record can be used in place). Returns the buffer,
+// to be freed by the caller, and its size in *size, or NULL.
+static inline void *mc_result_load(const char *path, size_t *size) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+
+    void *data = NULL;
+    long length = -1;
+    if (fseek(fp, 0, SEEK_END) == 0) length = ftell(fp);
+    if (length >= 0 && fseek(fp, 0, SEEK_SET) == 0) {
+        data = malloc(length > 0 ? (size_t)length : 1);
+        if (data && fread(data, 1, (size_t)length, fp) != (size_t)length) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(fp);
+
+    *size = (size_t)length;
+    return data;
+}
+
+// Verify a binary result of 'size' bytes at 'base' (8-byte aligned), written
+// by app 'app_id' with entries of 'entry_size' bytes, and point *entries at
+// its entries. Returns NULL on success or a description of the problem.
+static inline const char *mc_result_open(const void *base, size_t size, uint32_t app_id,
+                                         size_t entry_size, const void **entries) {
+    const mc_result_header_t *h = (const mc_result_header_t *)base;
+
+    if (size < sizeof(mc_result_header_t)) return "file is shorter than the header";
+    if (h->magic != MC_RESULT_MAGIC) {
+        return mc_result_is_binary(base, size) ? "byte order of the client is not supported"
+                                               : "bad magic number";
+    }
+    if (h->header_crc != mc_crc32(0, h, offsetof(mc_result_header_t, header_crc))) {
+        return "header checksum mismatch";
+    }
+    if (h->format != MC_RESULT_FORMAT) return "unsupported format version";
+    if (h->app_id != app_id) return "result of another application";
+    if (h->entry_size != entry_size) return "unexpected entry size";
+    if (h->count > (size - sizeof(mc_result_header_t)) / entry_size ||
+        size != sizeof(mc_result_header_t) + h->count * entry_size) {
+        return "file size does not match the header";
+    }
+
+    *entries = (const char *)base + sizeof(mc_result_header_t);
+    if (h->entries_crc != mc_crc32(0, *entries, h->count * entry_size)) {
+        return "checksum mismatch";
+    }
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * mc_rng.h
+ *
+ * Counter-based random number generator for the Monte Carlo applications
+ *
+ * Implements Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy
+ * as 1, 2, 3", SC'11). Each output block is a pure function of a 64-bit seed,
+ * a 64-bit stream id and a 64-bit block counter, so:
+ * - Any position of any stream can be reached in O(1) (mc_rng_seek)
+ * - Independent streams need no shared state (one per thread, walk, ...)
+ * - A checkpoint only has to store the seed and a counter
+ *
+ * Header-only so it can be used from both the C and C++ applications.
+ *
+ * Licensed under GPL v3
+ */
+
+#ifndef MC_RNG_H
+#define MC_RNG_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define MC_PHILOX_M0 0xD2511F53u
+#define MC_PHILOX_M1 0xCD9E8D57u
+#define MC_PHILOX_W0 0x9E3779B9u
+#define MC_PHILOX_W1 0xBB67AE85u
+
+typedef struct {
+    uint32_t key[2];    // Derived from the seed
+    uint64_t stream;    // Stream id (counter words 2-3)
+    uint64_t block;     // Next block to generate (counter words 0-1)
+    uint32_t buf[4];    // Outputs of the current block
+    int pos;            // Next unused word of buf (4 = empty)
+} mc_rng_t;
+
+// One Philox4x32 round
+static inline void mc_philox_round(uint32_t ctr[4], const uint32_t key[2]) {
+    uint64_t p0 = (uint64_t)MC_PHILOX_M0 * ctr[0];
+    uint64_t p1 = (uint64_t)MC_PHILOX_M1 * ctr[2];
+    uint32_t c1 = ctr[1];
+    uint32_t c3 = ctr[3];
+
+    ctr[0] = (uint32_t)(p1 >> 32) ^ c1 ^ key[0];
+    ctr[1] = (uint32_t)p1;
+    ctr[2] = (uint32_t)(p0 >> 32) ^ c3 ^ key[1];
+    ctr[3] = (uint32_t)p0;
+}
+
+// Philox4x32-10 bijection: out = philox(ctr, key)
+static inline void mc_philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4]) {
+    uint32_t c[4] = { ctr[0], ctr[1], ctr[2], ctr[3] };
+    uint32_t k[2] = { key[0], key[1] };
+
+    for (int round = 0; round < 10; round++) {
+        if (round > 0) {
+            k[0] += MC_PHILOX_W0;
+            k[1] += MC_PHILOX_W1;
+        }
+        mc_philox_round(c, k);
+    }
+
+    out[0] = c[0];
+    out[1] = c[1];
+    out[2] = c[2];
+    out[3] = c[3];
+}
+
+// Generate block number 'block' of stream 'stream' directly (no state)
+static inline void mc_rng_block(const uint32_t key[2], uint64_t stream, uint64_t block,
+                                uint32_t out[4]) {
+    uint32_t ctr[4] = {
+        (uint32_t)block, (uint32_t)(block >> 32),
+        (uint32_t)stream, (uint32_t)(stream >> 32)
+    };
+    mc_philox4x32(ctr, key, out);
+}
+
+// Map 64 random bits to a double in [0, 1) with 52 bits of resolution.
+// Uses the exponent trick (no integer-to-float conversion), so SIMD
+// kernels can reproduce the exact same values.
+static inline double mc_rng_u64_to_double(uint64_t u) {
+    uint64_t bits = (u >> 12) | 0x3FF0000000000000ULL;
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d - 1.0;
+}
+
+// Initialize a generator at block 0 of the given stream
+static inline void mc_rng_init(mc_rng_t *rng, uint64_t seed, uint64_t stream) {
+    rng->key[0] = (uint32_t)seed;
+    rng->key[1] = (uint32_t)(seed >> 32);
+    rng->stream = stream;
+    rng->block = 0;
+    rng->pos = 4;
+}
+
+// Jump to the start of an arbitrary block of the current stream
+static inline void mc_rng_seek(mc_rng_t *rng, uint64_t block) {
+    rng->block = block;
+    rng->pos = 4;
+}
+
+static inline uint32_t mc_rng_next_u32(mc_rng_t *rng) {
+    if (rng->pos == 4) {
+        mc_rng_block(rng->key, rng->stream, rng->block++, rng->buf);
+        rng->pos = 0;
+    }
+    return rng->buf[rng->pos++];
+}
+
+static inline uint64_t mc_rng_next_u64(mc_rng_t *rng) {
+    uint64_t lo = mc_rng_next_u32(rng);
+    uint64_t hi = mc_rng_next_u32(rng);
+    return lo | (hi << 32);
+}
+
+// Random double in [0, 1)
+static inline double mc_rng_next_double(mc_rng_t *rng) {
+    return mc_rng_u64_to_double(mc_rng_next_u64(rng));
+}
+
+// Antithetic partner of a value from mc_rng_next_double(): u -> 1 - u,
+// mapped onto the same grid of [0, 1) (exact, and never 1.0)
+static inline double mc_rng_reflect(double u) {
+    return (1.0 - 0x1p-52) - u;
+}
+
+#endif
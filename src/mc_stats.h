@@ -0,0 +1,67 @@
+/*
+ * mc_stats.h
+ *
+ * Running mean and variance of Monte Carlo samples (Welford's method)
+ *
+ * mc_stats_add() folds in one sample without keeping the samples or a
+ * sum of squares, which would lose all precision once the mean is large
+ * compared to the spread. mc_stats_merge() combines two sets of samples
+ * (Chan et al.), so per-thread or per-task statistics can be added to a
+ * running total in a fixed order and give the same result every time.
+ *
+ * Header-only, like the other mc_*.h modules.
+ *
+ * Licensed under GPL v3
+ */
+
+#ifndef MC_STATS_H
+#define MC_STATS_H
+
+#include <math.h>
+#include <stdint.h>
+
+typedef struct {
+    int64_t count;              // Number of samples
+    double mean;                // Their mean
+    double m2;                  // Sum of squared deviations from the mean
+} mc_stats_t;
+
+static inline void mc_stats_init(mc_stats_t *s) {
+    s->count = 0;
+    s->mean = 0.0;
+    s->m2 = 0.0;
+}
+
+static inline void mc_stats_add(mc_stats_t *s, double x) {
+    s->count++;
+    double delta = x - s->mean;
+    s->mean += delta / (double)s->count;
+    s->m2 += delta * (x - s->mean);
+}
+
+// s = s combined with the samples of 'other'
+static inline void mc_stats_merge(mc_stats_t *s, const mc_stats_t *other) {
+    if (other->count == 0) return;
+    if (s->count == 0) {
+        *s = *other;
+        return;
+    }
+
+    int64_t count = s->count + other->count;
+    double delta = other->mean - s->mean;
+    s->mean += delta * ((double)other->count / (double)count);
+    s->m2 += other->m2 + delta * delta * ((double)s->count * (double)other->count / (double)count);
+    s->count = count;
+}
+
+// Sample variance (0 with fewer than two samples)
+static inline double mc_stats_variance(const mc_stats_t *s) {
+    return s->count > 1 ? s->m2 / (double)(s->count - 1) : 0.0;
+}
+
+// Standard error of the mean
+static inline double mc_stats_std_error(const mc_stats_t *s) {
+    return s->count > 1 ? sqrt(mc_stats_variance(s) / (double)s->count) : 0.0;
+}
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * mc_telemetry.h
+ *
+ * Run-time counters of the Monte Carlo apps and the trailer they are
+ * reported in
+ *
+ * The apps time their phases (reading the input, setting up, computing,
+ * verifying, writing the output) and their checkpoint writes, count the
+ * samples and walk transitions they computed and keep a histogram of the
+ * walk lengths. All of it is plain additions to per-task or per-phase
+ * counters, cheap enough to stay on in production. At the end of a run
+ * mc_telemetry_write() prints the counters to stderr, which BOINC returns
+ * as the result's stderr.txt (result.stderr_out on the server):
+ *
+ *   telemetry version 1 app axb_montecarlo threads 4
+ *   telemetry phases read 0.512 setup 0.094 compute 61.203 verify 0.000 output 0.001 total 61.810
+ *   telemetry checkpoints 1 total 0.002 max 0.002
+ *   telemetry samples 1000000 per_sec 16339.1
+ *   telemetry transitions 8123456 per_sec 132730.0
+ *   telemetry walk_length_log2 0 12 410 ...
+ *
+ * One "telemetry <key> ..." line per group, so the server (server/
+ * telemetry.h, scripts/check_results.sh) can pick them out with a single
+ * pattern. Bin k of walk_length_log2 counts the walks that visited
+ * [2^k, 2^(k+1)) states. The counters describe this run of the process
+ * only: work done before a restart from a checkpoint is not included.
+ *
+ * Header-only and valid C and C++: used by pi_compute.cpp and
+ * Axb-MonteCarlo.c.
+ *
+ * Licensed under GPL v3
+ */
+
+#ifndef MC_TELEMETRY_H
+#define MC_TELEMETRY_H
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define MC_TELEMETRY_VERSION 1
+#define MC_TELEMETRY_BINS 16        // Walk length bins, up to 2^16 - 1 states
+
+// Phases of a run, in order
+enum {
+    MC_PHASE_READ,                  // Input parsing
+    MC_PHASE_SETUP,                 // Preparing the computation
+    MC_PHASE_COMPUTE,
+    MC_PHASE_VERIFY,
+    MC_PHASE_OUTPUT,
+    MC_NUM_PHASES
+};
+
+static const char *const mc_phase_names[MC_NUM_PHASES] = {
+    "read", "setup", "compute", "verify", "output"
+};
+
+// Walk counters of one task, merged into the run's with mc_walks_merge()
+typedef struct {
+    long long transitions;          // Moves between states
+    long long length_hist[MC_TELEMETRY_BINS];
+} mc_walks_t;
+
+typedef struct {
+    double phase_seconds[MC_NUM_PHASES];
+    long checkpoints;               // Checkpoints written
+    double checkpoint_seconds;      // Total time spent writing them
+    double checkpoint_max;          // Slowest checkpoint write
+    long long samples;              // Walks, or pi samples
+    int threads;
+    mc_walks_t walks;               // Not reported if no walk was counted
+} mc_telemetry_t;
+
+// Monotonic wall clock in seconds
+static inline double mc_telemetry_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline void mc_telemetry_init(mc_telemetry_t *t, int threads) {
+    memset(t, 0, sizeof(*t));
+    t->threads = threads;
+}
+
+// Add the time since 'start' (from mc_telemetry_now()) to a phase
+static inline void mc_telemetry_phase(mc_telemetry_t *t, int phase, double start) {
+    t->phase_seconds[phase] += mc_telemetry_now() - start;
+}
+
+// Record a checkpoint write that took 'seconds'
+static inline void mc_telemetry_checkpoint(mc_telemetry_t *t, double seconds) {
+    t->checkpoints++;
+    t->checkpoint_seconds += seconds;
+    if (seconds > t->checkpoint_max) t->checkpoint_max = seconds;
+}
+
+static inline void mc_walks_init(mc_walks_t *w) {
+    memset(w, 0, sizeof(*w));
+}
+
+// Count a walk that visited 'length' (>= 1) states
+static inline void mc_walks_add(mc_walks_t *w, int length) {
+    int bin = 31 - __builtin_clz((unsigned)length);
+    if (bin >= MC_TELEMETRY_BINS) bin = MC_TELEMETRY_BINS - 1;
+    w->length_hist[bin]++;
+    w->transitions += length - 1;
+}
+
+static inline void mc_walks_merge(mc_walks_t *w, const mc_walks_t *other) {
+    w->transitions += other->transitions;
+    for (int k = 0; k < MC_TELEMETRY_BINS; k++) {
+        w->length_hist[k] += other->length_hist[k];
+    }
+}
+
+// Print the trailer described above for app 'app'
+static inline void mc_telemetry_write(FILE *fp, const mc_telemetry_t *t, const char *app) {
+    double total = 0.0;
+    double compute = t->phase_seconds[MC_PHASE_COMPUTE];
+    long long walks = 0;
+
+    for (int k = 0; k < MC_TELEMETRY_BINS; k++) {
+        walks += t->walks.length_hist[k];
+    }
+
+    fprintf(fp, "telemetry version %d app %s threads %d\n", MC_TELEMETRY_VERSION, app, t->threads);
+    fprintf(fp, "telemetry phases");
+    for (int p = 0; p < MC_NUM_PHASES; p++) {
+        fprintf(fp, " %s %.3f", mc_phase_names[p], t->phase_seconds[p]);
+        total += t->phase_seconds[p];
+    }
+    fprintf(fp, " total %.3f\n", total);
+    fprintf(fp, "telemetry checkpoints %ld total %.3f max %.3f\n",
+            t->checkpoints, t->checkpoint_seconds, t->checkpoint_max);
+    fprintf(fp, "telemetry samples %lld per_sec %.1f\n",
+            t->samples, compute > 0 ? t->samples / compute : 0.0);
+    if (walks > 0) {
+        fprintf(fp, "telemetry transitions %lld per_sec %.1f\n",
+                t->walks.transitions, compute > 0 ? t->walks.transitions / compute : 0.0);
+        fprintf(fp, "telemetry walk_length_log2");
+        for (int k = 0; k < MC_TELEMETRY_BINS; k++) {
+            fprintf(fp, " %lld", t->walks.length_hist[k]);
+        }
+        fprintf(fp, "\n");
+    }
+    fflush(fp);
+}
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * mc_walk.h
+ *
+ * The random walk of the Ax=b solver
+ *
+ * A walk for x = Cx + f starts at state i with weight 1, adds
+ * weight * f[state] at every state it visits and stops there with
+ * probability absorb[state]. Otherwise it moves to the next state through
+ * the row's alias table (mc_alias.h), which also gives the factor the
+ * weight is multiplied by. The expected sum of a walk from i is x[i].
+ *
+ * Header-only, so the client (Axb-MonteCarlo.c) and the benchmark driver
+ * (mc_bench.cpp) run the same loop.
+ *
+ * Licensed under GPL v3
+ */
+
+#ifndef MC_WALK_H
+#define MC_WALK_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "mc_rng.h"
+#include "mc_alias.h"
+#include "mc_csr.h"
+
+#define MC_WALK_MAX_STEPS 10000     // Upper bound on the length of a walk
+
+// What a walk reads: C's row structure, its transition tables, f and the
+// per-row absorption probabilities
+typedef struct {
+    const int64_t *row_ptr;         // Row i's transitions are alias[row_ptr[i] .. row_ptr[i+1])
+    const mc_alias_slot_t *alias;
+    const double *f;
+    const double *row_sum;          // Sum of |C_ij| for each row
+    const double *absorb;
+} mc_walk_t;
+
+// Fill alias[0 .. C->nnz) with the transition tables of C: row i leaves
+// for column j with probability |C_ij| / row_sum[i], scaling the weight
+// by sign(C_ij) * row_sum[i] / (1 - absorb[i]).
+// Returns 0 on success, -1 if memory is exhausted.
+static inline int mc_walk_build_tables(const mc_csr_t *C, const double *row_sum,
+                                       const double *absorb, mc_alias_slot_t *alias) {
+    int retval = 0;
+    double *weight = (double *)malloc((C->nnz > 0 ? (size_t)C->nnz : 1) * sizeof(double));
+    double *mult = (double *)malloc((C->nnz > 0 ? (size_t)C->nnz : 1) * sizeof(double));
+
+    if (!weight || !mult) {
+        retval = -1;
+    }
+
+    for (int i = 0; i < C->n && retval == 0; i++) {
+        int64_t first = C->row_ptr[i];
+        int m = (int)(C->row_ptr[i + 1] - first);
+        double scale = row_sum[i] / (1.0 - absorb[i]);
+
+        for (int64_t k = first; k < first + m; k++) {
+            weight[k] = fabs(C->val[k]);
+            mult[k] = (C->val[k] > 0) ? scale : -scale;
+        }
+
+        retval = mc_alias_build(alias + first, m, weight + first, C->col + first, mult + first);
+    }
+
+    free(weight);
+    free(mult);
+    return retval;
+}
+
+// Next uniform of a walk, reflected for the antithetic twin
+static inline double mc_walk_uniform(mc_rng_t *rng, int reflect) {
+    double u = mc_rng_next_double(rng);
+    return reflect ? mc_rng_reflect(u) : u;
+}
+
+// Perform one random walk starting from state i ('reflect': the antithetic
+// twin of the walk of this stream). Returns the sum accumulated along the
+// walk; if 'length' is not NULL it receives the number of states visited.
+static inline double mc_walk_run(const mc_walk_t *w, int start_state, mc_rng_t *rng,
+                                 int reflect, int *length) {
+    double sum = 0.0;
+    int current_state = start_state;
+    double weight = 1.0;
+    int step;
+
+    for (step = 0; step < MC_WALK_MAX_STEPS; step++) {
+        // Add contribution from current state
+        sum += weight * w->f[current_state];
+
+        // Terminate with some probability
+        if (mc_walk_uniform(rng, reflect) < w->absorb[current_state]) {
+            break;
+        }
+
+        // Choose next state based on transition probabilities
+        // P(i -> j) = |C_ij| / sum_k |C_ik|, sampled from the row's alias table
+        int64_t first = w->row_ptr[current_state];
+        int m = (int)(w->row_ptr[current_state + 1] - first);
+        if (m == 0 || w->row_sum[current_state] < 1e-12) {
+            break;  // No transitions available
+        }
+
+        double u1 = mc_walk_uniform(rng, reflect);
+        double u2 = mc_walk_uniform(rng, reflect);
+        double mult;
+        current_state = mc_alias_sample(w->alias + first, m, u1, u2, &mult);
+
+        // Update weight with sign of C_ij and normalization
+        weight *= mult;
+    }
+
+    if (length) {
+        *length = step < MC_WALK_MAX_STEPS ? step + 1 : step;
+    }
+    return sum;
+}
+
+#endif
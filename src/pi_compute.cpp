@@ -15,6 +15,12 @@
  * - Progress reporting
  * - Checkpointing for fault tolerance
  * - Fraction done updates
+ * - Multithreaded computation (multi-core plan class)
+ * - SIMD kernels selected at run time (see pi_kernels.cpp)
+ * - A GPU app version counting on an OpenCL device (see mc_opencl.h)
+ * - Performance counters reported in stderr.txt (see mc_telemetry.h)
+ * - Batches of independent experiments in one work unit (read_input_file())
+ * - An optional binary result record with checksums (see mc_result.h)
  */
 
 #include <cstdio>
@@ -24,26 +30,92 @@
 #include <cstring>
 #include <sys/time.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <vector>
 #include "boinc_api.h"
 #include "filesys.h"
 #include "util.h"
+#include "mc_rng.h"
+#include "mc_checkpoint.h"
+#include "mc_result.h"
+#include "mc_telemetry.h"
+#include "pi_kernels.h"
+
+// One experiment of a work unit: an independent estimate from its own seed
+struct EXPERIMENT {
+    long long iterations;
+    long long points_in_circle;     // Known once the experiment is finished
+    unsigned long long seed;        // 0 in the input: chosen by the app
+};
 
 // Structure to hold our checkpoint data
+//
+// Sample i always uses Philox block i of stream 0, so the seed and the
+// number of completed iterations fully describe the generator state.
+// These are the fields of the experiment in progress; the checkpoint
+// follows them with the EXPERIMENT records of the whole batch (seeds, and
+// the counts of the experiments before 'experiment').
 struct CHECKPOINT_DATA {
     long long iterations_completed;
     long long points_in_circle;
-    unsigned int random_seed;
+    unsigned long long random_seed;
+    long long experiment;           // Experiment in progress
+    long long num_experiments;
+};
+
+// Largest batch of experiments in one work unit
+#define MAX_EXPERIMENTS 65536
+
+// Upper bound on the number of worker threads
+#define MAX_THREADS 256
+
+// Rounds (samples between two BOINC polls) are sized from the measured
+// sample rate so that each one takes about ROUND_SECONDS of wall time
+#define ROUND_SECONDS 0.5
+#define INITIAL_ROUND_SAMPLES 1000000LL     // Per worker, before any measurement
+#define MIN_ROUND_SAMPLES 65536LL
+#define MAX_ROUND_SAMPLES 4000000000LL
+
+// Work slice and accumulator of one worker thread.
+// Aligned to a cache line so the workers never write to a shared line.
+struct alignas(64) WORKER_DATA {
+    unsigned long long seed;
+    long long begin;              // First sample index (inclusive)
+    long long end;                // Last sample index (exclusive)
+    long long points_in_circle;   // Hits found in [begin, end)
+    pthread_t thread;
+    bool running;                 // Thread started and must be joined
 };
 
 // Global variables
 CHECKPOINT_DATA checkpoint_data;
-long long total_iterations = 0;
+std::vector<EXPERIMENT> experiments;
+long long total_iterations = 0;         // Of the experiment in progress
+long long batch_iterations = 0;         // Of all experiments
+long long batch_iterations_done = 0;    // Of the finished experiments
+long long round_samples = INITIAL_ROUND_SAMPLES;   // Per worker, kept across experiments
+WORKER_DATA workers[MAX_THREADS];
+const PI_KERNEL* pi_kernel = NULL;
+mc_telemetry_t telemetry;
+bool binary_output = false;             // "--binary_output": write an mc_result.h record
 
 // Function to read input file
-int read_input_file(const char* filename, long long& iterations) {
+//
+// The input is either one iteration count, for a single experiment, or a
+// batch of independent experiments run one after the other:
+//
+//   batch <count>
+//   <iterations> [<seed>]        one line per experiment
+//
+// An experiment without a seed (or with seed 0) gets a random one. Many
+// short experiments in one work unit pay the BOINC start-up, download and
+// validation costs once.
+int read_input_file(const char* filename, std::vector<EXPERIMENT>& batch) {
     FILE* infile;
     int retval;
     char input_path[512];
+    char token[64];
+    char line[256];
 
     // Resolve the logical filename to physical path
     retval = boinc_resolve_filename(filename, input_path, sizeof(input_path));
@@ -58,23 +130,114 @@ int read_input_file(const char* filename, long long& iterations) {
         return -1;
     }
 
-    // Read the number of iterations from the input file
-    if (fscanf(infile, "%lld", &iterations) != 1) {
+    batch.clear();
+    if (fscanf(infile, "%63s", token) != 1) {
         fprintf(stderr, "APP: error reading iterations from input file\n");
         fclose(infile);
         return -1;
     }
 
+    if (strcmp(token, "batch") == 0) {
+        long long count;
+        if (fscanf(infile, "%lld", &count) != 1 || count < 1 || count > MAX_EXPERIMENTS) {
+            fprintf(stderr, "APP: batch size must be 1 to %d\n", MAX_EXPERIMENTS);
+            fclose(infile);
+            return -1;
+        }
+        while ((long long)batch.size() < count && fgets(line, sizeof(line), infile)) {
+            EXPERIMENT e = { 0, 0, 0 };
+            int fields = sscanf(line, "%lld %llu", &e.iterations, &e.seed);
+            if (fields < 1) continue;   // Blank line
+            if (e.iterations <= 0) {
+                fprintf(stderr, "APP: experiment %zu has no iterations\n", batch.size());
+                fclose(infile);
+                return -1;
+            }
+            batch.push_back(e);
+        }
+        if ((long long)batch.size() < count) {
+            fprintf(stderr, "APP: input file has %zu of %lld experiments\n", batch.size(), count);
+            fclose(infile);
+            return -1;
+        }
+    } else {
+        EXPERIMENT e = { 0, 0, 0 };
+        char* end;
+        e.iterations = strtoll(token, &end, 10);
+        if (*end != '\0' || e.iterations <= 0) {
+            fprintf(stderr, "APP: error reading iterations from input file\n");
+            fclose(infile);
+            return -1;
+        }
+        batch.push_back(e);
+    }
+
     fclose(infile);
-    fprintf(stderr, "APP: input file read successfully. Iterations: %lld\n", iterations);
+    if (batch.size() == 1) {
+        fprintf(stderr, "APP: input file read successfully. Iterations: %lld\n",
+                batch[0].iterations);
+    } else {
+        fprintf(stderr, "APP: input file read successfully. %zu experiments\n", batch.size());
+    }
+    return 0;
+}
+
+// Write the output as a binary result record (mc_result.h)
+int write_binary_output(const char* output_path, const std::vector<EXPERIMENT>& batch) {
+    std::vector<mc_result_pi_t> entries(batch.size());
+    mc_result_header_t header;
+
+    memset(&header, 0, sizeof(header));
+    header.start_idx = 0;
+    header.end_idx = (int64_t)batch.size() - 1;
+    header.seed = batch[0].seed;
+    for (size_t k = 0; k < batch.size(); k++) {
+        double p = (double)batch[k].points_in_circle / batch[k].iterations;
+        entries[k].hits = batch[k].points_in_circle;
+        entries[k].iterations = batch[k].iterations;
+        entries[k].seed = batch[k].seed;
+        entries[k].pi = 4.0 * batch[k].points_in_circle / batch[k].iterations;
+        entries[k].std_error = 4.0 * sqrt(p * (1.0 - p) / batch[k].iterations);
+        header.num_walks += batch[k].iterations;
+    }
+
+    FILE* outfile = boinc_fopen(output_path, "wb");
+    if (!outfile) {
+        fprintf(stderr, "APP: error opening output file %s\n", output_path);
+        return -1;
+    }
+
+    int retval = mc_result_write(outfile, MC_RESULT_APP_PI, &header, entries.data(),
+                                 sizeof(mc_result_pi_t), entries.size());
+    if (fclose(outfile) != 0 || retval != 0) {
+        fprintf(stderr, "APP: error writing output file %s\n", output_path);
+        return -1;
+    }
+    fprintf(stderr, "APP: binary output file written successfully\n");
     return 0;
 }
 
 // Function to write output file
-int write_output_file(const char* filename, double pi_estimate, long long iterations) {
+// The last line repeats the raw counters as "counts <points_in_circle>
+// <iterations> <seed>", so the server can pool the hits of all replicas
+// into one estimate (server/pi_result.h). A batch reports the totals of
+// all its experiments there (with the seed of the first one), preceded
+// by one "experiment <index> <points_in_circle> <iterations> <seed>" line
+// per experiment.
+//
+// With --binary_output the same numbers go into one mc_result.h record
+// instead, one mc_result_pi_t per experiment (write_binary_output()).
+int write_output_file(const char* filename, const std::vector<EXPERIMENT>& batch) {
     FILE* outfile;
     int retval;
     char output_path[512];
+    long long iterations = 0, points_in_circle = 0;
+
+    for (const EXPERIMENT& e : batch) {
+        iterations += e.iterations;
+        points_in_circle += e.points_in_circle;
+    }
+    double pi_estimate = 4.0 * points_in_circle / iterations;
 
     // Resolve the logical filename to physical path
     retval = boinc_resolve_filename(filename, output_path, sizeof(output_path));
@@ -83,6 +246,10 @@ int write_output_file(const char* filename, double pi_estimate, long long iterat
         return retval;
     }
 
+    if (binary_output) {
+        return write_binary_output(output_path, batch);
+    }
+
     outfile = boinc_fopen(output_path, "w");
     if (!outfile) {
         fprintf(stderr, "APP: error opening output file %s\n", output_path);
@@ -92,19 +259,32 @@ int write_output_file(const char* filename, double pi_estimate, long long iterat
     // Write results
     fprintf(outfile, "PI Computation Results\n");
     fprintf(outfile, "======================\n");
+    if (batch.size() > 1) {
+        fprintf(outfile, "Experiments: %zu\n", batch.size());
+    }
     fprintf(outfile, "Total iterations: %lld\n", iterations);
+    fprintf(outfile, "Points in circle: %lld\n", points_in_circle);
     fprintf(outfile, "Estimated value of PI: %.15f\n", pi_estimate);
     fprintf(outfile, "Error from actual PI: %.15f\n", fabs(pi_estimate - M_PI));
     fprintf(outfile, "Accuracy: %.10f%%\n", 100.0 * (1.0 - fabs(pi_estimate - M_PI) / M_PI));
+    if (batch.size() > 1) {
+        for (size_t k = 0; k < batch.size(); k++) {
+            fprintf(outfile, "experiment %zu %lld %lld %llu\n", k, batch[k].points_in_circle,
+                    batch[k].iterations, batch[k].seed);
+        }
+    }
+    fprintf(outfile, "counts %lld %lld %llu\n", points_in_circle, iterations, batch[0].seed);
 
     fclose(outfile);
     fprintf(stderr, "APP: output file written successfully\n");
     return 0;
 }
 
+// Checkpoint payload layout version (bump when CHECKPOINT_DATA changes)
+#define PI_CHECKPOINT_VERSION 2
+
 // Function to write checkpoint file
 int write_checkpoint(const char* filename, const CHECKPOINT_DATA& data) {
-    FILE* checkpoint_file;
     int retval;
     char checkpoint_path[512];
 
@@ -114,24 +294,26 @@ int write_checkpoint(const char* filename, const CHECKPOINT_DATA& data) {
         return retval;
     }
 
-    checkpoint_file = boinc_fopen(checkpoint_path, "w");
-    if (!checkpoint_file) {
-        fprintf(stderr, "APP: error opening checkpoint file for writing\n");
+    // The experiment in progress, then the whole batch
+    std::vector<unsigned char> payload(sizeof(data) + experiments.size() * sizeof(EXPERIMENT));
+    memcpy(payload.data(), &data, sizeof(data));
+    memcpy(payload.data() + sizeof(data), experiments.data(),
+           experiments.size() * sizeof(EXPERIMENT));
+
+    // Written to a temporary file and renamed into place (see mc_checkpoint.h)
+    if (mc_checkpoint_write(checkpoint_path, MC_CHECKPOINT_APP_PI, PI_CHECKPOINT_VERSION,
+                            payload.data(), payload.size()) != 0) {
+        fprintf(stderr, "APP: error writing checkpoint file\n");
         return -1;
     }
 
-    fprintf(checkpoint_file, "%lld %lld %u\n",
-            data.iterations_completed,
-            data.points_in_circle,
-            data.random_seed);
-
-    fclose(checkpoint_file);
     return 0;
 }
 
 // Function to read checkpoint file
+// Restores 'data' and the seeds and finished counts of 'experiments'
+// (already read from the input, which the checkpoint must match).
 int read_checkpoint(const char* filename, CHECKPOINT_DATA& data) {
-    FILE* checkpoint_file;
     int retval;
     char checkpoint_path[512];
 
@@ -141,122 +323,324 @@ int read_checkpoint(const char* filename, CHECKPOINT_DATA& data) {
         return -1;
     }
 
-    checkpoint_file = boinc_fopen(checkpoint_path, "r");
-    if (!checkpoint_file) {
-        // Checkpoint file doesn't exist, start from beginning
+    // Missing, corrupt or incompatible checkpoints are all rejected here
+    size_t n = experiments.size();
+    std::vector<unsigned char> payload(sizeof(CHECKPOINT_DATA) + n * sizeof(EXPERIMENT));
+    size_t size = payload.size();
+    if (mc_checkpoint_read(checkpoint_path, MC_CHECKPOINT_APP_PI, PI_CHECKPOINT_VERSION,
+                           payload.data(), payload.size(), &size) != 0) {
         return -1;
     }
 
-    if (fscanf(checkpoint_file, "%lld %lld %u",
-               &data.iterations_completed,
-               &data.points_in_circle,
-               &data.random_seed) != 3) {
-        fprintf(stderr, "APP: error reading checkpoint file\n");
-        fclose(checkpoint_file);
+    CHECKPOINT_DATA saved;
+    std::vector<EXPERIMENT> batch(n);
+    memcpy(&saved, payload.data(), sizeof(saved));
+    memcpy(batch.data(), payload.data() + sizeof(saved), n * sizeof(EXPERIMENT));
+
+    bool matches = size == payload.size() && saved.num_experiments == (long long)n &&
+                   saved.experiment >= 0 && saved.experiment < (long long)n;
+    for (size_t k = 0; matches && k < n; k++) {
+        matches = batch[k].iterations == experiments[k].iterations &&
+                  (experiments[k].seed == 0 || batch[k].seed == experiments[k].seed) &&
+                  ((long long)k >= saved.experiment ||
+                   (batch[k].points_in_circle >= 0 &&
+                    batch[k].points_in_circle <= batch[k].iterations));
+    }
+    if (matches) {
+        const EXPERIMENT& current = batch[saved.experiment];
+        matches = saved.random_seed == current.seed && saved.iterations_completed >= 0 &&
+                  saved.iterations_completed <= current.iterations &&
+                  saved.points_in_circle >= 0 &&
+                  saved.points_in_circle <= saved.iterations_completed;
+    }
+    if (!matches) {
+        fprintf(stderr, "APP: checkpoint does not match this work unit, ignoring it\n");
         return -1;
     }
 
-    fclose(checkpoint_file);
-    fprintf(stderr, "APP: checkpoint read successfully. Resuming from iteration %lld\n",
+    data = saved;
+    experiments = batch;
+    fprintf(stderr, "APP: checkpoint read successfully. Resuming from iteration %lld",
             data.iterations_completed);
+    if (n > 1) {
+        fprintf(stderr, " of experiment %lld", data.experiment);
+    }
+    fprintf(stderr, "\n");
     return 0;
 }
 
-// Main computation function - Monte Carlo PI estimation
-int compute_pi() {
-    int retval;
+// A random seed from /dev/urandom, else from the time, the PID and 'salt'
+unsigned long long random_seed(unsigned long long salt) {
+    unsigned long long seed = 0;
 
-    // Read input file to get number of iterations
-    retval = read_input_file("in", total_iterations);
-    if (retval) {
-        return retval;
+    // Use /dev/urandom for truly random seed
+    FILE* urandom = fopen("/dev/urandom", "rb");
+    if (urandom) {
+        if (fread(&seed, sizeof(seed), 1, urandom) != 1) {
+            fprintf(stderr, "APP: warning - failed to read from /dev/urandom, using fallback\n");
+            seed = 0;
+        }
+        fclose(urandom);
+    } else {
+        fprintf(stderr, "APP: warning - cannot open /dev/urandom, using fallback\n");
     }
 
-    // Try to read checkpoint file
-    if (read_checkpoint("checkpoint.txt", checkpoint_data) != 0) {
-        // No checkpoint found, initialize from scratch
-        checkpoint_data.iterations_completed = 0;
-        checkpoint_data.points_in_circle = 0;
+    if (seed == 0) {
+        // Fallback to time + PID if /dev/urandom fails; the salt keeps the
+        // experiments of one batch apart
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        seed = (unsigned long long)(tv.tv_sec * 1000000 + tv.tv_usec) ^
+            ((unsigned long long)getpid() << 40) ^ (salt * 0x9E3779B97F4A7C15ULL);
+    }
+    return seed;
+}
 
-        // Use /dev/urandom for truly random seed
-        FILE* urandom = fopen("/dev/urandom", "rb");
-        if (urandom) {
-            if (fread(&checkpoint_data.random_seed, sizeof(checkpoint_data.random_seed), 1, urandom) != 1) {
-                fprintf(stderr, "APP: warning - failed to read from /dev/urandom, using fallback\n");
-                // Fallback to time + PID if /dev/urandom fails
-                struct timeval tv;
-                gettimeofday(&tv, NULL);
-                checkpoint_data.random_seed = (unsigned int)(tv.tv_sec * 1000000 + tv.tv_usec + getpid());
-            }
-            fclose(urandom);
-        } else {
-            fprintf(stderr, "APP: warning - cannot open /dev/urandom, using fallback\n");
-            // Fallback to time + PID if /dev/urandom cannot be opened
-            struct timeval tv;
-            gettimeofday(&tv, NULL);
-            checkpoint_data.random_seed = (unsigned int)(tv.tv_sec * 1000000 + tv.tv_usec + getpid());
+// Return the value following a "--name value" command line option, or NULL
+const char* get_option(int argc, char** argv, const char* name) {
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            return argv[i + 1];
         }
+    }
+    return NULL;
+}
 
-        fprintf(stderr, "APP: starting computation from beginning with seed %u\n",
-                checkpoint_data.random_seed);
-    } else {
-        fprintf(stderr, "APP: resuming from checkpoint\n");
+// Determine the number of worker threads
+//
+// Priority: "--nthreads N" on the command line (set via <cmdline> in
+// app_config.xml or the app version), then the CPU count BOINC assigned
+// to this app version (avg_ncpus, reported as APP_INIT_DATA::ncpus), else 1.
+int get_num_threads(int argc, char** argv) {
+    int nthreads = 0;
+
+    const char* option = get_option(argc, argv, "--nthreads");
+    if (option) {
+        nthreads = atoi(option);
     }
 
-    // Initialize random number generator
-    srand(checkpoint_data.random_seed);
+    if (nthreads <= 0) {
+        APP_INIT_DATA aid;
+        boinc_get_init_data(aid);
+        if (aid.ncpus >= 1.0) {
+            nthreads = (int)aid.ncpus;
+        }
+    }
 
-    // Main computation loop
-    for (long long i = checkpoint_data.iterations_completed; i < total_iterations; i++) {
-        // Generate random point in unit square
-        double x = (double)rand() / RAND_MAX;
-        double y = (double)rand() / RAND_MAX;
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > MAX_THREADS) nthreads = MAX_THREADS;
+    return nthreads;
+}
 
-        // Check if point is inside quarter circle
-        if (x * x + y * y <= 1.0) {
-            checkpoint_data.points_in_circle++;
-        }
+// Count the samples in [begin, end) that fall inside the quarter circle.
+// Sample i is Philox block i, so the result does not depend on how the
+// sample range is split between threads or on which kernel is used.
+long long count_points_in_circle(unsigned long long seed, long long begin, long long end) {
+    mc_rng_t rng;
+    mc_rng_init(&rng, seed, 0);
+    return pi_kernel->count(rng.key, begin, end);
+}
+
+// Worker thread entry point
+void* worker_main(void* arg) {
+    WORKER_DATA* worker = (WORKER_DATA*)arg;
+    worker->points_in_circle = count_points_in_circle(worker->seed, worker->begin, worker->end);
+    return NULL;
+}
 
-        checkpoint_data.iterations_completed = i + 1;
+// Main loop
+//
+// The remaining samples are processed in rounds. Each round is split
+// evenly over the workers and runs without any BOINC calls; counters are
+// merged when the round ends, so checkpoint_data always describes a
+// contiguous prefix of the sample sequence and a checkpoint can be
+// resumed with any thread count. With one thread the round runs inline.
+//
+// Progress, suspend and checkpoint handling happen only between rounds.
+// The round size follows the measured samples/second, so slow hosts
+// still poll BOINC often and fast ones do not waste time polling.
+//
+// Runs the experiment in progress to completion; rounds never span two
+// experiments of a batch.
+int compute_pi_rounds(int nthreads) {
+    int retval;
+    long long samples_done = 0;
 
-        // Update progress and check for BOINC events every 100,000 iterations
-        if (i % 100000 == 0) {
-            double fraction_done = (double)i / total_iterations;
-            boinc_fraction_done(fraction_done);
+    while (checkpoint_data.iterations_completed < total_iterations) {
+        long long begin = checkpoint_data.iterations_completed;
+        long long round = round_samples * nthreads;
+        if (round > total_iterations - begin) {
+            round = total_iterations - begin;
+        }
 
-            // Allow BOINC to suspend/resume the application
-            boinc_sleep(0);
+        double round_start = dtime();
+
+        for (int t = 0; t < nthreads; t++) {
+            workers[t].seed = checkpoint_data.random_seed;
+            workers[t].begin = begin + round * t / nthreads;
+            workers[t].end = begin + round * (t + 1) / nthreads;
+            workers[t].points_in_circle = 0;
+            workers[t].running = false;
+
+            if (nthreads > 1) {
+                workers[t].running =
+                    (pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]) == 0);
+                if (!workers[t].running) {
+                    fprintf(stderr, "APP: pthread_create failed, running slice %d inline\n", t);
+                }
+            }
+            if (!workers[t].running) {
+                worker_main(&workers[t]);
+            }
         }
 
+        // Merge per-thread counters
+        for (int t = 0; t < nthreads; t++) {
+            if (workers[t].running) {
+                pthread_join(workers[t].thread, NULL);
+            }
+            checkpoint_data.points_in_circle += workers[t].points_in_circle;
+        }
+        checkpoint_data.iterations_completed = begin + round;
+        samples_done += round;
+
+        // Resize the next round from the rate measured on this one
+        double elapsed = dtime() - round_start;
+        if (elapsed > 0) {
+            double rate = round / elapsed;
+            round_samples = (long long)(rate * ROUND_SECONDS / nthreads);
+            if (round_samples < MIN_ROUND_SAMPLES) round_samples = MIN_ROUND_SAMPLES;
+            if (round_samples > MAX_ROUND_SAMPLES) round_samples = MAX_ROUND_SAMPLES;
+        }
+
+        // Update progress and check for BOINC events once per round
+        boinc_fraction_done((double)(batch_iterations_done + checkpoint_data.iterations_completed) /
+                            batch_iterations);
+
+        // Allow BOINC to suspend/resume the application
+        boinc_sleep(0);
+
         // Check if it's time to checkpoint
         if (boinc_time_to_checkpoint()) {
-            // Update random seed for next resume
-            checkpoint_data.random_seed = rand();
-
-            retval = write_checkpoint("checkpoint.txt", checkpoint_data);
+            double checkpoint_start = mc_telemetry_now();
+            retval = write_checkpoint("checkpoint.bin", checkpoint_data);
             if (retval) {
                 fprintf(stderr, "APP: checkpoint write failed\n");
                 return retval;
             }
+            mc_telemetry_checkpoint(&telemetry, mc_telemetry_now() - checkpoint_start);
 
             boinc_checkpoint_completed();
-            fprintf(stderr, "APP: checkpoint written at iteration %lld\n", i);
+            fprintf(stderr, "APP: checkpoint written at iteration %lld\n",
+                    checkpoint_data.iterations_completed);
         }
     }
 
+    telemetry.samples += samples_done;
+
+    return 0;
+}
+
+// Main computation function - Monte Carlo PI estimation
+int compute_pi(int nthreads) {
+    int retval;
+    double phase_start = mc_telemetry_now();
+
+    mc_telemetry_init(&telemetry, nthreads);
+
+    // Read input file to get the experiments
+    retval = read_input_file("in", experiments);
+    if (retval) {
+        return retval;
+    }
+    size_t n = experiments.size();
+    batch_iterations = 0;
+    for (const EXPERIMENT& e : experiments) {
+        batch_iterations += e.iterations;
+    }
+
+    // Try to read checkpoint file
+    if (read_checkpoint("checkpoint.bin", checkpoint_data) != 0) {
+        // No checkpoint found, initialize from scratch; all seeds are chosen
+        // now, so the checkpoint fixes them for the whole batch
+        for (size_t k = 0; k < n; k++) {
+            if (experiments[k].seed == 0) {
+                experiments[k].seed = random_seed(k);
+            }
+            experiments[k].points_in_circle = 0;
+        }
+        checkpoint_data.iterations_completed = 0;
+        checkpoint_data.points_in_circle = 0;
+        checkpoint_data.random_seed = experiments[0].seed;
+        checkpoint_data.experiment = 0;
+        checkpoint_data.num_experiments = n;
+
+        if (n == 1) {
+            fprintf(stderr, "APP: starting computation from beginning with seed %llu\n",
+                    checkpoint_data.random_seed);
+        } else {
+            fprintf(stderr, "APP: starting batch of %zu experiments from beginning\n", n);
+        }
+    } else {
+        fprintf(stderr, "APP: resuming from checkpoint\n");
+    }
+
+    fprintf(stderr, "APP: using %d worker thread(s), %s kernel\n", nthreads, pi_kernel->name);
+    mc_telemetry_phase(&telemetry, MC_PHASE_READ, phase_start);
+
+    // Main computation loop, one experiment after the other
+    phase_start = mc_telemetry_now();
+    double start_time = dtime();
+    batch_iterations_done = 0;
+    for (long long k = 0; k < checkpoint_data.experiment; k++) {
+        batch_iterations_done += experiments[k].iterations;
+    }
+    while (checkpoint_data.experiment < (long long)n) {
+        EXPERIMENT& e = experiments[checkpoint_data.experiment];
+        total_iterations = e.iterations;
+        retval = compute_pi_rounds(nthreads);
+        if (retval) {
+            return retval;
+        }
+        e.points_in_circle = checkpoint_data.points_in_circle;
+        batch_iterations_done += e.iterations;
+
+        checkpoint_data.experiment++;
+        checkpoint_data.iterations_completed = 0;
+        checkpoint_data.points_in_circle = 0;
+        if (checkpoint_data.experiment < (long long)n) {
+            checkpoint_data.random_seed = experiments[checkpoint_data.experiment].seed;
+        }
+    }
+    double total_time = dtime() - start_time;
+    if (total_time > 0) {
+        fprintf(stderr, "APP: %.2f million samples/second\n",
+                telemetry.samples / total_time / 1e6);
+    }
+    mc_telemetry_phase(&telemetry, MC_PHASE_COMPUTE, phase_start);
+
     // Computation complete, calculate PI
-    double pi_estimate = 4.0 * checkpoint_data.points_in_circle / total_iterations;
+    long long points_in_circle = 0;
+    for (const EXPERIMENT& e : experiments) {
+        points_in_circle += e.points_in_circle;
+    }
+    double pi_estimate = 4.0 * points_in_circle / batch_iterations;
 
     fprintf(stderr, "APP: computation complete\n");
-    fprintf(stderr, "APP: Points in circle: %lld\n", checkpoint_data.points_in_circle);
-    fprintf(stderr, "APP: Total points: %lld\n", total_iterations);
+    if (n > 1) {
+        fprintf(stderr, "APP: Experiments: %zu\n", n);
+    }
+    fprintf(stderr, "APP: Points in circle: %lld\n", points_in_circle);
+    fprintf(stderr, "APP: Total points: %lld\n", batch_iterations);
     fprintf(stderr, "APP: Estimated PI: %.15f\n", pi_estimate);
 
     // Write output file
-    retval = write_output_file("out", pi_estimate, total_iterations);
+    phase_start = mc_telemetry_now();
+    retval = write_output_file("out", experiments);
     if (retval) {
         return retval;
     }
+    mc_telemetry_phase(&telemetry, MC_PHASE_OUTPUT, phase_start);
 
     // Report 100% completion
     boinc_fraction_done(1.0);
@@ -268,24 +652,56 @@ int main(int argc, char** argv) {
     int retval;
 
     // Initialize BOINC
-    // Using simple boinc_init() for standalone mode compatibility
-    retval = boinc_init();
+    // The app may create worker threads, so BOINC must suspend and
+    // resume the whole process rather than only the main thread
+    BOINC_OPTIONS options;
+    boinc_options_defaults(options);
+    options.multi_thread = true;
+    retval = boinc_init_options(&options);
     if (retval) {
-        fprintf(stderr, "APP: boinc_init() failed: %d\n", retval);
+        fprintf(stderr, "APP: boinc_init_options() failed: %d\n", retval);
         fprintf(stderr, "APP: This may be normal for standalone testing\n");
         // Continue anyway - most BOINC functions will still work
     }
 
     fprintf(stderr, "APP: PI Computation started\n");
 
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--binary_output") == 0) binary_output = true;
+    }
+
+    // Pick the sampling kernel ("--kernel scalar" etc. forces one)
+    const char* kernel_name = get_option(argc, argv, "--kernel");
+    int nthreads = get_num_threads(argc, argv);
+#ifdef MC_OPENCL
+    // GPU app versions count on the device, driven by one thread; the
+    // counts are those of the CPU kernels, so checkpoints carry over
+    if (!kernel_name) {
+        pi_kernel = open_pi_opencl_kernel(argc, argv);
+        if (pi_kernel) {
+            nthreads = 1;
+        } else {
+            fprintf(stderr, "APP: no usable OpenCL device, counting on the CPU\n");
+        }
+    }
+#endif
+    if (!pi_kernel) {
+        pi_kernel = select_pi_kernel(kernel_name);
+    }
+    if (!pi_kernel) {
+        fprintf(stderr, "APP: kernel %s not available, using default\n", kernel_name);
+        pi_kernel = select_pi_kernel(NULL);
+    }
+
     // Run the main computation
-    retval = compute_pi();
+    retval = compute_pi(nthreads);
 
     if (retval) {
         fprintf(stderr, "APP: computation failed with error %d\n", retval);
         boinc_finish(retval);
     } else {
         fprintf(stderr, "APP: computation completed successfully\n");
+        mc_telemetry_write(stderr, &telemetry, "pi_compute");
         boinc_finish(0);
     }
 
@@ -0,0 +1,401 @@
+/*
+ * pi_kernels.cpp
+ *
+ * Scalar and SIMD kernels for the PI Monte Carlo estimator
+ *
+ * The SIMD kernels run Philox4x32-10 on 8 (AVX2), 16 (AVX-512) or 4 (NEON)
+ * consecutive sample indices at once, build the coordinates with the same
+ * exponent trick as mc_rng_u64_to_double() and count hits by accumulating
+ * the compare masks, so there is no branch per sample.
+ *
+ * Must be compiled with -ffp-contract=off: fusing x*x + y*y into an FMA
+ * would round differently from the scalar kernel and break the guarantee
+ * that all kernels return identical counts.
+ *
+ * The GPU app versions (-DMC_OPENCL) add the "opencl" kernel, which runs
+ * pi_count of mc_kernels.cl on the device opened by open_pi_opencl_kernel().
+ */
+
+#include <cstring>
+#include "mc_rng.h"
+#include "pi_kernels.h"
+
+#ifdef MC_OPENCL
+#include "mc_opencl.h"
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PI_KERNELS_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define PI_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define EXPONENT_ONE 0x3FF0000000000000LL
+
+// Reference kernel, one Philox block per sample
+static long long count_scalar(const uint32_t key[2], long long begin, long long end) {
+    long long hits = 0;
+    uint32_t out[4];
+
+    for (long long i = begin; i < end; i++) {
+        mc_rng_block(key, 0, (uint64_t)i, out);
+        double x = mc_rng_u64_to_double((uint64_t)out[0] | ((uint64_t)out[1] << 32));
+        double y = mc_rng_u64_to_double((uint64_t)out[2] | ((uint64_t)out[3] << 32));
+        hits += (x * x + y * y <= 1.0);
+    }
+    return hits;
+}
+
+// Expand the key schedule of the 10 Philox rounds
+static void philox_round_keys(const uint32_t key[2], uint32_t k0[10], uint32_t k1[10]) {
+    k0[0] = key[0];
+    k1[0] = key[1];
+    for (int round = 1; round < 10; round++) {
+        k0[round] = k0[round - 1] + MC_PHILOX_W0;
+        k1[round] = k1[round - 1] + MC_PHILOX_W1;
+    }
+}
+
+#ifdef PI_KERNELS_X86
+
+// 32x32->64 bit multiply of all eight lanes, split into high and low words
+__attribute__((target("avx2")))
+static inline void mulhilo_avx2(__m256i a, __m256i m, __m256i* hi, __m256i* lo) {
+    __m256i even = _mm256_mul_epu32(a, m);
+    __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+    *lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+    *hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+}
+
+// Inside-circle mask (all ones per hit) for four samples
+__attribute__((target("avx2")))
+static inline __m256i inside_avx2(__m256i xbits, __m256i ybits, __m256i exponent, __m256d one) {
+    __m256d x = _mm256_sub_pd(_mm256_castsi256_pd(
+        _mm256_or_si256(_mm256_srli_epi64(xbits, 12), exponent)), one);
+    __m256d y = _mm256_sub_pd(_mm256_castsi256_pd(
+        _mm256_or_si256(_mm256_srli_epi64(ybits, 12), exponent)), one);
+    __m256d r2 = _mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y));
+    return _mm256_castpd_si256(_mm256_cmp_pd(r2, one, _CMP_LE_OQ));
+}
+
+__attribute__((target("avx2")))
+static long long count_avx2(const uint32_t key[2], long long begin, long long end) {
+    const __m256i m0 = _mm256_set1_epi32((int)MC_PHILOX_M0);
+    const __m256i m1 = _mm256_set1_epi32((int)MC_PHILOX_M1);
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i exponent = _mm256_set1_epi64x(EXPONENT_ONE);
+    const __m256d one = _mm256_set1_pd(1.0);
+
+    uint32_t k0[10], k1[10];
+    philox_round_keys(key, k0, k1);
+    __m256i rk0[10], rk1[10];
+    for (int round = 0; round < 10; round++) {
+        rk0[round] = _mm256_set1_epi32((int)k0[round]);
+        rk1[round] = _mm256_set1_epi32((int)k1[round]);
+    }
+
+    long long hits = 0;
+    __m256i acc = _mm256_setzero_si256();
+    long long i = begin;
+
+    while (end - i >= 8) {
+        uint64_t idx = (uint64_t)i;
+        if ((uint32_t)idx > 0xFFFFFFFFu - 7) {
+            // Low counter word wraps inside this group
+            hits += count_scalar(key, i, i + 8);
+            i += 8;
+            continue;
+        }
+
+        __m256i c0 = _mm256_add_epi32(_mm256_set1_epi32((int)(uint32_t)idx), lane);
+        __m256i c1 = _mm256_set1_epi32((int)(uint32_t)(idx >> 32));
+        __m256i c2 = _mm256_setzero_si256();
+        __m256i c3 = _mm256_setzero_si256();
+
+        for (int round = 0; round < 10; round++) {
+            __m256i hi0, lo0, hi1, lo1;
+            mulhilo_avx2(c0, m0, &hi0, &lo0);
+            mulhilo_avx2(c2, m1, &hi1, &lo1);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), rk0[round]);
+            c1 = lo1;
+            c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), rk1[round]);
+            c3 = lo0;
+        }
+
+        // Words (0,1) form x and (2,3) form y; unpack gives 4 samples per register
+        acc = _mm256_sub_epi64(acc, inside_avx2(_mm256_unpacklo_epi32(c0, c1),
+                                                _mm256_unpacklo_epi32(c2, c3), exponent, one));
+        acc = _mm256_sub_epi64(acc, inside_avx2(_mm256_unpackhi_epi32(c0, c1),
+                                                _mm256_unpackhi_epi32(c2, c3), exponent, one));
+        i += 8;
+    }
+
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    hits += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    return hits + count_scalar(key, i, end);
+}
+
+// GCC 12 warns about the _mm512_undefined_*() placeholders inside the
+// AVX-512 intrinsics when they are inlined into target() functions
+// (GCC bug 105593); the warnings are spurious.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+static inline void mulhilo_avx512(__m512i a, __m512i m, __m512i* hi, __m512i* lo) {
+    __m512i even = _mm512_mul_epu32(a, m);
+    __m512i odd = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), m);
+    *lo = _mm512_mask_blend_epi32(0xAAAA, even, _mm512_slli_epi64(odd, 32));
+    *hi = _mm512_mask_blend_epi32(0xAAAA, _mm512_srli_epi64(even, 32), odd);
+}
+
+__attribute__((target("avx512f")))
+static inline __mmask8 inside_avx512(__m512i xbits, __m512i ybits, __m512i exponent, __m512d one) {
+    __m512d x = _mm512_sub_pd(_mm512_castsi512_pd(
+        _mm512_or_si512(_mm512_srli_epi64(xbits, 12), exponent)), one);
+    __m512d y = _mm512_sub_pd(_mm512_castsi512_pd(
+        _mm512_or_si512(_mm512_srli_epi64(ybits, 12), exponent)), one);
+    __m512d r2 = _mm512_add_pd(_mm512_mul_pd(x, x), _mm512_mul_pd(y, y));
+    return _mm512_cmp_pd_mask(r2, one, _CMP_LE_OQ);
+}
+
+__attribute__((target("avx512f")))
+static long long count_avx512(const uint32_t key[2], long long begin, long long end) {
+    const __m512i m0 = _mm512_set1_epi32((int)MC_PHILOX_M0);
+    const __m512i m1 = _mm512_set1_epi32((int)MC_PHILOX_M1);
+    const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                                           8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i exponent = _mm512_set1_epi64(EXPONENT_ONE);
+    const __m512i ones = _mm512_set1_epi64(1);
+    const __m512d one = _mm512_set1_pd(1.0);
+
+    uint32_t k0[10], k1[10];
+    philox_round_keys(key, k0, k1);
+    __m512i rk0[10], rk1[10];
+    for (int round = 0; round < 10; round++) {
+        rk0[round] = _mm512_set1_epi32((int)k0[round]);
+        rk1[round] = _mm512_set1_epi32((int)k1[round]);
+    }
+
+    long long hits = 0;
+    __m512i acc = _mm512_setzero_si512();
+    long long i = begin;
+
+    while (end - i >= 16) {
+        uint64_t idx = (uint64_t)i;
+        if ((uint32_t)idx > 0xFFFFFFFFu - 15) {
+            hits += count_scalar(key, i, i + 16);
+            i += 16;
+            continue;
+        }
+
+        __m512i c0 = _mm512_add_epi32(_mm512_set1_epi32((int)(uint32_t)idx), lane);
+        __m512i c1 = _mm512_set1_epi32((int)(uint32_t)(idx >> 32));
+        __m512i c2 = _mm512_setzero_si512();
+        __m512i c3 = _mm512_setzero_si512();
+
+        for (int round = 0; round < 10; round++) {
+            __m512i hi0, lo0, hi1, lo1;
+            mulhilo_avx512(c0, m0, &hi0, &lo0);
+            mulhilo_avx512(c2, m1, &hi1, &lo1);
+            c0 = _mm512_xor_si512(_mm512_xor_si512(hi1, c1), rk0[round]);
+            c1 = lo1;
+            c2 = _mm512_xor_si512(_mm512_xor_si512(hi0, c3), rk1[round]);
+            c3 = lo0;
+        }
+
+        __mmask8 lo = inside_avx512(_mm512_unpacklo_epi32(c0, c1),
+                                    _mm512_unpacklo_epi32(c2, c3), exponent, one);
+        __mmask8 hi = inside_avx512(_mm512_unpackhi_epi32(c0, c1),
+                                    _mm512_unpackhi_epi32(c2, c3), exponent, one);
+        acc = _mm512_mask_add_epi64(acc, lo, acc, ones);
+        acc = _mm512_mask_add_epi64(acc, hi, acc, ones);
+        i += 16;
+    }
+
+    hits += _mm512_reduce_add_epi64(acc);
+
+    return hits + count_scalar(key, i, end);
+}
+
+#pragma GCC diagnostic pop
+
+static bool supports_avx2() { return __builtin_cpu_supports("avx2"); }
+static bool supports_avx512() { return __builtin_cpu_supports("avx512f"); }
+
+#endif // PI_KERNELS_X86
+
+#ifdef PI_KERNELS_NEON
+
+static inline void mulhilo_neon(uint32x4_t a, uint32x4_t m, uint32x4_t* hi, uint32x4_t* lo) {
+    uint32x4_t p01 = vreinterpretq_u32_u64(vmull_u32(vget_low_u32(a), vget_low_u32(m)));
+    uint32x4_t p23 = vreinterpretq_u32_u64(vmull_high_u32(a, m));
+    *lo = vuzp1q_u32(p01, p23);
+    *hi = vuzp2q_u32(p01, p23);
+}
+
+static inline uint64x2_t inside_neon(uint32x4_t xbits, uint32x4_t ybits,
+                                     uint64x2_t exponent, float64x2_t one) {
+    float64x2_t x = vsubq_f64(vreinterpretq_f64_u64(
+        vorrq_u64(vshrq_n_u64(vreinterpretq_u64_u32(xbits), 12), exponent)), one);
+    float64x2_t y = vsubq_f64(vreinterpretq_f64_u64(
+        vorrq_u64(vshrq_n_u64(vreinterpretq_u64_u32(ybits), 12), exponent)), one);
+    float64x2_t r2 = vaddq_f64(vmulq_f64(x, x), vmulq_f64(y, y));
+    return vcleq_f64(r2, one);
+}
+
+static long long count_neon(const uint32_t key[2], long long begin, long long end) {
+    const uint32x4_t m0 = vdupq_n_u32(MC_PHILOX_M0);
+    const uint32x4_t m1 = vdupq_n_u32(MC_PHILOX_M1);
+    const uint32_t lane_init[4] = { 0, 1, 2, 3 };
+    const uint32x4_t lane = vld1q_u32(lane_init);
+    const uint64x2_t exponent = vdupq_n_u64((uint64_t)EXPONENT_ONE);
+    const float64x2_t one = vdupq_n_f64(1.0);
+
+    uint32_t k0[10], k1[10];
+    philox_round_keys(key, k0, k1);
+
+    long long hits = 0;
+    uint64x2_t acc = vdupq_n_u64(0);
+    long long i = begin;
+
+    while (end - i >= 4) {
+        uint64_t idx = (uint64_t)i;
+        if ((uint32_t)idx > 0xFFFFFFFFu - 3) {
+            hits += count_scalar(key, i, i + 4);
+            i += 4;
+            continue;
+        }
+
+        uint32x4_t c0 = vaddq_u32(vdupq_n_u32((uint32_t)idx), lane);
+        uint32x4_t c1 = vdupq_n_u32((uint32_t)(idx >> 32));
+        uint32x4_t c2 = vdupq_n_u32(0);
+        uint32x4_t c3 = vdupq_n_u32(0);
+
+        for (int round = 0; round < 10; round++) {
+            uint32x4_t hi0, lo0, hi1, lo1;
+            mulhilo_neon(c0, m0, &hi0, &lo0);
+            mulhilo_neon(c2, m1, &hi1, &lo1);
+            c0 = veorq_u32(veorq_u32(hi1, c1), vdupq_n_u32(k0[round]));
+            c1 = lo1;
+            c2 = veorq_u32(veorq_u32(hi0, c3), vdupq_n_u32(k1[round]));
+            c3 = lo0;
+        }
+
+        // Compare masks are all ones (-1) per hit
+        acc = vsubq_u64(acc, inside_neon(vzip1q_u32(c0, c1), vzip1q_u32(c2, c3), exponent, one));
+        acc = vsubq_u64(acc, inside_neon(vzip2q_u32(c0, c1), vzip2q_u32(c2, c3), exponent, one));
+        i += 4;
+    }
+
+    hits += (long long)vaddvq_u64(acc);
+
+    return hits + count_scalar(key, i, end);
+}
+
+#endif // PI_KERNELS_NEON
+
+static bool always_supported() { return true; }
+
+// Kernels in order of preference
+struct KERNEL_ENTRY {
+    PI_KERNEL kernel;
+    bool (*supported)();
+};
+
+static const KERNEL_ENTRY kernels[] = {
+#ifdef PI_KERNELS_X86
+    { { "avx512", count_avx512 }, supports_avx512 },
+    { { "avx2", count_avx2 }, supports_avx2 },
+#endif
+#ifdef PI_KERNELS_NEON
+    { { "neon", count_neon }, always_supported },
+#endif
+    { { "scalar", count_scalar }, always_supported },
+};
+
+#ifdef MC_OPENCL
+
+#define PI_CL_GROUPS 1024           // Work-groups of MC_CL_LOCAL_SIZE work-items per launch
+
+// The device and the buffer of per-group hits, set up by open_pi_opencl_kernel()
+static mc_cl_t pi_cl;
+static cl_kernel pi_cl_count;
+static cl_mem pi_cl_partial;
+
+// The device counts the same samples as count_scalar(); if a launch fails
+// the range is counted on the CPU instead, which gives the same result
+static long long count_opencl(const uint32_t key[2], long long begin, long long end) {
+    cl_uint k0 = key[0], k1 = key[1];
+    cl_long first = begin, last = end;
+    size_t local = MC_CL_LOCAL_SIZE, global = PI_CL_GROUPS * MC_CL_LOCAL_SIZE;
+    cl_long partial[PI_CL_GROUPS];
+    cl_int err;
+
+    err = clSetKernelArg(pi_cl_count, 0, sizeof(k0), &k0);
+    err |= clSetKernelArg(pi_cl_count, 1, sizeof(k1), &k1);
+    err |= clSetKernelArg(pi_cl_count, 2, sizeof(first), &first);
+    err |= clSetKernelArg(pi_cl_count, 3, sizeof(last), &last);
+    err |= clSetKernelArg(pi_cl_count, 4, sizeof(pi_cl_partial), &pi_cl_partial);
+    err |= clSetKernelArg(pi_cl_count, 5, MC_CL_LOCAL_SIZE * sizeof(cl_long), NULL);
+    if (err == CL_SUCCESS) {
+        err = clEnqueueNDRangeKernel(pi_cl.queue, pi_cl_count, 1, NULL, &global, &local,
+                                     0, NULL, NULL);
+    }
+    if (err == CL_SUCCESS) {
+        err = clEnqueueReadBuffer(pi_cl.queue, pi_cl_partial, CL_TRUE, 0, sizeof(partial),
+                                  partial, 0, NULL, NULL);
+    }
+    if (mc_cl_check(err, "pi_count") < 0) {
+        return count_scalar(key, begin, end);
+    }
+
+    long long hits = 0;
+    for (int g = 0; g < PI_CL_GROUPS; g++) {
+        hits += partial[g];
+    }
+    return hits;
+}
+
+static const PI_KERNEL opencl_kernel = { "opencl", count_opencl };
+
+const PI_KERNEL* open_pi_opencl_kernel(int argc, char** argv) {
+    if (pi_cl_count) {
+        return &opencl_kernel;
+    }
+    if (mc_cl_open(&pi_cl, argc, argv) < 0) {
+        return NULL;
+    }
+    pi_cl_count = mc_cl_kernel(&pi_cl, "pi_count");
+    pi_cl_partial = mc_cl_buffer(&pi_cl, PI_CL_GROUPS * sizeof(cl_long), NULL);
+    if (!pi_cl_count || !pi_cl_partial) {
+        if (pi_cl_count) clReleaseKernel(pi_cl_count);
+        pi_cl_count = NULL;
+        mc_cl_close(&pi_cl);
+        return NULL;
+    }
+    fprintf(stderr, "APP: OpenCL device %s\n", pi_cl.name);
+    return &opencl_kernel;
+}
+
+#endif // MC_OPENCL
+
+const PI_KERNEL* select_pi_kernel(const char* name) {
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (name && strcmp(name, kernels[i].kernel.name) != 0) {
+            continue;
+        }
+        if (kernels[i].supported()) {
+            return &kernels[i].kernel;
+        }
+        if (name) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
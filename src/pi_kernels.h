@@ -0,0 +1,43 @@
+/*
+ * pi_kernels.h
+ *
+ * Batch kernels for the PI Monte Carlo estimator
+ *
+ * A kernel counts how many samples of a range fall inside the quarter
+ * circle. Sample i is Philox block i of stream 0 (see mc_rng.h): the
+ * first two words give x, the last two give y. Every kernel generates
+ * exactly the same points and applies the same test, so they all return
+ * the same count and can be mixed freely, e.g. across a checkpoint.
+ *
+ * select_pi_kernel() picks the fastest kernel the CPU supports at run time.
+ * The GPU app versions (built with -DMC_OPENCL) count on the device with
+ * the kernel returned by open_pi_opencl_kernel().
+ */
+
+#ifndef PI_KERNELS_H
+#define PI_KERNELS_H
+
+#include <stdint.h>
+
+// Count samples in [begin, end) of the stream keyed by 'key' that fall
+// inside the quarter circle
+typedef long long (*PI_COUNT_FN)(const uint32_t key[2], long long begin, long long end);
+
+struct PI_KERNEL {
+    const char* name;
+    PI_COUNT_FN count;
+};
+
+// Return the kernel with the given name, or the fastest one supported by
+// this CPU when name is NULL. Returns NULL if the named kernel is unknown
+// or not supported here.
+const PI_KERNEL* select_pi_kernel(const char* name);
+
+#ifdef MC_OPENCL
+// Open the GPU the client assigned ("--device N" in argv, see mc_opencl.h)
+// and return the kernel counting on it, or NULL if there is no usable
+// device. The kernel is not thread safe: call it from one thread only.
+const PI_KERNEL* open_pi_opencl_kernel(int argc, char** argv);
+#endif
+
+#endif
@@ -6,9 +6,12 @@
  *
  * Pure C implementation without BOINC dependencies
  * Compares Monte Carlo solution against direct Gaussian elimination
+ * (blocked LU with partial pivoting, mc_lu.h)
  *
- * Compile: gcc -o simpleAxbMC simpleAxbMC.c -lm
- * Usage: ./simpleAxbMC [dimension] [num_walks]
+ * Compile: gcc -pthread -o simpleAxbMC simpleAxbMC.c -lm
+ * Usage: ./simpleAxbMC [dimension] [num_walks] [num_threads] [absorption]
+ *        absorption: stop probability per step (default 0.1), or "row"
+ *        for 1 - row_sum of the current row
  *
  * Licensed under GPL v3
  */
@@ -19,10 +22,17 @@
 #include <time.h>
 #include <string.h>
 
+#include "mc_alias.h"
+#include "mc_rng.h"
+#include "mc_pool.h"
+#include "mc_lu.h"
+
 #define MAX_DIM 100
 #define DEFAULT_WALKS 100000
 #define MAX_WALK_LENGTH 10000
-#define TERMINATION_PROB 0.1
+#define DEFAULT_ABSORB_PROB 0.1
+#define MIN_ABSORB_PROB 0.01    // Lower bound of the per-row absorption
+#define WALKS_PER_TASK 1024     // Walks per thread pool task
 
 typedef struct {
     int n;                    // Dimension
@@ -31,12 +41,18 @@ typedef struct {
     double C[MAX_DIM][MAX_DIM]; // Iteration matrix C = I - D^{-1}A
     double f[MAX_DIM];         // f = D^{-1}b
     double row_sum[MAX_DIM];   // Sum of |C_ij| for transition probabilities
+    double absorb[MAX_DIM];    // Probability that a walk stops at each row
+    mc_alias_slot_t alias[MAX_DIM][MAX_DIM]; // Per-row alias tables over the nonzeros of C
+    int alias_size[MAX_DIM];   // Number of slots in each row's table
     double x_mc[MAX_DIM];      // Monte Carlo solution
     double x_direct[MAX_DIM];  // Direct solution (Gaussian elimination)
 } LinearSystem;
 
-// Initialize random number generator with high-quality seed
-void init_random() {
+// Initialize random number generator with high-quality seed.
+// rand() generates the test problem; the walks use counter-based streams
+// (mc_rng.h) derived from the same seed, one per walk, so they can run
+// on any number of threads.
+unsigned int init_random() {
     unsigned int seed;
     FILE* urandom = fopen("/dev/urandom", "rb");
     if (urandom) {
@@ -47,6 +63,7 @@ void init_random() {
     }
     srand(seed);
     printf("Random seed: %u\n\n", seed);
+    return seed;
 }
 
 // Generate random double in [0, 1)
@@ -54,6 +71,13 @@ double rand_double() {
     return (double)rand() / (RAND_MAX + 1.0);
 }
 
+// Wall clock time in seconds (clock() would add up the CPU time of all threads)
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 // Generate a random diagonally dominant matrix (ensures convergence)
 void generate_diagonal_dominant_matrix(LinearSystem* sys) {
     printf("Generating %dx%d diagonally dominant system...\n", sys->n, sys->n);
@@ -114,7 +138,9 @@ void print_vector(const char* name, int n, double* v) {
 }
 
 // Prepare iteration form: C = I - D^{-1}A, f = D^{-1}b
-int prepare_iteration_form(LinearSystem* sys) {
+// absorb_prob < 0 stops a walk at row i with probability 1 - row_sum_i,
+// which keeps the walk weights at +-1
+int prepare_iteration_form(LinearSystem* sys, double absorb_prob) {
     printf("Preparing iteration form (C = I - D^{-1}A, f = D^{-1}b)...\n");
 
     for (int i = 0; i < sys->n; i++) {
@@ -140,6 +166,34 @@ int prepare_iteration_form(LinearSystem* sys) {
         }
 
         printf("  Row %d: diagonal = %.4f, row_sum = %.4f\n", i, diag, sys->row_sum[i]);
+
+        sys->absorb[i] = absorb_prob;
+        if (absorb_prob < 0) {
+            sys->absorb[i] = 1.0 - sys->row_sum[i];
+            if (sys->absorb[i] < MIN_ABSORB_PROB) sys->absorb[i] = MIN_ABSORB_PROB;
+        }
+
+        // Alias table over the nonzeros of row i (see mc_alias.h); taking
+        // entry j multiplies the walk weight by sign(C_ij) * row_sum / (1 - p_stop)
+        double weight[MAX_DIM], mult[MAX_DIM];
+        int32_t column[MAX_DIM];
+        double scale = sys->row_sum[i] / (1.0 - sys->absorb[i]);
+        int m = 0;
+
+        for (int j = 0; j < sys->n; j++) {
+            if (sys->C[i][j] != 0.0) {
+                weight[m] = fabs(sys->C[i][j]);
+                mult[m] = (sys->C[i][j] > 0) ? scale : -scale;
+                column[m] = j;
+                m++;
+            }
+        }
+
+        if (mc_alias_build(sys->alias[i], m, weight, column, mult) < 0) {
+            fprintf(stderr, "Error: Cannot build transition table for row %d\n", i);
+            return -1;
+        }
+        sys->alias_size[i] = m;
     }
 
     // Check convergence condition
@@ -160,7 +214,7 @@ int prepare_iteration_form(LinearSystem* sys) {
 }
 
 // Perform one random walk starting from state i
-double random_walk(LinearSystem* sys, int start_state) {
+double random_walk(LinearSystem* sys, int start_state, mc_rng_t* rng) {
     double sum = 0.0;
     int current_state = start_state;
     double weight = 1.0;
@@ -169,127 +223,151 @@ double random_walk(LinearSystem* sys, int start_state) {
         // Add contribution from current state
         sum += weight * sys->f[current_state];
 
-        // Terminate with probability TERMINATION_PROB
-        if (rand_double() < TERMINATION_PROB) {
+        // Terminate with the absorption probability of the current row
+        if (mc_rng_next_double(rng) < sys->absorb[current_state]) {
             break;
         }
 
         // No transitions available
-        if (sys->row_sum[current_state] < 1e-12) {
+        if (sys->alias_size[current_state] == 0 || sys->row_sum[current_state] < 1e-12) {
             break;
         }
 
-        // Choose next state based on transition probabilities
-        double r = rand_double() * sys->row_sum[current_state];
-        double cumsum = 0.0;
-        int next_state = current_state;
+        // Choose next state based on transition probabilities (O(1) alias draw)
+        double u1 = mc_rng_next_double(rng);
+        double u2 = mc_rng_next_double(rng);
+        double mult;
+        current_state = mc_alias_sample(sys->alias[current_state], sys->alias_size[current_state],
+                                        u1, u2, &mult);
 
-        for (int j = 0; j < sys->n; j++) {
-            cumsum += fabs(sys->C[current_state][j]);
-            if (r <= cumsum) {
-                next_state = j;
-                // Update weight with sign of C_ij and normalization
-                weight *= (sys->C[current_state][j] >= 0) ? 1.0 : -1.0;
-                weight *= sys->row_sum[current_state] / (1.0 - TERMINATION_PROB);
-                break;
-            }
-        }
-
-        current_state = next_state;
+        // Update weight with sign of C_ij and normalization
+        weight *= mult;
     }
 
     return sum;
 }
 
-// Solve using Monte Carlo method
-void solve_monte_carlo(LinearSystem* sys, long num_walks) {
-    printf("Solving with Monte Carlo (%ld walks per component)...\n", num_walks);
-
-    clock_t start = clock();
-
-    for (int i = 0; i < sys->n; i++) {
-        double sum = 0.0;
-
-        for (long walk = 0; walk < num_walks; walk++) {
-            sum += random_walk(sys, i);
-        }
-
-        sys->x_mc[i] = sum / num_walks;
+// Walk tasks of one batch of components for the thread pool: task t runs
+// block t % tasks_per_component of component first + t / tasks_per_component
+typedef struct {
+    LinearSystem* sys;
+    uint64_t seed;
+    long num_walks;
+    int first;
+    long tasks_per_component;
+    double* task_sum;          // Result slot of each task
+} WalkBatch;
+
+void run_walk_task(void* ctx, long task) {
+    WalkBatch* batch = (WalkBatch*)ctx;
+    int i = batch->first + (int)(task / batch->tasks_per_component);
+    long begin = (task % batch->tasks_per_component) * WALKS_PER_TASK;
+    long end = begin + WALKS_PER_TASK;
+    if (end > batch->num_walks) end = batch->num_walks;
 
-        if ((i + 1) % 10 == 0 || i == sys->n - 1) {
-            printf("  Computed %d/%d components\n", i + 1, sys->n);
-        }
+    double sum = 0.0;
+    for (long walk = begin; walk < end; walk++) {
+        // Walk 'walk' of component i has its own stream
+        mc_rng_t rng;
+        mc_rng_init(&rng, batch->seed, ((uint64_t)i << 32) | (uint32_t)walk);
+        sum += random_walk(batch->sys, i, &rng);
     }
-
-    clock_t end = clock();
-    double time_spent = (double)(end - start) / CLOCKS_PER_SEC;
-
-    printf("Monte Carlo solution completed in %.3f seconds\n\n", time_spent);
+    batch->task_sum[task] = sum;
 }
 
-// Gaussian elimination with partial pivoting
-void solve_gaussian_elimination(LinearSystem* sys) {
-    printf("Solving with Gaussian elimination...\n");
-
-    clock_t start = clock();
+// Solve using Monte Carlo method
+//
+// Walks are grouped into tasks of WALKS_PER_TASK and spread over a
+// work-stealing thread pool (mc_pool.h). Task sums are added in task
+// order, so the solution does not depend on the number of threads.
+// Returns 0 on success, -1 if memory is exhausted.
+int solve_monte_carlo(LinearSystem* sys, long num_walks, uint64_t seed, int num_threads) {
+    const int COMPONENTS_PER_BATCH = 10;
+    long tasks_per_component = (num_walks + WALKS_PER_TASK - 1) / WALKS_PER_TASK;
+    mc_pool_t* pool = malloc(sizeof(mc_pool_t));
+    WalkBatch batch;
+
+    batch.task_sum = malloc(COMPONENTS_PER_BATCH * tasks_per_component * sizeof(double));
+    if (!pool || !batch.task_sum) {
+        fprintf(stderr, "Error: Cannot allocate the walk tasks\n");
+        free(pool);
+        free(batch.task_sum);
+        return -1;
+    }
 
-    // Make working copies
-    double A_work[MAX_DIM][MAX_DIM];
-    double b_work[MAX_DIM];
+    num_threads = mc_pool_create(pool, num_threads);
+    printf("Solving with Monte Carlo (%ld walks per component, %d threads)...\n",
+           num_walks, num_threads);
 
-    memcpy(A_work, sys->A, sizeof(A_work));
-    memcpy(b_work, sys->b, sizeof(b_work));
+    batch.sys = sys;
+    batch.seed = seed;
+    batch.num_walks = num_walks;
+    batch.tasks_per_component = tasks_per_component;
 
-    int n = sys->n;
+    double start = now();
 
-    // Forward elimination with partial pivoting
-    for (int k = 0; k < n - 1; k++) {
-        // Find pivot
-        int pivot_row = k;
-        double max_val = fabs(A_work[k][k]);
+    for (int first = 0; first < sys->n; first += COMPONENTS_PER_BATCH) {
+        int count = sys->n - first < COMPONENTS_PER_BATCH ? sys->n - first : COMPONENTS_PER_BATCH;
 
-        for (int i = k + 1; i < n; i++) {
-            if (fabs(A_work[i][k]) > max_val) {
-                max_val = fabs(A_work[i][k]);
-                pivot_row = i;
-            }
-        }
+        batch.first = first;
+        mc_pool_run(pool, count * tasks_per_component, run_walk_task, &batch);
 
-        // Swap rows if necessary
-        if (pivot_row != k) {
-            for (int j = 0; j < n; j++) {
-                double temp = A_work[k][j];
-                A_work[k][j] = A_work[pivot_row][j];
-                A_work[pivot_row][j] = temp;
+        for (int c = 0; c < count; c++) {
+            double sum = 0.0;
+            for (long t = 0; t < tasks_per_component; t++) {
+                sum += batch.task_sum[c * tasks_per_component + t];
             }
-            double temp = b_work[k];
-            b_work[k] = b_work[pivot_row];
-            b_work[pivot_row] = temp;
+            sys->x_mc[first + c] = sum / num_walks;
         }
 
-        // Eliminate column
-        for (int i = k + 1; i < n; i++) {
-            double factor = A_work[i][k] / A_work[k][k];
-            for (int j = k; j < n; j++) {
-                A_work[i][j] -= factor * A_work[k][j];
-            }
-            b_work[i] -= factor * b_work[k];
-        }
+        printf("  Computed %d/%d components\n", first + count, sys->n);
     }
 
-    // Back substitution
-    for (int i = n - 1; i >= 0; i--) {
-        sys->x_direct[i] = b_work[i];
-        for (int j = i + 1; j < n; j++) {
-            sys->x_direct[i] -= A_work[i][j] * sys->x_direct[j];
-        }
-        sys->x_direct[i] /= A_work[i][i];
+    double time_spent = now() - start;
+
+    mc_pool_destroy(pool);
+    free(pool);
+    free(batch.task_sum);
+
+    printf("Monte Carlo solution completed in %.3f seconds\n\n", time_spent);
+    return 0;
+}
+
+// Gaussian elimination with partial pivoting: the blocked LU of mc_lu.h,
+// its trailing updates spread over 'num_threads' threads
+// Returns 0 on success, -1 if A is singular or memory is exhausted.
+int solve_gaussian_elimination(LinearSystem* sys, int num_threads) {
+    mc_pool_t* pool = NULL;
+    mc_lu_t lu;
+    int retval = 0;
+
+    if (mc_lu_alloc(&lu, sys->n) < 0) {
+        fprintf(stderr, "Error: Cannot allocate the LU factors\n");
+        return -1;
+    }
+    if (num_threads > 1) {
+        pool = malloc(sizeof(mc_pool_t));
+        if (pool) num_threads = mc_pool_create(pool, num_threads);
     }
+    printf("Solving with Gaussian elimination (%s, %d threads)...\n", MC_LU_BACKEND,
+           pool ? num_threads : 1);
+
+    double start = now();
 
-    clock_t end = clock();
-    double time_spent = (double)(end - start) / CLOCKS_PER_SEC;
+    if (mc_lu_factor(&lu, &sys->A[0][0], MAX_DIM, pool) != 0) {
+        fprintf(stderr, "Error: The matrix is singular\n");
+        retval = -1;
+    } else {
+        mc_lu_solve(&lu, sys->b, sys->x_direct);
+        printf("Gaussian elimination completed in %.6f seconds\n\n", now() - start);
+    }
 
-    printf("Gaussian elimination completed in %.6f seconds\n\n", time_spent);
+    if (pool) {
+        mc_pool_destroy(pool);
+        free(pool);
+    }
+    mc_lu_free(&lu);
+    return retval;
 }
 
 // Compare solutions and compute errors
@@ -358,6 +436,8 @@ int main(int argc, char** argv) {
     LinearSystem sys;
     int dimension = 5;
     long num_walks = DEFAULT_WALKS;
+    int num_threads = 1;
+    double absorb_prob = DEFAULT_ABSORB_PROB;
 
     // Parse command line arguments
     if (argc > 1) {
@@ -370,12 +450,33 @@ int main(int argc, char** argv) {
 
     if (argc > 2) {
         num_walks = atol(argv[2]);
-        if (num_walks < 1) {
-            fprintf(stderr, "Error: Number of walks must be positive\n");
+        if (num_walks < 1 || num_walks > 4294967295L) {
+            fprintf(stderr, "Error: Number of walks must be between 1 and 2^32-1\n");
+            return 1;
+        }
+    }
+
+    if (argc > 3) {
+        num_threads = atoi(argv[3]);
+        if (num_threads < 1 || num_threads > MC_POOL_MAX_THREADS) {
+            fprintf(stderr, "Error: Number of threads must be between 1 and %d\n",
+                    MC_POOL_MAX_THREADS);
             return 1;
         }
     }
 
+    if (argc > 4) {
+        if (strcmp(argv[4], "row") == 0) {
+            absorb_prob = -1.0;
+        } else {
+            absorb_prob = atof(argv[4]);
+            if (absorb_prob <= 0.0 || absorb_prob >= 1.0) {
+                fprintf(stderr, "Error: Absorption probability must be in (0, 1) or \"row\"\n");
+                return 1;
+            }
+        }
+    }
+
     sys.n = dimension;
 
     printf("========================================\n");
@@ -385,21 +486,25 @@ int main(int argc, char** argv) {
     printf("Walks/component: %ld\n\n", num_walks);
 
     // Initialize random number generator
-    init_random();
+    unsigned int seed = init_random();
 
     // Generate test problem
     generate_diagonal_dominant_matrix(&sys);
 
     // Prepare iteration form
-    if (prepare_iteration_form(&sys) < 0) {
+    if (prepare_iteration_form(&sys, absorb_prob) < 0) {
         return 1;
     }
 
     // Solve with Monte Carlo
-    solve_monte_carlo(&sys, num_walks);
+    if (solve_monte_carlo(&sys, num_walks, seed, num_threads) < 0) {
+        return 1;
+    }
 
     // Solve with direct method
-    solve_gaussian_elimination(&sys);
+    if (solve_gaussian_elimination(&sys, num_threads) < 0) {
+        return 1;
+    }
 
     // Compare solutions
     compare_solutions(&sys);
@@ -6,6 +6,20 @@ Generates BOINC work units for the Ax=b Monte Carlo solver.
 Splits the solution vector into multiple work units, where each work unit
 computes a subset of the solution components.
 
+By default the matrix is written once, to a content-hashed file that all
+work units of the job share (a sticky BOINC input, see templates/axb_in.xml),
+and every work unit only gets a one-line parameter file. Hosts that already
+have the matrix do not download it again.
+
+Component ranges are sized by the estimated cost of their components
+(walk lengths from the row sums of the iteration matrix, and walk counts
+from the variances of a pilot run when there is one), so work units take
+about the same time. With --pilot-app the solver itself runs a short
+pilot on a few components first; its measured variances, walk lengths
+and times then also set the number of work units (--target-runtime).
+Input files are written by a pool of threads and BOINC work units are
+created in batches through "create_work --stdin".
+
 This demonstrates how to parallelize a naturally divisible problem across
 multiple BOINC clients.
 
@@ -14,9 +28,31 @@ Licensed under GPL v3
 
 import sys
 import os
+import io
 import argparse
+import hashlib
 import numpy as np
+import struct
 import subprocess
+from concurrent.futures import ThreadPoolExecutor
+
+# Binary input format (see src/axb_input.h)
+AXB_INPUT_MAGIC = 0x49425841       # "AXBI"
+AXB_INPUT_VERSION = 1
+
+# Defaults of the solver (see src/axb_params.h)
+DEFAULT_ABSORB = 0.1
+MIN_ABSORB_PROB = 0.01
+DEFAULT_MIN_WALKS = 1024
+
+# Work units per "create_work --stdin" call
+DEFAULT_BATCH_SIZE = 1000
+
+# Pilot runs (--pilot-app): components sampled, share of --num-walks
+# each of them runs, and the fewest walks that give a usable variance
+DEFAULT_PILOT_COMPONENTS = 16
+PILOT_WALK_FRACTION = 0.01
+MIN_PILOT_WALKS = 100
 
 def generate_test_matrix(n, condition_number=10.0, diagonal_dominant=True):
     """
@@ -56,54 +92,520 @@ def generate_test_matrix(n, condition_number=10.0, diagonal_dominant=True):
     return A, b, x_true
 
 
-def write_input_file(filename, A, b, start_idx, end_idx, num_walks):
+class SparseMatrix:
+    """
+    Square matrix stored as (row, column, value) triplets (COO)
+    """
+
+    def __init__(self, n, rows, cols, vals):
+        self.n = n
+        self.rows = np.asarray(rows, dtype=np.int64)
+        self.cols = np.asarray(cols, dtype=np.int64)
+        self.vals = np.asarray(vals, dtype=np.float64)
+
+    def __matmul__(self, x):
+        y = np.zeros(self.n)
+        np.add.at(y, self.rows, self.vals * x[self.cols])
+        return y
+
+
+def generate_sparse_test_matrix(n, nnz_per_row):
+    """
+    Generate a sparse diagonally dominant matrix A and vector b
+
+    Each row gets nnz_per_row - 1 off-diagonal entries in random columns,
+    like the stencil of a PDE discretization but without its structure.
+
+    Returns:
+        A: SparseMatrix
+        b: n vector
+        x_true: True solution (for verification)
+    """
+    x_true = np.random.randn(n)
+    off = max(0, min(nnz_per_row - 1, n - 1))
+
+    rows, cols, vals = [], [], []
+    for i in range(n):
+        others = np.random.choice(n - 1, size=off, replace=False)
+        others[others >= i] += 1          # Skip the diagonal
+        row_vals = np.random.randn(off) * 0.1
+
+        rows.extend([i] * (off + 1))
+        cols.extend(others.tolist() + [i])
+        vals.extend(row_vals.tolist() + [np.sum(np.abs(row_vals)) * 1.5 + 1.0])
+
+    A = SparseMatrix(n, rows, cols, vals)
+    return A, A @ x_true, x_true
+
+
+def write_matrix(f, A, b):
+    """
+    Write the dimension, matrix A and vector b in the solver's input format
+
+    Dense matrices are written row by row after "n"; sparse ones as
+    "sparse n nnz" followed by one "i j A_ij" triplet per line.
+    """
+    n = len(b)
+
+    if isinstance(A, SparseMatrix):
+        f.write(f"sparse {n} {len(A.vals)}\n")
+        for i, j, v in zip(A.rows, A.cols, A.vals):
+            f.write(f"{i} {j} {v:.15e}\n")
+    else:
+        f.write(f"{n}\n")
+        for i in range(n):
+            f.write(" ".join(map("{:.15e}".format, A[i])) + " \n")
+
+    for i in range(n):
+        f.write(f"{b[i]:.15e}\n")
+
+
+def read_matrix_file(filename):
+    """
+    Read a matrix saved with --save-matrix (dense or sparse format)
+    """
+    with open(filename) as f:
+        tokens = f.read().split()
+
+    if tokens[0] == "sparse":
+        n, nnz = int(tokens[1]), int(tokens[2])
+        triplets = np.array(tokens[3:3 + 3 * nnz], dtype=np.float64).reshape(nnz, 3)
+        A = SparseMatrix(n, triplets[:, 0], triplets[:, 1], triplets[:, 2])
+        b = np.array(tokens[3 + 3 * nnz:3 + 3 * nnz + n], dtype=np.float64)
+    else:
+        n = int(tokens[0])
+        A = np.array(tokens[1:1 + n * n], dtype=np.float64).reshape(n, n)
+        b = np.array(tokens[1 + n * n:1 + n * n + n], dtype=np.float64)
+
+    return A, b
+
+
+def format_params(start_idx, end_idx, num_walks, options=()):
+    """
+    Parameter line of one work unit (format: src/axb_params.h)
+
+        start_idx end_idx num_walks [key=value ...]
+    """
+    return " ".join([f"{start_idx} {end_idx} {num_walks}"] + list(options)) + "\n"
+
+
+def solver_options(args):
+    """
+    The key=value work unit parameters selected on the command line
+    """
+    options = []
+    if args.walk_seed:
+        options.append(f"seed={args.walk_seed}")
+    if args.tolerance:
+        options.append(f"tol={args.tolerance!r}")
+    if args.estimator != "component":
+        options.append(f"mode={args.estimator}")
+    if args.absorb is not None:
+        options.append(f"absorb={args.absorb}")
+    if args.control_variate:
+        options.append(f"cv={args.control_variate}")
+    if args.antithetic:
+        options.append("antithetic=1")
+    if args.split != "jacobi":
+        options.append(f"split={args.split}")
+    if args.omega != 1.0:
+        options.append(f"omega={args.omega!r}")
+    if args.split == "block":
+        options.append(f"block={args.block_size}")
+    return options
+
+
+def absorption(value):
+    """
+    argparse type of --absorb: a probability in (0, 1) or "row"
+    """
+    if value == "row":
+        return value
+    p = float(value)
+    if not 0.0 < p < 1.0:
+        raise argparse.ArgumentTypeError("must be in (0, 1) or \"row\"")
+    return repr(p)
+
+
+def write_input_file(filename, A, b, start_idx, end_idx, num_walks, options=()):
     """
     Write input file for one work unit
 
     Format:
-        n (dimension)
-        A (matrix, row by row)
+        n (dimension) and A (matrix, row by row), or
+        sparse n nnz and nnz "i j A_ij" lines
         b (vector)
-        start_idx end_idx num_walks (work unit parameters)
+        start_idx end_idx num_walks [key=value ...] (work unit parameters)
+    """
+    write_encoded_input(filename, encode_input(A, b), start_idx, end_idx, num_walks,
+                        options=options)
+
+
+class EncodedInput:
+    """
+    Matrix and right-hand side of a work unit input, formatted once
+
+    Self-contained work units differ only in their component range and
+    parameters, so the bytes of A and b are produced once per job and
+    every input file is a short header or parameter line plus this body.
+    """
+
+    def __init__(self, n, nnz, body, binary):
+        self.n = n
+        self.nnz = nnz
+        self.body = body
+        self.binary = binary
+
+
+def encode_input(A, b, binary=False):
+    """
+    Format A and b for write_encoded_input() (text or binary layout)
+    """
+    n = len(b)
+    if not binary:
+        f = io.StringIO()
+        write_matrix(f, A, b)
+        return EncodedInput(n, None, f.getvalue().encode(), False)
+
+    row_ptr, col, val = to_csr(A, n)
+    nnz = len(val)
+    body = b"".join([
+        row_ptr.astype('<i8').tobytes(),
+        col.astype('<i4').tobytes(),
+        b'\0' * ((-4 * nnz) % 8),
+        val.astype('<f8').tobytes(),
+        np.asarray(b, dtype='<f8').tobytes(),
+    ])
+    return EncodedInput(n, nnz, body, True)
+
+
+def write_encoded_input(filename, encoded, start_idx, end_idx, num_walks, options=(), seed=0):
+    """
+    Write the input file of one work unit from an encode_input() body:
+    text inputs end with the parameter line, binary ones start with the
+    header of src/axb_input.h (which has room for the seed only)
+    """
+    with open(filename, 'wb') as f:
+        if encoded.binary:
+            f.write(struct.pack('<IIqqqqqQQ', AXB_INPUT_MAGIC, AXB_INPUT_VERSION,
+                                encoded.n, encoded.nnz, start_idx, end_idx, num_walks, seed, 0))
+            f.write(encoded.body)
+        else:
+            f.write(encoded.body)
+            f.write(format_params(start_idx, end_idx, num_walks, options).encode())
+
+
+def to_csr(A, n):
+    """
+    Convert a dense or sparse matrix to CSR arrays (row_ptr, col, val)
+    with ascending columns, no duplicates and no explicit zeros
+    """
+    if isinstance(A, SparseMatrix):
+        rows, cols, vals = A.rows, A.cols, A.vals
+    else:
+        rows, cols = np.nonzero(A)
+        vals = A[rows, cols]
+
+    # Sort by (row, column) and sum duplicate entries
+    keys, inverse = np.unique(rows.astype(np.int64) * n + cols, return_inverse=True)
+    vals = np.bincount(inverse, weights=vals, minlength=len(keys))
+    keep = vals != 0.0
+    keys, vals = keys[keep], vals[keep]
+
+    rows = keys // n
+    row_ptr = np.zeros(n + 1, dtype=np.int64)
+    np.cumsum(np.bincount(rows, minlength=n), out=row_ptr[1:])
+
+    return row_ptr, (keys % n).astype(np.int32), vals.astype(np.float64)
+
+
+def approximate_inverse(A, n):
+    """
+    Sparse approximate inverse P of A for split=approx, with the sparsity
+    pattern of A: row i of P minimizes ||P_i A - e_i|| over the columns
+    that row i of A has (one small least-squares problem per row)
+    """
+    row_ptr, col, val = to_csr(A, n)
+    rows, cols, vals = [], [], []
+
+    for i in range(n):
+        J = col[row_ptr[i]:row_ptr[i + 1]]
+
+        # Rows J of A, restricted to the columns they touch
+        K = np.unique(np.concatenate([col[row_ptr[j]:row_ptr[j + 1]] for j in J]))
+        M = np.zeros((len(J), len(K)))
+        for a, j in enumerate(J):
+            M[a, np.searchsorted(K, col[row_ptr[j]:row_ptr[j + 1]])] = val[row_ptr[j]:row_ptr[j + 1]]
+
+        p = np.linalg.lstsq(M.T, (K == i).astype(np.float64), rcond=None)[0]
+        rows.extend([i] * len(J))
+        cols.extend(J)
+        vals.extend(p)
+
+    return SparseMatrix(n, rows, cols, vals)
+
+
+def write_binary_input_file(filename, A, b, start_idx, end_idx, num_walks, seed=0):
+    """
+    Write input file for one work unit in the binary format of
+    src/axb_input.h: a 64-byte header followed by little-endian arrays
+
+        int64 row_ptr[n+1], int32 col[nnz] (padded to 8 bytes),
+        float64 val[nnz], float64 b[n]
+
+    The client maps the file and uses the matrix without parsing it.
+    A seed of 0 lets each client pick its own random seed.
+    """
+    write_encoded_input(filename, encode_input(A, b, binary=True), start_idx, end_idx,
+                        num_walks, seed=seed)
+
+
+def write_shared_matrix(output_dir, A, b, num_walks, binary=False, prefix="axb_matrix"):
+    """
+    Write the matrix file shared by all work units of a job (or, with
+    prefix "axb_precond", its approximate inverse, with b = 0)
+
+    The file is named after a hash of its contents, so a changed matrix
+    never reuses the name of one that clients may already hold as a
+    sticky file, and an unchanged one is never downloaded twice. The
+    component range and walks stored in it are only defaults; each work
+    unit's parameter file overrides them.
+
+    Returns:
+        Path of the matrix file
     """
     n = len(b)
+    extension = "bin" if binary else "txt"
+    tmp_path = os.path.join(output_dir, f"{prefix}.{extension}.tmp")
+
+    write_encoded_input(tmp_path, encode_input(A, b, binary), 0, n - 1, num_walks)
+
+    digest = hashlib.sha256()
+    with open(tmp_path, 'rb') as f:
+        for chunk in iter(lambda: f.read(1 << 20), b''):
+            digest.update(chunk)
+
+    path = os.path.join(output_dir, f"{prefix}_{digest.hexdigest()[:16]}.{extension}")
+    os.replace(tmp_path, path)
+    return path
+
 
+def write_params_file(filename, start_idx, end_idx, num_walks, options=()):
+    """
+    Write the parameter file of one work unit (format: src/axb_params.h)
+    """
     with open(filename, 'w') as f:
-        # Write dimension
-        f.write(f"{n}\n")
+        f.write(format_params(start_idx, end_idx, num_walks, options))
 
-        # Write matrix A
-        for i in range(n):
-            for j in range(n):
-                f.write(f"{A[i, j]:.15e} ")
-            f.write("\n")
 
-        # Write vector b
-        for i in range(n):
-            f.write(f"{b[i]:.15e}\n")
+class PilotReport:
+    """
+    What a pilot run of the solver measured (pilot=K, see run_pilot() in
+    src/Axb-MonteCarlo.c): for each sampled component the variance of one
+    sample, the mean number of states a walk visited and the seconds its
+    walks took on one thread
+    """
+
+    def __init__(self, walks, components, variances, lengths, seconds):
+        self.walks = walks
+        self.components = components
+        self.variances = variances
+        self.lengths = lengths
+        self.seconds = seconds
+
+    def seconds_per_cost(self):
+        """
+        Seconds per unit of component_costs() on the pilot's host
+        """
+        return np.sum(self.seconds) / np.sum(self.walks * (self.lengths + 1.0))
+
+
+def run_pilot(app, output_dir, matrix_file, precond_file, n, walks, components, options):
+    """
+    Run a pilot of the standalone solver (built without _BOINC_) on this
+    machine over the whole system and return the path of its report
+    """
+    params_file = os.path.join(output_dir, "axb_pilot_params.txt")
+    report_file = os.path.join(output_dir, "axb_pilot_report.txt")
+    write_params_file(params_file, 0, n - 1, walks, list(options) + [f"pilot={components}"])
+
+    cmd = [app, matrix_file, report_file, params_file] + ([precond_file] if precond_file else [])
+    try:
+        subprocess.run(cmd, check=True, capture_output=True, text=True)
+    except (OSError, subprocess.CalledProcessError) as e:
+        stderr = getattr(e, "stderr", None) or str(e)
+        raise RuntimeError(f"pilot run of {app} failed: {stderr.strip()}")
+    return report_file
+
+
+def read_pilot(filename, n, pilot_walks):
+    """
+    Per-walk variance of every component from a pilot: a report of
+    run_pilot(), or the output of an ordinary short run ("start end", then
+    "value std_error" lines) that ran pilot_walks walks per component,
+    where variance = std_error^2 * pilot_walks.
+
+    Components between those of a report get the variance interpolated
+    from their neighbours, components an ordinary run did not cover the
+    mean of the others.
+
+    Returns:
+        variances: n per-walk variances
+        report: PilotReport, or None for an ordinary output
+    """
+    with open(filename) as f:
+        header = f.readline().split()
+        lines = [line.split() for line in f if line.strip()]
+
+    if header and header[0] == "pilot":
+        walks = int(header[3])
+        table = np.array([[float(v) for v in line[:6]] for line in lines])
+        if len(table) != int(header[1]) or len(table) == 0 or np.any(table[:, 0] >= n):
+            raise ValueError(f"{filename} does not match a {n}-dimensional system")
+
+        components = table[:, 0].astype(np.int64)
+        report = PilotReport(walks, components, table[:, 3], table[:, 4], table[:, 5])
+        variances = np.interp(np.arange(n), components, report.variances)
+        return variances, report
+
+    start_idx, end_idx = int(header[0]), int(header[1])
+    errors = np.array([float(line[1]) for line in lines])
+
+    if len(errors) != end_idx - start_idx + 1 or end_idx >= n:
+        raise ValueError(f"{filename} does not match a {n}-dimensional system")
 
-        # Write work unit parameters
-        f.write(f"{start_idx} {end_idx} {num_walks}\n")
+    variances = np.full(n, np.mean(errors ** 2) * pilot_walks)
+    variances[start_idx:end_idx + 1] = errors ** 2 * pilot_walks
+    return variances, None
 
 
-def create_work_unit(work_dir, wu_name, input_file, app_name="axb_montecarlo"):
+def component_costs(A, n, args, variances=None, report=None):
+    """
+    Estimated relative cost of computing each component:
+    walks x (expected walk length + 1)
+
+    The walk lengths follow from the absorption: with a fixed probability
+    P every walk takes 1/P steps on average, with absorb=row a walk from i
+    takes l_i steps where l = 1 + (1 - a) * T l, T being the transition
+    probabilities |C_ij| / row_sum_i. C is the iteration matrix of the
+    relaxed Jacobi splitting, which is close enough for the other
+    splittings to balance work units. Without a tolerance every component
+    runs --num-walks walks; with one and pilot variances, about
+    variance / tol^2 of them. A pilot report rescales the walk lengths so
+    that they match the ones it measured on average.
+    """
+    row_ptr, col, val = to_csr(A, n)
+    rows = np.repeat(np.arange(n), np.diff(row_ptr))
+    on_diag = col == rows
+
+    diag = np.ones(n)
+    diag[rows[on_diag]] = np.abs(val[on_diag])
+    diag[diag == 0] = 1.0           # The client rejects these anyway
+
+    off = ~on_diag
+    weights = args.omega * np.abs(val[off]) / diag[rows[off]]
+    self_weight = abs(1.0 - args.omega)
+    row_sums = np.bincount(rows[off], weights=weights, minlength=n) + self_weight
+
+    if args.absorb == "row":
+        absorb = np.maximum(1.0 - row_sums, MIN_ABSORB_PROB)
+        safe_sums = np.where(row_sums > 0, row_sums, 1.0)
+        trans = weights / safe_sums[rows[off]]
+        trans_self = self_weight / safe_sums
+
+        # Fixed point of l = 1 + (1 - a) T l; converges since 1 - a < 1
+        length = np.ones(n)
+        for _ in range(1000):
+            step = np.bincount(rows[off], weights=trans * length[col[off]], minlength=n)
+            new_length = 1.0 + (1.0 - absorb) * (step + trans_self * length)
+            done = np.max(np.abs(new_length - length) / new_length) < 1e-3
+            length = new_length
+            if done:
+                break
+    else:
+        p = float(args.absorb) if args.absorb is not None else DEFAULT_ABSORB
+        length = np.full(n, 1.0 / p)
+
+    if report is not None:
+        length *= np.mean(report.lengths) / np.mean(length[report.components])
+
+    walks = np.full(n, float(args.num_walks))
+    if args.tolerance and variances is not None:
+        walks = np.clip(variances / args.tolerance ** 2, DEFAULT_MIN_WALKS, args.num_walks)
+
+    return walks * (length + 1.0)
+
+
+def balanced_ranges(costs, num_wu):
+    """
+    Split components 0 .. n-1 into num_wu contiguous ranges of about equal
+    total cost (every range gets at least one component)
+    """
+    n = len(costs)
+    cumulative = np.cumsum(costs)
+    targets = cumulative[-1] * np.arange(1, num_wu) / num_wu
+
+    # Cut before or after the component that crosses each target,
+    # whichever lands closer to it
+    cuts = []
+    for k, target in enumerate(targets):
+        i = int(np.searchsorted(cumulative, target))
+        before = cumulative[i - 1] if i > 0 else 0.0
+        cut = i if target - before < cumulative[i] - target else i + 1
+        low = cuts[-1] + 1 if cuts else 1
+        cuts.append(min(max(cut, low), n - (num_wu - 1 - k)))
+
+    bounds = [0] + cuts + [n]
+    return [(bounds[k], bounds[k + 1] - 1) for k in range(num_wu)]
+
+
+def stage_file(work_dir, path):
+    """
+    Copy an input file into the project's download hierarchy
+
+    Files that are already staged (a shared matrix used by an earlier
+    job) are left alone.
+    """
+    name = os.path.basename(path)
+    result = subprocess.run([os.path.join(work_dir, "bin", "dir_hier_path"), name],
+                            capture_output=True, text=True)
+    if result.returncode == 0 and os.path.exists(result.stdout.strip()):
+        return True
+
+    try:
+        subprocess.run([os.path.join(work_dir, "bin", "stage_file"), "--copy", path],
+                       cwd=work_dir, check=True, capture_output=True, text=True)
+        return True
+    except subprocess.CalledProcessError as e:
+        print(f"Error staging {path}: {e.stderr}")
+        return False
+
+
+def create_work_unit(work_dir, wu_name, input_files, app_name="axb_montecarlo",
+                     wu_template="axb_in.xml", binary_output=False):
     """
     Create a BOINC work unit using the create_work tool
 
     Args:
         work_dir: BOINC project directory
         wu_name: Work unit name
-        input_file: Path to input file
+        input_files: Paths of the input files, in template order
         app_name: BOINC application name
+        wu_template: Input template in the project's templates/ directory
+        binary_output: Have the client upload a binary result (src/mc_result.h)
     """
+    for path in input_files:
+        if not stage_file(work_dir, path):
+            return False
+
     cmd = [
         os.path.join(work_dir, "bin", "create_work"),
         "--appname", app_name,
         "--wu_name", wu_name,
-        "--wu_template", os.path.join(work_dir, "templates", "axb_in.xml"),
+        "--wu_template", os.path.join(work_dir, "templates", wu_template),
         "--result_template", os.path.join(work_dir, "templates", "axb_out.xml"),
-        input_file
-    ]
+    ] + (["--command_line", "--binary_output"] if binary_output else []) + [
+        os.path.basename(path) for path in input_files]
 
     try:
         subprocess.run(cmd, check=True, capture_output=True, text=True)
@@ -114,6 +616,75 @@ def create_work_unit(work_dir, wu_name, input_file, app_name="axb_montecarlo"):
         return False
 
 
+def stage_files(work_dir, paths, chunk=DEFAULT_BATCH_SIZE):
+    """
+    Copy new input files into the download hierarchy, many per stage_file call
+    """
+    for k in range(0, len(paths), chunk):
+        try:
+            subprocess.run([os.path.join(work_dir, "bin", "stage_file"), "--copy"] +
+                           list(paths[k:k + chunk]),
+                           cwd=work_dir, check=True, capture_output=True, text=True)
+        except subprocess.CalledProcessError as e:
+            print(f"Error staging input files: {e.stderr}")
+            return False
+    return True
+
+
+def create_work_units(work_dir, jobs, shared_files, app_name="axb_montecarlo",
+                      batch_size=DEFAULT_BATCH_SIZE, binary_output=False):
+    """
+    Create many BOINC work units with one "create_work --stdin" call per
+    batch instead of one create_work process each
+
+    Args:
+        work_dir: BOINC project directory
+        jobs: (wu_name, wu_template, input_files) per work unit
+        shared_files: Inputs used by every work unit (staged only once)
+        app_name: BOINC application name
+        batch_size: Work units per create_work call
+        binary_output: Have the clients upload binary results (src/mc_result.h)
+
+    Returns:
+        Number of work units created
+    """
+    for path in shared_files:
+        if not stage_file(work_dir, path):
+            return 0
+
+    own_files = [path for _, _, files in jobs for path in files if path not in shared_files]
+    if not stage_files(work_dir, own_files, batch_size):
+        return 0
+
+    created = 0
+    for k in range(0, len(jobs), batch_size):
+        batch = jobs[k:k + batch_size]
+        lines = [
+            " ".join(["--wu_name", wu_name,
+                      "--wu_template", os.path.join(work_dir, "templates", wu_template)] +
+                     [os.path.basename(path) for path in files])
+            for wu_name, wu_template, files in batch
+        ]
+        cmd = [
+            os.path.join(work_dir, "bin", "create_work"),
+            "--appname", app_name,
+            "--result_template", os.path.join(work_dir, "templates", "axb_out.xml"),
+            "--stdin",
+        ]
+        if binary_output:
+            cmd += ["--command_line", "--binary_output"]
+
+        try:
+            subprocess.run(cmd, input="\n".join(lines) + "\n", cwd=work_dir,
+                           check=True, capture_output=True, text=True)
+            created += len(batch)
+            print(f"Created work units {batch[0][0]} .. {batch[-1][0]}")
+        except subprocess.CalledProcessError as e:
+            print(f"Error creating work units {batch[0][0]} .. {batch[-1][0]}: {e.stderr}")
+
+    return created
+
+
 def main():
     parser = argparse.ArgumentParser(
         description="Generate BOINC work units for Ax=b Monte Carlo solver"
@@ -168,6 +739,173 @@ def main():
         help="Generate diagonally dominant matrix (ensures convergence)"
     )
 
+    parser.add_argument(
+        "--sparse",
+        action="store_true",
+        help="Generate a sparse matrix and write it as (i, j, value) triplets"
+    )
+
+    parser.add_argument(
+        "--nnz-per-row",
+        type=int,
+        default=10,
+        help="Nonzeros per row of a sparse matrix, diagonal included (default: 10)"
+    )
+
+    parser.add_argument(
+        "--binary",
+        action="store_true",
+        help="Write work unit inputs in the binary format (smaller, no parsing on the client)"
+    )
+
+    parser.add_argument(
+        "--walk-seed",
+        type=int,
+        default=0,
+        help="Seed for the walks of every work unit (default: 0, client chooses)"
+    )
+
+    parser.add_argument(
+        "--tolerance",
+        type=float,
+        default=0.0,
+        help="Stop each component once its standard error reaches this value; "
+             "--num-walks is then the maximum (default: 0, always run all walks)"
+    )
+
+    parser.add_argument(
+        "--estimator",
+        choices=["component", "suffix"],
+        default="component",
+        help="component: walks estimate only their start component; suffix: every walk "
+             "adds a sample to each component of the work unit it visits (default: component)"
+    )
+
+    parser.add_argument(
+        "--absorb",
+        type=absorption,
+        default=None,
+        help="Probability that a walk stops at each step, or \"row\" for 1 - row sum "
+             "of |C| (default: 0.1)"
+    )
+
+    parser.add_argument(
+        "--control-variate",
+        type=int,
+        default=0,
+        metavar="SWEEPS",
+        help="Let the walks estimate only the remainder after this many Jacobi sweeps "
+             "(default: 0, off)"
+    )
+
+    parser.add_argument(
+        "--antithetic",
+        action="store_true",
+        help="Run antithetic walk pairs (component estimator only)"
+    )
+
+    parser.add_argument(
+        "--split",
+        choices=["jacobi", "block", "approx"],
+        default="jacobi",
+        help="Splitting of A that defines the walks: jacobi (diagonal), block (diagonal "
+             "blocks) or approx (sparse approximate inverse computed here and shipped "
+             "with the matrix) (default: jacobi)"
+    )
+
+    parser.add_argument(
+        "--omega",
+        type=float,
+        default=1.0,
+        help="Relaxation factor of the splitting, in (0, 2) (default: 1)"
+    )
+
+    parser.add_argument(
+        "--block-size",
+        type=int,
+        default=8,
+        help="Rows per diagonal block with --split block (default: 8)"
+    )
+
+    parser.add_argument(
+        "--self-contained",
+        action="store_true",
+        help="Embed the full matrix in every work unit instead of sharing one matrix file"
+    )
+
+    parser.add_argument(
+        "--balance",
+        choices=["cost", "count"],
+        default="cost",
+        help="Size component ranges by estimated cost (walk lengths from the row sums, "
+             "walk counts from --pilot-output) or by equal component counts (default: cost)"
+    )
+
+    parser.add_argument(
+        "--pilot-output",
+        type=str,
+        default=None,
+        help="Output of a pilot run on this matrix (an ordinary short run, or the report "
+             "of --pilot-app); its standard errors give the walks each component needs "
+             "to reach --tolerance"
+    )
+
+    parser.add_argument(
+        "--pilot-app",
+        type=str,
+        default=None,
+        help="Standalone axb_montecarlo binary to run a pilot with before sizing the "
+             "work units (replaces --pilot-output)"
+    )
+
+    parser.add_argument(
+        "--pilot-components",
+        type=int,
+        default=DEFAULT_PILOT_COMPONENTS,
+        help=f"Components sampled by the --pilot-app run (default: {DEFAULT_PILOT_COMPONENTS})"
+    )
+
+    parser.add_argument(
+        "--pilot-walks",
+        type=int,
+        default=None,
+        help=f"Walks per component of the pilot run (default: {PILOT_WALK_FRACTION:.0%} of "
+             f"--num-walks, at least {MIN_PILOT_WALKS}, for --pilot-app; "
+             f"{DEFAULT_MIN_WALKS} for an ordinary --pilot-output)"
+    )
+
+    parser.add_argument(
+        "--target-runtime",
+        type=float,
+        default=0.0,
+        metavar="SECONDS",
+        help="Create as many work units as it takes for each to run about this long on "
+             "one core of the pilot's host (needs a pilot report; replaces "
+             "--num-work-units)"
+    )
+
+    parser.add_argument(
+        "-j", "--jobs",
+        type=int,
+        default=os.cpu_count() or 1,
+        help="Threads writing work unit input files (default: number of CPUs)"
+    )
+
+    parser.add_argument(
+        "--batch-size",
+        type=int,
+        default=DEFAULT_BATCH_SIZE,
+        help=f"Work units per \"create_work --stdin\" call, or 0 for one create_work "
+             f"call per work unit (default: {DEFAULT_BATCH_SIZE})"
+    )
+
+    parser.add_argument(
+        "--binary-output",
+        action="store_true",
+        help="Have the clients upload binary results with checksums (src/mc_result.h) "
+             "instead of text"
+    )
+
     parser.add_argument(
         "--save-matrix",
         type=str,
@@ -177,83 +915,226 @@ def main():
 
     args = parser.parse_args()
 
+    if args.tolerance < 0:
+        parser.error("--tolerance must not be negative")
+    if not 0 <= args.control_variate <= 1000:
+        parser.error("--control-variate must be between 0 and 1000")
+    if args.antithetic and args.estimator != "component":
+        parser.error("--antithetic needs --estimator component")
+    if not 0 < args.omega < 2:
+        parser.error("--omega must be in (0, 2)")
+    if not 1 <= args.block_size <= 1024:
+        parser.error("--block-size must be between 1 and 1024")
+    if args.split == "approx" and args.self_contained:
+        parser.error("--split approx needs a shared matrix (no --self-contained)")
+    if args.pilot_output and args.pilot_app:
+        parser.error("--pilot-output and --pilot-app exclude each other")
+    if args.pilot_output and not (args.tolerance or args.target_runtime):
+        parser.error("--pilot-output needs --tolerance or --target-runtime")
+    if args.pilot_app and args.estimator != "component":
+        parser.error("--pilot-app needs --estimator component")
+    if args.pilot_walks is not None and args.pilot_walks < 2:
+        parser.error("--pilot-walks must be at least 2")
+    if not 1 <= args.pilot_components <= 4096:
+        parser.error("--pilot-components must be between 1 and 4096")
+    if args.target_runtime < 0:
+        parser.error("--target-runtime must not be negative")
+    if args.target_runtime and not (args.pilot_output or args.pilot_app):
+        parser.error("--target-runtime needs --pilot-app or a pilot report (--pilot-output)")
+    if args.jobs < 1 or args.batch_size < 0:
+        parser.error("--jobs must be positive and --batch-size not negative")
+
+    options = solver_options(args)
+    if args.binary and args.self_contained and \
+            any(not option.startswith("seed=") for option in options):
+        parser.error("solver options need a parameter file or text input "
+                     "(the binary header only has a seed)")
+
     # Create output directory
     os.makedirs(args.output_dir, exist_ok=True)
 
     # Generate or load matrix
     if args.matrix_file:
         print(f"Loading matrix from {args.matrix_file}...")
-        data = np.loadtxt(args.matrix_file)
-        n = int(data[0])
-        A = data[1:n+1, :].reshape(n, n)
-        b = data[n+1, :]
+        A, b = read_matrix_file(args.matrix_file)
+        n = len(b)
         x_true = None
     else:
         print(f"Generating {args.dimension}x{args.dimension} test matrix...")
-        A, b, x_true = generate_test_matrix(
-            args.dimension,
-            diagonal_dominant=args.diagonal_dominant
-        )
+        if args.sparse:
+            A, b, x_true = generate_sparse_test_matrix(args.dimension, args.nnz_per_row)
+        else:
+            A, b, x_true = generate_test_matrix(
+                args.dimension,
+                diagonal_dominant=args.diagonal_dominant
+            )
         n = args.dimension
 
         # Save matrix if requested
         if args.save_matrix:
             with open(args.save_matrix, 'w') as f:
-                f.write(f"{n}\n")
-                for i in range(n):
-                    for j in range(n):
-                        f.write(f"{A[i, j]:.15e} ")
-                    f.write("\n")
-                for i in range(n):
-                    f.write(f"{b[i]:.15e}\n")
+                write_matrix(f, A, b)
             print(f"Matrix saved to {args.save_matrix}")
 
     # Print matrix properties
     print(f"\nMatrix properties:")
     print(f"  Dimension: {n}x{n}")
-    print(f"  Condition number: {np.linalg.cond(A):.2e}")
+    if isinstance(A, SparseMatrix):
+        print(f"  Nonzeros: {len(A.vals)}")
+    else:
+        print(f"  Condition number: {np.linalg.cond(A):.2e}")
     print(f"  Norm of b: {np.linalg.norm(b):.6f}")
 
     # Check diagonal dominance
-    diag_dom = True
-    for i in range(n):
-        row_sum = np.sum(np.abs(A[i, :])) - np.abs(A[i, i])
-        if np.abs(A[i, i]) <= row_sum:
-            diag_dom = False
-            break
+    if isinstance(A, SparseMatrix):
+        diag = np.zeros(n)
+        off_sum = np.zeros(n)
+        on_diag = A.rows == A.cols
+        np.add.at(diag, A.rows[on_diag], A.vals[on_diag])
+        np.add.at(off_sum, A.rows[~on_diag], np.abs(A.vals[~on_diag]))
+        diag_dom = bool(np.all(np.abs(diag) > off_sum))
+    else:
+        diag_dom = True
+        for i in range(n):
+            row_sum = np.sum(np.abs(A[i, :])) - np.abs(A[i, i])
+            if np.abs(A[i, i]) <= row_sum:
+                diag_dom = False
+                break
     print(f"  Diagonally dominant: {diag_dom}")
 
     if x_true is not None:
         print(f"  True solution norm: {np.linalg.norm(x_true):.6f}")
 
+    # Shared matrix file, unless every work unit carries its own copy
+    matrix_file = None
+    precond_file = None
+    if not args.self_contained:
+        matrix_file = write_shared_matrix(args.output_dir, A, b, args.num_walks, args.binary)
+        print(f"\n  Shared matrix: {matrix_file}")
+
+    # Approximate inverse, computed once here instead of on every client
+    if args.split == "approx":
+        P = approximate_inverse(A, n)
+        precond_file = write_shared_matrix(args.output_dir, P, np.zeros(n), args.num_walks,
+                                           args.binary, prefix="axb_precond")
+        print(f"  Approximate inverse: {precond_file} ({len(P.vals)} nonzeros)")
+
+    # Pilot run of the solver on a few components, with the options of
+    # the work units
+    pilot_output = args.pilot_output
+    pilot_walks = args.pilot_walks or DEFAULT_MIN_WALKS
+    if args.pilot_app:
+        pilot_walks = args.pilot_walks or min(
+            args.num_walks, max(MIN_PILOT_WALKS, int(args.num_walks * PILOT_WALK_FRACTION)))
+        pilot_matrix = matrix_file or write_shared_matrix(
+            args.output_dir, A, b, args.num_walks, args.binary, prefix="axb_pilot_matrix")
+        print(f"\nPilot run: {pilot_walks} walks at {min(args.pilot_components, n)} components...")
+        try:
+            pilot_output = run_pilot(args.pilot_app, args.output_dir, pilot_matrix, precond_file,
+                                     n, pilot_walks, args.pilot_components, options)
+        except RuntimeError as e:
+            print(f"Error: {e}")
+            sys.exit(1)
+        finally:
+            if not matrix_file:
+                os.remove(pilot_matrix)
+
+    variances = None
+    report = None
+    if pilot_output:
+        variances, report = read_pilot(pilot_output, n, pilot_walks)
+    if report is not None:
+        print(f"  Pilot: mean walk length {np.mean(report.lengths):.1f} states, "
+              f"variance {np.min(report.variances):.3g} .. {np.max(report.variances):.3g}, "
+              f"{report.seconds_per_cost() * 1e9:.1f} ns per walk step")
+    elif args.target_runtime:
+        parser.error("--target-runtime needs a pilot report, not an ordinary output")
+
+    costs = None
+    if args.balance == "cost" or args.target_runtime:
+        costs = component_costs(A, n, args, variances, report)
+
     # Distribute components across work units
     num_wu = args.num_work_units
-    components_per_wu = n // num_wu
-    remainder = n % num_wu
+    if args.target_runtime:
+        total_seconds = np.sum(costs) * report.seconds_per_cost()
+        num_wu = int(min(max(np.ceil(total_seconds / args.target_runtime), 1), n))
+        print(f"  Estimated run time: {total_seconds:.0f} s on one core, "
+              f"{num_wu} work units of about {total_seconds / num_wu:.0f} s")
+    if not 1 <= num_wu <= n:
+        parser.error(f"--num-work-units must be between 1 and {n}")
 
     print(f"\nDistributing {n} components across {num_wu} work units:")
 
-    wu_ranges = []
-    start = 0
-    for i in range(num_wu):
-        # Give extra components to first 'remainder' work units
-        end = start + components_per_wu + (1 if i < remainder else 0) - 1
-        wu_ranges.append((start, end))
-        start = end + 1
+    if args.balance == "cost":
+        wu_ranges = balanced_ranges(costs, num_wu)
+    else:
+        components_per_wu = n // num_wu
+        remainder = n % num_wu
+
+        wu_ranges = []
+        start = 0
+        for i in range(num_wu):
+            # Give extra components to first 'remainder' work units
+            end = start + components_per_wu + (1 if i < remainder else 0) - 1
+            wu_ranges.append((start, end))
+            start = end + 1
+
+    # Matrix bytes of self-contained inputs, formatted once for all of them
+    encoded = None
+    if not matrix_file:
+        encoded = encode_input(A, b, args.binary)
 
-    # Generate work unit input files
+    # Work unit input files, written in parallel
+    jobs = []
+    writes = []
     for i, (start_idx, end_idx) in enumerate(wu_ranges):
         wu_name = f"axb_wu_{i:04d}"
-        input_file = os.path.join(args.output_dir, f"{wu_name}_input.txt")
 
+        cost = f", cost {np.sum(costs[start_idx:end_idx + 1]) / np.sum(costs):.1%}" \
+            if args.balance == "cost" else ""
+        if report is not None:
+            seconds = np.sum(costs[start_idx:end_idx + 1]) * report.seconds_per_cost()
+            cost += f", ~{seconds:.0f} s"
         print(f"  WU {i}: components {start_idx}-{end_idx} " +
-              f"({end_idx - start_idx + 1} components)")
+              f"({end_idx - start_idx + 1} components{cost})")
+
+        if matrix_file:
+            params_file = os.path.join(args.output_dir, f"{wu_name}_params.txt")
+            writes.append((write_params_file, params_file, start_idx, end_idx,
+                           args.num_walks, options))
+            if precond_file:
+                input_files = [matrix_file, precond_file, params_file]
+                wu_template = "axb_precond_in.xml"
+            else:
+                input_files = [matrix_file, params_file]
+                wu_template = "axb_in.xml"
+        else:
+            extension = "bin" if args.binary else "txt"
+            input_file = os.path.join(args.output_dir, f"{wu_name}_input.{extension}")
+            writes.append((write_encoded_input, input_file, encoded, start_idx, end_idx,
+                           args.num_walks, options, args.walk_seed))
+            input_files = [input_file]
+            wu_template = "axb_single_in.xml"
+
+        jobs.append((wu_name, wu_template, input_files))
 
-        write_input_file(input_file, A, b, start_idx, end_idx, args.num_walks)
+    with ThreadPoolExecutor(max_workers=args.jobs) as pool:
+        for future in [pool.submit(*write) for write in writes]:
+            future.result()
 
-        # Create BOINC work unit if project directory specified
-        if args.boinc_project_dir:
-            create_work_unit(args.boinc_project_dir, wu_name, input_file)
+    # Create BOINC work units if project directory specified
+    if args.boinc_project_dir:
+        if args.batch_size:
+            shared_files = [path for path in (matrix_file, precond_file) if path]
+            created = create_work_units(args.boinc_project_dir, jobs, shared_files,
+                                        batch_size=args.batch_size,
+                                        binary_output=args.binary_output)
+            print(f"Created {created} of {len(jobs)} work units")
+        else:
+            for wu_name, wu_template, input_files in jobs:
+                create_work_unit(args.boinc_project_dir, wu_name, input_files,
+                                 wu_template=wu_template, binary_output=args.binary_output)
 
     print(f"\nGenerated {num_wu} work unit input files in {args.output_dir}/")
 
@@ -269,7 +1150,7 @@ def main():
 
     print("\nTo create BOINC work units, run:")
     print(f"  {sys.argv[0]} --boinc-project-dir /path/to/boinc/project \\")
-    print(f"    -n {args.dimension} -w {args.num_work_units} -s {args.num_walks}")
+    print(f"    -n {args.dimension} -w {num_wu} -s {args.num_walks}")
 
 
 if __name__ == "__main__":
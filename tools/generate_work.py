@@ -4,11 +4,18 @@ BOINC Work Generator for PI Computation Project
 
 This script generates work units for the PI computation application.
 It creates input files with varying iteration counts and submits them
-as work units to the BOINC server.
+as work units to the BOINC server, many at a time through
+"create_work --stdin" (one create_work call per work unit with
+--batch_size 0).
+
+With --experiments K each work unit runs K independent experiments of
+the given iteration count back to back, so many short experiments share
+one work unit's scheduling and validation overhead.
 
 Usage:
     ./generate_work.py --num_wu 100 --iterations 100000000
     ./generate_work.py --range 10000000:1000000000:10
+    ./generate_work.py --num_wu 10 --iterations 1000000 --experiments 1000
 """
 
 import os
@@ -19,15 +26,26 @@ import time
 from pathlib import Path
 
 
+# Work units per "create_work --stdin" call
+DEFAULT_BATCH_SIZE = 1000
+
+
 class PIWorkGenerator:
-    def __init__(self, project_dir):
+    def __init__(self, project_dir, batch_size=DEFAULT_BATCH_SIZE, experiments=1,
+                 binary_output=False):
         """
         Initialize the work generator.
 
         Args:
             project_dir: Path to BOINC project directory (e.g., ~/projects/pi_compute)
+            batch_size: Work units per create_work call (0: one call each)
+            experiments: Independent experiments per work unit
+            binary_output: Have the clients upload binary results (src/mc_result.h)
         """
         self.project_dir = Path(project_dir)
+        self.batch_size = batch_size
+        self.experiments = experiments
+        self.binary_output = binary_output
         self.download_dir = self.project_dir / "download"
         self.templates_dir = self.project_dir / "templates"
         self.bin_dir = self.project_dir / "bin"
@@ -42,8 +60,12 @@ class PIWorkGenerator:
         """
         Create an input file with specified iteration count.
 
+        With more than one experiment per work unit the file is a batch
+        ("batch K", then one iteration count per experiment); the
+        experiments have no seeds, so every replica picks its own.
+
         Args:
-            iterations: Number of iterations for PI computation
+            iterations: Number of iterations for PI computation (per experiment)
             filename: Name of the input file to create
 
         Returns:
@@ -51,27 +73,23 @@ class PIWorkGenerator:
         """
         filepath = self.download_dir / filename
         with open(filepath, 'w') as f:
-            f.write(f"{iterations}\n")
-
-        print(f"Created input file: {filename} ({iterations} iterations)")
+            if self.experiments > 1:
+                f.write(f"batch {self.experiments}\n")
+                f.write(f"{iterations}\n" * self.experiments)
+            else:
+                f.write(f"{iterations}\n")
+
+        if not self.batch_size:
+            print(f"Created input file: {filename} ({self.experiments} x {iterations} iterations)")
         return filepath
 
-    def create_work_unit(self, wu_name, input_file, fpops_est=1e12):
+    def create_work_args(self, fpops_est):
         """
-        Create a BOINC work unit.
-
-        Args:
-            wu_name: Unique name for the work unit
-            input_file: Path to input file
-            fpops_est: Estimated floating point operations
-
-        Returns:
-            True if successful, False otherwise
+        create_work options shared by all work units with this estimate
         """
-        create_work_cmd = [
+        args = [
             str(self.bin_dir / "create_work"),
             "--appname", "pi_compute",
-            "--wu_name", wu_name,
             "--wu_template", str(self.templates_dir / "pi_in.xml"),
             "--result_template", str(self.templates_dir / "pi_out.xml"),
             "--rsc_fpops_est", str(int(fpops_est)),
@@ -81,6 +99,25 @@ class PIWorkGenerator:
             "--delay_bound", "86400",  # 24 hours
             "--min_quorum", "2",  # Need 2 results
             "--target_nresults", "2",
+        ]
+        if self.binary_output:
+            args += ["--command_line", "--binary_output"]
+        return args
+
+    def create_work_unit(self, wu_name, input_file, fpops_est=1e12):
+        """
+        Create a BOINC work unit.
+
+        Args:
+            wu_name: Unique name for the work unit
+            input_file: Path to input file
+            fpops_est: Estimated floating point operations
+
+        Returns:
+            True if successful, False otherwise
+        """
+        create_work_cmd = self.create_work_args(fpops_est) + [
+            "--wu_name", wu_name,
             str(input_file)
         ]
 
@@ -99,6 +136,62 @@ class PIWorkGenerator:
             print(f"  Error: {e.stderr}")
             return False
 
+    def create_work_units(self, jobs):
+        """
+        Create work units in batches, one "create_work --stdin" call each.
+        The per-job lines carry only the name and input file, so jobs are
+        grouped by their FLOP estimate.
+
+        Args:
+            jobs: (wu_name, input_file, fpops_est) per work unit
+
+        Returns:
+            Number of work units created
+        """
+        groups = {}
+        for wu_name, input_file, fpops_est in jobs:
+            groups.setdefault(fpops_est, []).append((wu_name, input_file))
+
+        created = 0
+        for fpops_est, group in groups.items():
+            for k in range(0, len(group), self.batch_size):
+                batch = group[k:k + self.batch_size]
+                lines = "".join(f"--wu_name {wu_name} {input_file}\n"
+                                for wu_name, input_file in batch)
+                try:
+                    subprocess.run(
+                        self.create_work_args(fpops_est) + ["--stdin"],
+                        input=lines,
+                        cwd=str(self.project_dir),
+                        capture_output=True,
+                        text=True,
+                        check=True
+                    )
+                    created += len(batch)
+                    print(f"✓ Created work units {batch[0][0]} .. {batch[-1][0]}")
+                except subprocess.CalledProcessError as e:
+                    print(f"✗ Failed to create work units {batch[0][0]} .. {batch[-1][0]}:")
+                    print(f"  Error: {e.stderr}")
+
+        return created
+
+    def submit(self, jobs):
+        """
+        Create the work units of 'jobs' in batches or one by one
+        """
+        if self.batch_size:
+            return self.create_work_units(jobs)
+
+        success_count = 0
+        for i, (wu_name, input_file, fpops_est) in enumerate(jobs):
+            if self.create_work_unit(wu_name, input_file, fpops_est):
+                success_count += 1
+
+            # Small delay to avoid overwhelming the database
+            if i < len(jobs) - 1:
+                time.sleep(0.1)
+        return success_count
+
     def generate_fixed_work(self, num_units, iterations):
         """
         Generate multiple work units with same iteration count.
@@ -110,7 +203,7 @@ class PIWorkGenerator:
         print(f"\nGenerating {num_units} work units with {iterations} iterations each...")
         print("=" * 70)
 
-        success_count = 0
+        jobs = []
         for i in range(num_units):
             wu_name = f"pi_wu_{iterations}_{i:06d}"
             input_filename = f"pi_in_{wu_name}.txt"
@@ -119,15 +212,11 @@ class PIWorkGenerator:
             input_file = self.create_input_file(iterations, input_filename)
 
             # Estimate FLOPs based on iterations
-            fpops_est = iterations * 10  # Rough estimate
+            fpops_est = iterations * self.experiments * 10  # Rough estimate
 
-            # Create work unit
-            if self.create_work_unit(wu_name, input_file, fpops_est):
-                success_count += 1
+            jobs.append((wu_name, input_file, fpops_est))
 
-            # Small delay to avoid overwhelming the database
-            if i < num_units - 1:
-                time.sleep(0.1)
+        success_count = self.submit(jobs)
 
         print("=" * 70)
         print(f"Summary: {success_count}/{num_units} work units created successfully")
@@ -151,7 +240,7 @@ class PIWorkGenerator:
             step = (max_iter - min_iter) / (num_units - 1)
             iterations_list = [int(min_iter + i * step) for i in range(num_units)]
 
-        success_count = 0
+        jobs = []
         for i, iterations in enumerate(iterations_list):
             wu_name = f"pi_wu_var_{i:06d}"
             input_filename = f"pi_in_{wu_name}.txt"
@@ -160,14 +249,11 @@ class PIWorkGenerator:
             input_file = self.create_input_file(iterations, input_filename)
 
             # Estimate FLOPs
-            fpops_est = iterations * 10
+            fpops_est = iterations * self.experiments * 10
 
-            # Create work unit
-            if self.create_work_unit(wu_name, input_file, fpops_est):
-                success_count += 1
+            jobs.append((wu_name, input_file, fpops_est))
 
-            if i < num_units - 1:
-                time.sleep(0.1)
+        success_count = self.submit(jobs)
 
         print("=" * 70)
         print(f"Summary: {success_count}/{num_units} work units created successfully")
@@ -185,6 +271,9 @@ Examples:
   # Generate 50 work units with varying iterations from 10M to 1B
   %(prog)s --range 10000000:1000000000:50
 
+  # Generate 10 work units of 1000 experiments with 1 million iterations each
+  %(prog)s --num_wu 10 --iterations 1000000 --experiments 1000
+
   # Use custom project directory
   %(prog)s --project_dir ~/projects/pi_compute --num_wu 10 --iterations 50000000
         """
@@ -213,14 +302,42 @@ Examples:
         help='Number of iterations per work unit (used with --num_wu)'
     )
 
+    parser.add_argument(
+        '--batch_size',
+        type=int,
+        default=DEFAULT_BATCH_SIZE,
+        help=f'Work units per "create_work --stdin" call, 0 for one create_work call '
+             f'per work unit (default: {DEFAULT_BATCH_SIZE})'
+    )
+
+    parser.add_argument(
+        '--experiments',
+        type=int,
+        default=1,
+        help='Independent experiments per work unit, each with the given iterations '
+             '(default: 1)'
+    )
+
+    parser.add_argument(
+        '--binary_output',
+        action='store_true',
+        help='Have the clients upload binary results with checksums (src/mc_result.h) '
+             'instead of text'
+    )
+
     args = parser.parse_args()
 
     # Validate arguments
     if args.num_wu and not args.iterations:
         parser.error("--num_wu requires --iterations")
+    if args.batch_size < 0:
+        parser.error("--batch_size must not be negative")
+    if not 1 <= args.experiments <= 65536:
+        parser.error("--experiments must be 1 to 65536")
 
     try:
-        generator = PIWorkGenerator(args.project_dir)
+        generator = PIWorkGenerator(args.project_dir, args.batch_size, args.experiments,
+                                    args.binary_output)
 
         if args.num_wu:
             generator.generate_fixed_work(args.num_wu, args.iterations)